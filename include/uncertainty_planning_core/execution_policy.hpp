@@ -8,13 +8,15 @@
 #include <iostream>
 #include <stdexcept>
 #include <functional>
+#include <memory>
 #include <queue>
-#include <common_robotics_utilities/openmp_helpers.hpp>
 #include <common_robotics_utilities/print.hpp>
 #include <common_robotics_utilities/simple_rrt_planner.hpp>
 #include <common_robotics_utilities/simple_graph.hpp>
 #include <common_robotics_utilities/simple_graph_search.hpp>
 #include <uncertainty_planning_core/uncertainty_planner_state.hpp>
+#include <uncertainty_planning_core/retry_probability_solver.hpp>
+#include <uncertainty_planning_core/thread_pool.hpp>
 
 namespace uncertainty_planning_core
 {
@@ -90,12 +92,28 @@ public:
       }
       // Detect if we are a goal state and add edges to the goal
       if (child_indices.size() == 0
-          && current_planner_state.GetGoalPfeasibility() > 0.0)
+          && current_planner_state.GetGoalPfeasibility() > 0.0
+          && !current_planner_state.IsTransposition())
       {
         const double edge_weight = current_planner_state.GetGoalPfeasibility();
         policy_graph.AddEdgesBetweenNodes(
             static_cast<int64_t>(idx), goal_idx, edge_weight);
       }
+      // Transpositions are linked to the identical state they duplicate, which
+      // makes the graph a DAG (plus reverse edges) rather than a tree
+      if (current_planner_state.IsTransposition())
+      {
+        const int64_t transposition_index
+            = current_planner_state.GetTranspositionIndex();
+        if ((transposition_index < 0)
+            || (transposition_index >= static_cast<int64_t>(idx)))
+        {
+          throw std::invalid_argument(
+              "Transposition must refer to an earlier state in the tree");
+        }
+        policy_graph.AddEdgesBetweenNodes(
+            static_cast<int64_t>(idx), transposition_index, 1.0);
+      }
     }
     if (policy_graph.CheckGraphLinkage() == false)
     {
@@ -104,6 +122,19 @@ public:
     return policy_graph;
   }
 
+  // Returns true if the edge links a transposition to the state it duplicates
+  static bool IsTranspositionEdge(
+      const PolicyGraph& graph,
+      const common_robotics_utilities::simple_graph::GraphEdge& edge)
+  {
+    const UncertaintyPlanningState& from_state
+        = graph.GetNodeImmutable(edge.GetFromIndex()).GetValueImmutable();
+    const UncertaintyPlanningState& to_state
+        = graph.GetNodeImmutable(edge.GetToIndex()).GetValueImmutable();
+    return (from_state.GetTranspositionIndex() == edge.GetToIndex())
+           || (to_state.GetTranspositionIndex() == edge.GetFromIndex());
+  }
+
   static uint32_t ComputeEstimatedEdgeAttemptCount(
       const PolicyGraph& graph,
       const common_robotics_utilities::simple_graph::GraphEdge& current_edge,
@@ -164,43 +195,18 @@ public:
         return 1u;
       }
       // Compute the retry count
-      double percent_active = 1.0;
-      double p_reached = 0.0;
-      for (uint32_t try_attempt = 1; try_attempt <= edge_repeat_threshold;
-           try_attempt++)
+      RetryProbabilitySolver retry_solver;
+      retry_solver.AddOutcome(to_node_value);
+      for (size_t other_idx = 0;
+           other_idx < same_action_other_child_edges.size(); other_idx++)
       {
-        // How many particles got to our state on this attempt?
-        p_reached += (percent_active * to_node_value.GetRawEdgePfeasibility());
-        // See if we've reached our threshold
-        if (p_reached >= conformant_planning_threshold)
-        {
-          return try_attempt;
-        }
-        // Update the percent of particles that are still usefully active
-        double updated_percent_active = 0.0;
-        for (size_t other_idx = 0;
-             other_idx < same_action_other_child_edges.size(); other_idx++)
-        {
-          const auto& other_child_edge
-              = same_action_other_child_edges[other_idx];
-          const int64_t child_index = other_child_edge.GetToIndex();
-          const PolicyGraphNode& child_node
-              = graph.GetNodeImmutable(child_index);
-          const UncertaintyPlanningState& child_node_value
-              = child_node.GetValueImmutable();
-          if (child_node_value.IsActionOutcomeNominallyIndependent())
-          {
-            const double p_reached_other
-                = percent_active * child_node_value.GetRawEdgePfeasibility();
-            const double p_returned_to_parent
-                = p_reached_other
-                  * child_node_value.GetReverseEdgePfeasibility();
-            updated_percent_active += p_returned_to_parent;
-          }
-        }
-        percent_active = updated_percent_active;
+        const int64_t child_index
+            = same_action_other_child_edges[other_idx].GetToIndex();
+        retry_solver.AddOutcome(
+            graph.GetNodeImmutable(child_index).GetValueImmutable());
       }
-      return edge_repeat_threshold;
+      return retry_solver.ComputeAttemptsToReach(
+          0, conformant_planning_threshold, edge_repeat_threshold);
     }
     // If we're going backwards
     else if (from_index > to_index)
@@ -217,11 +223,11 @@ public:
   }
 
   static PolicyGraph ComputeTrueEdgeWeights(
-      const PolicyGraph& initial_graph, const double marginal_edge_weight,
+      PolicyGraph initial_graph, const double marginal_edge_weight,
       const double conformant_planning_threshold,
       const uint32_t edge_attempt_threshold)
   {
-    PolicyGraph updated_graph = initial_graph;
+    PolicyGraph updated_graph = std::move(initial_graph);
     for (size_t idx = 0; idx < updated_graph.GetNodesImmutable().size(); idx++)
     {
       PolicyGraphNode& current_node
@@ -234,9 +240,14 @@ public:
         auto& current_out_edge = current_out_edges[out_edge_index];
         // The current edge weight is the probability of that edge
         const double current_edge_weight = current_out_edge.GetWeight();
+        // Moving between identical states takes no action
+        if (IsTranspositionEdge(updated_graph, current_out_edge))
+        {
+          current_out_edge.SetWeight(0.0);
+        }
         // If the edge has positive probability, we need to consider the
         // estimated retry count of the edge
-        if (current_edge_weight > 0.0)
+        else if (current_edge_weight > 0.0)
         {
           const uint32_t estimated_attempt_count
               = ComputeEstimatedEdgeAttemptCount(
@@ -269,9 +280,14 @@ public:
         auto& current_in_edge = current_in_edges[out_edge_index];
         // The current edge weight is the probability of that edge
         const double current_edge_weight = current_in_edge.GetWeight();
+        // Moving between identical states takes no action
+        if (IsTranspositionEdge(updated_graph, current_in_edge))
+        {
+          current_in_edge.SetWeight(0.0);
+        }
         // If the edge has positive probability, we need to consider the
         // estimated retry count of the edge
-        if (current_edge_weight > 0.0)
+        else if (current_edge_weight > 0.0)
         {
           const uint32_t estimated_attempt_count
               = ComputeEstimatedEdgeAttemptCount(
@@ -383,22 +399,148 @@ private:
   typedef PolicyGraphBuilder<Configuration, ConfigSerializer, ConfigAlloc>
       ExecutionPolicyGraphBuilder;
 
+  // Planner tree shared between copies of the policy. Once a mutable reference
+  // to the tree has been handed out, writes through it can't be detected, so
+  // the tree is no longer shared: every later copy gets its own copy of the
+  // tree, and assigning to the policy replaces the tree's contents in place so
+  // that the reference stays valid.
+  class SharedPlannerTree
+  {
+  private:
+    std::shared_ptr<UncertaintyPlanningTree> tree_;
+    bool handed_out_mutably_ = false;
+
+    std::shared_ptr<UncertaintyPlanningTree> ShareTree() const
+    {
+      if (handed_out_mutably_)
+      {
+        return std::make_shared<UncertaintyPlanningTree>(*tree_);
+      }
+      else
+      {
+        return tree_;
+      }
+    }
+
+  public:
+    SharedPlannerTree()
+        : tree_(std::make_shared<UncertaintyPlanningTree>()) {}
+
+    explicit SharedPlannerTree(UncertaintyPlanningTree tree)
+        : tree_(std::make_shared<UncertaintyPlanningTree>(std::move(tree))) {}
+
+    SharedPlannerTree(const SharedPlannerTree& other)
+        : tree_(other.ShareTree()) {}
+
+    // Any mutable reference now points into this tree
+    SharedPlannerTree(SharedPlannerTree&& other)
+        : tree_(std::move(other.tree_)),
+          handed_out_mutably_(other.handed_out_mutably_)
+    {
+      other.tree_ = std::make_shared<UncertaintyPlanningTree>();
+      other.handed_out_mutably_ = false;
+    }
+
+    SharedPlannerTree& operator=(const SharedPlannerTree& other)
+    {
+      if (this != &other)
+      {
+        if (handed_out_mutably_)
+        {
+          *tree_ = *other.tree_;
+        }
+        else
+        {
+          tree_ = other.ShareTree();
+        }
+      }
+      return *this;
+    }
+
+    SharedPlannerTree& operator=(SharedPlannerTree&& other)
+    {
+      return operator=(static_cast<const SharedPlannerTree&>(other));
+    }
+
+    void Reset(UncertaintyPlanningTree tree)
+    {
+      if (handed_out_mutably_)
+      {
+        *tree_ = std::move(tree);
+      }
+      else
+      {
+        tree_ = std::make_shared<UncertaintyPlanningTree>(std::move(tree));
+      }
+    }
+
+    // Gives this policy its own copy of the tree before it is modified, if the
+    // tree is currently shared with other copies of the policy
+    void Detach()
+    {
+      if (tree_.use_count() > 1)
+      {
+        tree_ = std::make_shared<UncertaintyPlanningTree>(*tree_);
+      }
+    }
+
+    UncertaintyPlanningTree& HandOutMutably()
+    {
+      Detach();
+      handed_out_mutably_ = true;
+      return *tree_;
+    }
+
+    UncertaintyPlanningTree& operator*() { return *tree_; }
+
+    const UncertaintyPlanningTree& operator*() const { return *tree_; }
+
+    UncertaintyPlanningTree* operator->() { return tree_.get(); }
+
+    const UncertaintyPlanningTree* operator->() const { return tree_.get(); }
+  };
+
   bool initialized_ = false;
   // Raw data used to rebuild the policy graph
-  UncertaintyPlanningTree planner_tree_;
+  // The planner tree and policy graph are shared between copies of the policy
+  // and the tree is copied on write, so copying a policy (e.g. to run a policy
+  // execution) does not copy the tree, its particles, or the policy graph
+  SharedPlannerTree planner_tree_;
   Configuration goal_;
   double marginal_edge_weight_ = 0.0;
   double conformant_planning_threshold_ = 0.0;
   uint32_t edge_attempt_threshold_ = 0u;
   uint32_t policy_action_attempt_count_ = 0u;
   // Actual policy graph
-  PolicyGraph policy_graph_;
-  common_robotics_utilities::simple_graph_search::DijkstrasResult
-      policy_dijkstras_result_;
+  std::shared_ptr<const PolicyGraph> policy_graph_
+      = std::make_shared<const PolicyGraph>();
+  std::shared_ptr<const common_robotics_utilities::simple_graph_search
+      ::DijkstrasResult> policy_dijkstras_result_
+          = std::make_shared<const common_robotics_utilities
+              ::simple_graph_search::DijkstrasResult>();
   // Logging function
   std::function<void(const std::string&, const int32_t)> logging_fn_;
 
 public:
+  // Tests if a configuration is a member of the cluster of particles
+  typedef std::function<bool(const std::vector<Configuration, ConfigAlloc>&,
+                             const Configuration&)> ParticleClusteringFn;
+  // Tests if a configuration is a member of a state's cluster, so the test can
+  // use the state's cluster descriptor rather than its particles
+  typedef std::function<bool(const UncertaintyPlanningState&,
+                             const Configuration&)> StateClusteringFn;
+
+  static StateClusteringFn MakeStateClusteringFn(
+      const ParticleClusteringFn& particle_clustering_fn)
+  {
+    return [particle_clustering_fn] (const UncertaintyPlanningState& state,
+                                     const Configuration& config)
+    {
+      return particle_clustering_fn(
+          state.GetParticlePositionsImmutable().Value(), config);
+    };
+  }
+
   static uint32_t AddWithOverflowClamp(
       const uint32_t original, const uint32_t additional)
   {
@@ -437,13 +579,15 @@ public:
   }
 
   ExecutionPolicy(
-      const UncertaintyPlanningTree& planner_tree, const Configuration& goal,
+      UncertaintyPlanningTree planner_tree, const Configuration& goal,
       const double marginal_edge_weight,
       const double conformant_planning_threshold,
       const uint32_t edge_attempt_threshold,
       const uint32_t policy_action_attempt_count,
       const std::function<void(const std::string&, const int32_t)>& logging_fn)
-      : initialized_(true), planner_tree_(planner_tree), goal_(goal),
+      : initialized_(true),
+        planner_tree_(std::move(planner_tree)),
+        goal_(goal),
         marginal_edge_weight_(marginal_edge_weight),
         conformant_planning_threshold_(conformant_planning_threshold),
         edge_attempt_threshold_(edge_attempt_threshold),
@@ -477,18 +621,19 @@ public:
       const double conformant_planning_threshold,
       const uint32_t edge_attempt_threshold) const
   {
-    const PolicyGraph preliminary_policy_graph
+    PolicyGraph preliminary_policy_graph
         = ExecutionPolicyGraphBuilder::BuildPolicyGraphFromPlannerTree(
             planner_tree, UncertaintyPlanningState(goal));
-    const PolicyGraph intermediate_policy_graph
+    PolicyGraph intermediate_policy_graph
         = ExecutionPolicyGraphBuilder::ComputeTrueEdgeWeights(
-            preliminary_policy_graph, marginal_edge_weight,
+            std::move(preliminary_policy_graph), marginal_edge_weight,
             conformant_planning_threshold, edge_attempt_threshold);
-    const auto distances = ExecutionPolicyGraphBuilder::ComputeNodeDistances(
+    auto distances = ExecutionPolicyGraphBuilder::ComputeNodeDistances(
           intermediate_policy_graph,
           static_cast<int64_t>(
               intermediate_policy_graph.GetNodesImmutable().size()) - 1);
-    return std::make_pair(intermediate_policy_graph, distances);
+    return std::make_pair(std::move(intermediate_policy_graph),
+                          std::move(distances));
   }
 
   std::string PrintTree(
@@ -535,12 +680,15 @@ public:
 
   void RebuildPolicyGraph()
   {
-    const auto processed_policy_graph_components
+    auto processed_policy_graph_components
         = BuildPolicyGraphComponentsFromTree(
-            planner_tree_, goal_, marginal_edge_weight_,
+            *planner_tree_, goal_, marginal_edge_weight_,
             conformant_planning_threshold_, edge_attempt_threshold_);
-    policy_graph_ = processed_policy_graph_components.first;
-    policy_dijkstras_result_ = processed_policy_graph_components.second;
+    policy_graph_ = std::make_shared<const PolicyGraph>(
+        std::move(processed_policy_graph_components.first));
+    policy_dijkstras_result_ = std::make_shared<
+        const common_robotics_utilities::simple_graph_search::DijkstrasResult>(
+            std::move(processed_policy_graph_components.second));
   }
 
   uint64_t SerializeSelf(std::vector<uint8_t>& buffer) const
@@ -561,7 +709,7 @@ public:
           state, ser_buffer, UncertaintyPlanningState::Serialize);
     };
     SerializeVectorLike(
-        planner_tree_, buffer, planning_tree_state_serializer_fn);
+        *planner_tree_, buffer, planning_tree_state_serializer_fn);
     // Serialize the goal
     ConfigSerializer::Serialize(goal_, buffer);
     // Serialize the marginal edge weight
@@ -599,10 +747,10 @@ public:
       return UncertaintyPlanningTreeState::Deserialize(
           deser_buffer, deser_current, UncertaintyPlanningState::Deserialize);
     };
-    const std::pair<UncertaintyPlanningTree, uint64_t> planner_tree_deserialized
+    std::pair<UncertaintyPlanningTree, uint64_t> planner_tree_deserialized
         = DeserializeVectorLike<UncertaintyPlanningTreeState>(
             buffer, current_position, planning_tree_state_deserializer_fn);
-    planner_tree_ = planner_tree_deserialized.first;
+    planner_tree_.Reset(std::move(planner_tree_deserialized.first));
     current_position += planner_tree_deserialized.second;
     // Deserialize the goal
     const std::pair<Configuration, uint64_t> goal_deserialized
@@ -643,10 +791,10 @@ public:
       const std::function<std::vector<std::string>(
           const UncertaintyPlanningState&)>& state_print_fn) const
   {
-    if ((node_index >= 0) && (node_index < planner_tree_.size()))
+    if ((node_index >= 0) && (node_index < planner_tree_->size()))
     {
       const UncertaintyPlanningTreeState& policy_tree_state
-          = planner_tree_[node_index];
+          = (*planner_tree_)[static_cast<size_t>(node_index)];
       std::vector<std::string> state_string_rep;
       state_string_rep.push_back(
             "<state id=\""
@@ -711,7 +859,7 @@ public:
   {
     if (initialized_)
     {
-      return planner_tree_;
+      return *planner_tree_;
     }
     else
     {
@@ -719,11 +867,13 @@ public:
     }
   }
 
+  // Once the tree has been handed out mutably, it is no longer shared with
+  // copies of the policy, so copying the policy copies the tree
   UncertaintyPlanningTree& GetPlannerTreeMutable()
   {
     if (initialized_)
     {
-      return planner_tree_;
+      return planner_tree_.HandOutMutably();
     }
     else
     {
@@ -759,7 +909,7 @@ public:
   {
     if (initialized_)
     {
-      return planner_tree_;
+      return *planner_tree_;
     }
     else
     {
@@ -771,7 +921,7 @@ public:
   {
     if (initialized_)
     {
-      return policy_graph_;
+      return *policy_graph_;
     }
     else
     {
@@ -784,7 +934,7 @@ public:
   {
     if (initialized_)
     {
-      return policy_dijkstras_result_;
+      return *policy_dijkstras_result_;
     }
     else
     {
@@ -803,23 +953,25 @@ public:
   }
 
 private:
+  void DetachPlannerTree() { planner_tree_.Detach(); }
+
   PolicyQueryResult<Configuration> QueryNextAction(
       const int64_t current_state_index) const
   {
-    if (!policy_graph_.IndexInRange(current_state_index))
+    if (!policy_graph_->IndexInRange(current_state_index))
     {
       throw std::invalid_argument("current_state_index is out of range");
     }
     const PolicyGraphNode& result_state_policy_node
-        = policy_graph_.GetNodeImmutable(current_state_index);
+        = policy_graph_->GetNodeImmutable(current_state_index);
     const UncertaintyPlanningState& result_state
         = result_state_policy_node.GetValueImmutable();
     // Get the action to take
     // Get the previous node, as indicated by Dijkstra's algorithm
     const int64_t target_state_index
-        = policy_dijkstras_result_.GetPreviousIndex(current_state_index);
+        = policy_dijkstras_result_->GetPreviousIndex(current_state_index);
     const double expected_cost_to_goal
-          = policy_dijkstras_result_.GetNodeDistance(current_state_index);
+          = policy_dijkstras_result_->GetNodeDistance(current_state_index);
     if (target_state_index < 0)
     {
       throw std::runtime_error("Policy no longer has a solution");
@@ -828,7 +980,7 @@ private:
     // that links the graph together since this node has no meaningful value in
     // cases of goal regions
     else if (target_state_index
-             == static_cast<int64_t>(policy_graph_.Size()) - 1)
+             == static_cast<int64_t>(policy_graph_->Size()) - 1)
     {
       Log("Already at a goal state " + std::to_string(current_state_index)
           + " - cannot proceed to virtual goal state - repeating transition "
@@ -842,9 +994,20 @@ private:
     else
     {
       const PolicyGraphNode& target_state_policy_node
-          = policy_graph_.GetNodeImmutable(target_state_index);
+          = policy_graph_->GetNodeImmutable(target_state_index);
       const UncertaintyPlanningState& target_state
           = target_state_policy_node.GetValueImmutable();
+      // If we're at a transposition (or at the state it duplicates), moving
+      // between the two identical states takes no action, so we take the
+      // action of the other state instead
+      if ((result_state.GetTranspositionIndex() == target_state_index)
+          || (target_state.GetTranspositionIndex() == current_state_index))
+      {
+        Log("State " + std::to_string(current_state_index)
+            + " is identical to state " + std::to_string(target_state_index)
+            + ", returning its action", 2);
+        return QueryNextAction(target_state_index);
+      }
       // Figure out the correct action to take
       const uint64_t result_state_id = result_state.GetStateId();
       const uint64_t target_state_id = target_state.GetStateId();
@@ -889,22 +1052,20 @@ public:
       const uint64_t performed_transition_id,
       const Configuration& current_config, const bool allow_branch_jumping,
       const bool link_runtime_states_to_planned_parent,
-      const std::function<bool(
-          const std::vector<Configuration, ConfigAlloc>&,
-          const Configuration&)>& particle_clustering_fn)
+      const StateClusteringFn& state_clustering_fn)
   {
     if (initialized_)
     {
       // If we're just starting out
       if (performed_transition_id == 0)
       {
-        return QueryStartBestAction(current_config, particle_clustering_fn);
+        return QueryStartBestAction(current_config, state_clustering_fn);
       }
       else
       {
         return QueryNormalBestAction(
               performed_transition_id, current_config, allow_branch_jumping,
-              link_runtime_states_to_planned_parent, particle_clustering_fn);
+              link_runtime_states_to_planned_parent, state_clustering_fn);
       }
     }
     else
@@ -913,71 +1074,157 @@ public:
     }
   }
 
+  PolicyQueryResult<Configuration> QueryBestAction(
+      const uint64_t performed_transition_id,
+      const Configuration& current_config, const bool allow_branch_jumping,
+      const bool link_runtime_states_to_planned_parent,
+      const ParticleClusteringFn& particle_clustering_fn)
+  {
+    return QueryBestAction(
+        performed_transition_id, current_config, allow_branch_jumping,
+        link_runtime_states_to_planned_parent,
+        MakeStateClusteringFn(particle_clustering_fn));
+  }
+
+  /*
+   * Answers the same query as QueryBestAction, but does not learn from the
+   * observed outcome, so it is safe to call on a shared, immutable policy.
+   * The first element of the returned pair is false if the observed outcome
+   * matches no state in the policy - in that case, the query can only be
+   * answered by QueryBestAction adding a new state, and the second element is
+   * a placeholder that must not be used.
+   */
+  std::pair<bool, PolicyQueryResult<Configuration>>
+  QueryBestActionWithoutLearning(
+      const uint64_t performed_transition_id,
+      const Configuration& current_config, const bool allow_branch_jumping,
+      const StateClusteringFn& state_clustering_fn) const
+  {
+    if (!initialized_)
+    {
+      throw std::runtime_error("PolicyGraph is not initialized");
+    }
+    if (performed_transition_id == 0)
+    {
+      return std::make_pair(
+          true, QueryStartBestAction(current_config, state_clustering_fn));
+    }
+    const std::vector<std::pair<int64_t, bool>> expected_possible_result_states
+        = CollectPossibleResultStates(performed_transition_id).second;
+    const std::vector<std::pair<int64_t, bool>> expected_result_state_matches
+        = MatchPossibleResultStates(
+            expected_possible_result_states, current_config,
+            state_clustering_fn);
+    if (expected_result_state_matches.size() > 0)
+    {
+      // Same selection as UpdateNodeCountsAndTree, minus the count updates
+      if (expected_possible_result_states.size() == 1
+          && expected_result_state_matches.size() == 1)
+      {
+        return std::make_pair(
+            true, QueryNextAction(
+                ResultStateIndex(expected_result_state_matches.front())));
+      }
+      else
+      {
+        return std::make_pair(
+            true, QueryNextAction(ResultStateIndex(
+                SelectBestResultState(expected_result_state_matches))));
+      }
+    }
+    std::vector<std::pair<int64_t, bool>> expected_possible_result_child_states;
+    for (size_t idx = 0; idx < expected_possible_result_states.size(); idx++)
+    {
+      const int64_t possible_match_state_idx
+          = ResultStateIndex(expected_possible_result_states[idx]);
+      const std::vector<int64_t>& child_state_indices
+          = planner_tree_->at(static_cast<size_t>(possible_match_state_idx))
+              .GetChildIndices();
+      for (size_t cdx = 0; cdx < child_state_indices.size(); cdx++)
+      {
+        expected_possible_result_child_states.push_back(
+            std::make_pair(child_state_indices[cdx], false));
+      }
+    }
+    const std::vector<std::pair<int64_t, bool>>
+        expected_result_child_state_matches
+            = MatchPossibleResultStates(
+                expected_possible_result_child_states, current_config,
+                state_clustering_fn);
+    if (expected_result_child_state_matches.size() > 0)
+    {
+      return std::make_pair(
+          true, QueryNextAction(ResultStateIndex(
+              SelectBestResultState(expected_result_child_state_matches))));
+    }
+    if (allow_branch_jumping)
+    {
+      const int64_t best_matching_branch_jump_index
+          = FindBestMatchingStateInPolicy(
+              current_config, state_clustering_fn);
+      if (best_matching_branch_jump_index >= 0)
+      {
+        return std::make_pair(
+            true, QueryNextAction(best_matching_branch_jump_index));
+      }
+    }
+    return std::make_pair(
+        false, PolicyQueryResult<Configuration>(
+            -1, 0, current_config, current_config,
+            std::numeric_limits<double>::infinity(), false));
+  }
+
+  std::pair<bool, PolicyQueryResult<Configuration>>
+  QueryBestActionWithoutLearning(
+      const uint64_t performed_transition_id,
+      const Configuration& current_config, const bool allow_branch_jumping,
+      const ParticleClusteringFn& particle_clustering_fn) const
+  {
+    return QueryBestActionWithoutLearning(
+        performed_transition_id, current_config, allow_branch_jumping,
+        MakeStateClusteringFn(particle_clustering_fn));
+  }
+
 private:
   int64_t FindBestMatchingStateInPolicy(
       const Configuration& current_config,
-      const std::function<bool(
-          const std::vector<Configuration, ConfigAlloc>&,
-          const Configuration&)>& particle_clustering_fn) const
+      const StateClusteringFn& state_clustering_fn) const
   {
     // Get the starting state - NOTE, we ignore the last node in the policy
     // graph, which is the virtual goal node
-    std::vector<std::pair<int64_t, double>> per_thread_best_node(
-        common_robotics_utilities::openmp_helpers::GetNumOmpThreads(),
-        std::make_pair(-1, std::numeric_limits<double>::infinity()));
-    #pragma omp parallel for
-    for (int64_t node_idx = 0;
-         node_idx < static_cast<int64_t>(
-             policy_graph_.GetNodesImmutable().size()) - 1;
-         node_idx++)
+    const int64_t num_nodes
+        = static_cast<int64_t>(policy_graph_->GetNodesImmutable().size()) - 1;
+    ThreadPool& thread_pool = *ThreadPool::GetSharedPool();
+    const std::pair<int64_t, double> best_node = thread_pool.ParallelArgBest(
+        0, num_nodes, thread_pool.DefaultGrainSize(0, num_nodes),
+        std::numeric_limits<double>::infinity(),
+        [&] (const int64_t node_idx, double& expected_cost_to_goal)
     {
       const PolicyGraphNode& current_node
-          = policy_graph_.GetNodeImmutable(node_idx);
+          = policy_graph_->GetNodeImmutable(node_idx);
       const UncertaintyPlanningState& current_node_state
           = current_node.GetValueImmutable();
       // Are we a member of this cluster?
       // Make sure we are close enough to the start state
       const bool is_cluster_member
-          = particle_clustering_fn(
-              current_node_state.GetParticlePositionsImmutable().Value(),
-              current_config);
+          = state_clustering_fn(current_node_state, current_config);
       if (is_cluster_member)
       {
-        const int32_t thread_id
-            = common_robotics_utilities::openmp_helpers
-                ::GetContextOmpThreadNum();
-        const double expected_cost_to_goal
-            = policy_dijkstras_result_.GetNodeDistance(node_idx);
-        if (expected_cost_to_goal < per_thread_best_node[thread_id].second)
-        {
-            per_thread_best_node[thread_id].first = node_idx;
-            per_thread_best_node[thread_id].second = expected_cost_to_goal;
-        }
-      }
-    }
-    int64_t best_node_index = -1;
-    double best_node_expected_cost_to_goal
-        = std::numeric_limits<double>::infinity();
-    for (size_t idx = 0; idx < per_thread_best_node.size(); idx++)
-    {
-      const std::pair<int64_t, double>& thread_best = per_thread_best_node[idx];
-      if (thread_best.second < best_node_expected_cost_to_goal)
-      {
-        best_node_index = thread_best.first;
-        best_node_expected_cost_to_goal = thread_best.second;
+        expected_cost_to_goal
+            = policy_dijkstras_result_->GetNodeDistance(node_idx);
       }
-    }
+      return is_cluster_member;
+    }, std::less<double>());
+    const int64_t best_node_index = best_node.first;
     return best_node_index;
   }
 
   PolicyQueryResult<Configuration> QueryStartBestAction(
       const Configuration& current_config,
-      const std::function<bool(
-          const std::vector<Configuration, ConfigAlloc>&,
-          const Configuration&)>& particle_clustering_fn) const
+      const StateClusteringFn& state_clustering_fn) const
   {
     const int64_t best_node_index
-        = FindBestMatchingStateInPolicy(current_config, particle_clustering_fn);
+        = FindBestMatchingStateInPolicy(current_config, state_clustering_fn);
     if (best_node_index >= 0)
     {
       Log("Starting configuration best matches node "
@@ -991,21 +1238,79 @@ private:
     }
   }
 
-  PolicyQueryResult<Configuration> QueryNormalBestAction(
-      const uint64_t performed_transition_id,
-      const Configuration& current_config, const bool allow_branch_jumping,
-      const bool link_runtime_states_to_planned_parent,
-      const std::function<bool(
-          const std::vector<Configuration, ConfigAlloc>&,
-          const Configuration&)>& particle_clustering_fn)
+  // Resolves a (state index, is reversal) match into the index of the state
+  // the robot is actually in - for reversals, this is the parent state
+  int64_t ResultStateIndex(const std::pair<int64_t, bool>& match) const
   {
-    Log("++++++++++\nQuerying the policy with performed transition ID "
-        + std::to_string(performed_transition_id) + "...", 2);
-    if (performed_transition_id <= 0)
+    if (match.second)
     {
-      throw std::invalid_argument(
-            "performed_transition_id must be greater than zero");
+      return planner_tree_->at(static_cast<size_t>(match.first))
+          .GetParentIndex();
+    }
+    else
+    {
+      return match.first;
+    }
+  }
+
+  std::vector<std::pair<int64_t, bool>> MatchPossibleResultStates(
+      const std::vector<std::pair<int64_t, bool>>& possible_result_states,
+      const Configuration& current_config,
+      const StateClusteringFn& state_clustering_fn) const
+  {
+    std::vector<std::pair<int64_t, bool>> result_state_matches;
+    for (size_t idx = 0; idx < possible_result_states.size(); idx++)
+    {
+      const std::pair<int64_t, bool>& possible_match
+          = possible_result_states[idx];
+      const int64_t possible_match_state_idx = ResultStateIndex(possible_match);
+      const UncertaintyPlanningTreeState& possible_match_tree_state
+          = planner_tree_->at(static_cast<size_t>(possible_match_state_idx));
+      const UncertaintyPlanningState& possible_match_state
+          = possible_match_tree_state.GetValueImmutable();
+      const bool is_cluster_member
+          = state_clustering_fn(possible_match_state, current_config);
+      // If the current config is part of the cluster
+      if (is_cluster_member)
+      {
+        const Configuration possible_match_state_expectation
+            = possible_match_state.GetExpectation();
+        Log("Possible result state matches with expectation "
+            + common_robotics_utilities::print::Print(
+                possible_match_state_expectation), 1);
+        result_state_matches.push_back(possible_match);
+      }
+    }
+    return result_state_matches;
+  }
+
+  std::pair<int64_t, bool> SelectBestResultState(
+      const std::vector<std::pair<int64_t, bool>>& result_state_matches) const
+  {
+    std::pair<int64_t, bool> best_result_state(-1, false);
+    double best_distance = std::numeric_limits<double>::infinity();
+    for (size_t idx = 0; idx < result_state_matches.size(); idx++)
+    {
+      const std::pair<int64_t, bool>& result_match = result_state_matches[idx];
+      const double result_match_distance
+          = policy_dijkstras_result_->GetNodeDistance(
+              ResultStateIndex(result_match));
+      if (result_match_distance < best_distance)
+      {
+        best_result_state = result_match;
+        best_distance = result_match_distance;
+      }
+    }
+    if (best_result_state.first < 0)
+    {
+      throw std::runtime_error("Could not identify best result state");
     }
+    return best_result_state;
+  }
+
+  std::pair<int64_t, std::vector<std::pair<int64_t, bool>>>
+  CollectPossibleResultStates(const uint64_t performed_transition_id) const
+  {
     // Collect the possible states that could have resulted from the transition
     // we just performed
     std::map<int64_t, std::vector<std::pair<int64_t, bool>>>
@@ -1013,17 +1318,17 @@ private:
     std::map<int64_t, uint64_t> previous_state_index_possibilities;
     // Go through the entire tree and retrieve all states with matching
     // transition IDs
-    for (int64_t idx = 0; idx < (int64_t)planner_tree_.size(); idx++)
+    for (int64_t idx = 0; idx < (int64_t)planner_tree_->size(); idx++)
     {
       const UncertaintyPlanningTreeState& candidate_tree_state
-          = planner_tree_.at(static_cast<size_t>(idx));
+          = planner_tree_->at(static_cast<size_t>(idx));
       const UncertaintyPlanningState& candidate_state
           = candidate_tree_state.GetValueImmutable();
       if (candidate_state.GetTransitionId() == performed_transition_id)
       {
         const int64_t parent_state_idx = candidate_tree_state.GetParentIndex();
         const UncertaintyPlanningTreeState& candidate_parent_tree_state
-            = planner_tree_.at(static_cast<size_t>(parent_state_idx));
+            = planner_tree_->at(static_cast<size_t>(parent_state_idx));
         const UncertaintyPlanningState& candidate_parent_state
             = candidate_parent_tree_state.GetValueImmutable();
         expected_possibility_result_states[parent_state_idx].push_back(
@@ -1040,7 +1345,12 @@ private:
       }
     }
     int64_t previous_state_index = -1;
-    if (previous_state_index_possibilities.size() > 1)
+    if (previous_state_index_possibilities.empty())
+    {
+      throw std::runtime_error(
+            "No states in the policy match performed_transition_id");
+    }
+    else if (previous_state_index_possibilities.size() > 1)
     {
       Log("Multiple previous state index possibilities "
           + common_robotics_utilities::print::Print(
@@ -1078,43 +1388,38 @@ private:
       throw std::runtime_error(
             "expected_possible_result_states cannot be empty");
     }
+    return std::make_pair(previous_state_index, expected_possible_result_states);
+  }
+
+  PolicyQueryResult<Configuration> QueryNormalBestAction(
+      const uint64_t performed_transition_id,
+      const Configuration& current_config, const bool allow_branch_jumping,
+      const bool link_runtime_states_to_planned_parent,
+      const StateClusteringFn& state_clustering_fn)
+  {
+    Log("++++++++++\nQuerying the policy with performed transition ID "
+        + std::to_string(performed_transition_id) + "...", 2);
+    if (performed_transition_id <= 0)
+    {
+      throw std::invalid_argument(
+            "performed_transition_id must be greater than zero");
+    }
+    const std::pair<int64_t, std::vector<std::pair<int64_t, bool>>>
+        possible_result_states
+            = CollectPossibleResultStates(performed_transition_id);
+    const int64_t previous_state_index = possible_result_states.first;
+    const std::vector<std::pair<int64_t, bool>>& expected_possible_result_states
+        = possible_result_states.second;
     Log("Result state could match "
         + std::to_string(expected_possible_result_states.size())
         + " states", 2);
     ////////////////////////////////////////////////////////////////////////////
     // Check if the current config matches one or more of the expected result
     // states
-    std::vector<std::pair<int64_t, bool>> expected_result_state_matches;
-    for (size_t idx = 0; idx < expected_possible_result_states.size(); idx++)
-    {
-      const std::pair<int64_t, bool>& possible_match
-          = expected_possible_result_states[idx];
-      const int64_t possible_match_state_idx
-          = (possible_match.second)
-            ? planner_tree_.at(static_cast<size_t>(possible_match.first))
-                .GetParentIndex()
-            : possible_match.first;
-      const UncertaintyPlanningTreeState& possible_match_tree_state
-          = planner_tree_.at(static_cast<size_t>(possible_match_state_idx));
-      const UncertaintyPlanningState& possible_match_state
-          = possible_match_tree_state.GetValueImmutable();
-      const std::vector<Configuration, ConfigAlloc>&
-          possible_match_node_particles
-              = possible_match_state.GetParticlePositionsImmutable().Value();
-      const bool is_cluster_member
-          = particle_clustering_fn(
-              possible_match_node_particles, current_config);
-      // If the current config is part of the cluster
-      if (is_cluster_member)
-      {
-        const Configuration possible_match_state_expectation
-            = possible_match_state.GetExpectation();
-        Log("Possible result state matches with expectation "
-            + common_robotics_utilities::print::Print(
-                possible_match_state_expectation), 1);
-        expected_result_state_matches.push_back(possible_match);
-      }
-    }
+    const std::vector<std::pair<int64_t, bool>> expected_result_state_matches
+        = MatchPossibleResultStates(
+            expected_possible_result_states, current_config,
+            state_clustering_fn);
     // If any child states matched
     if (expected_result_state_matches.size() > 0)
     {
@@ -1144,11 +1449,11 @@ private:
             = expected_possible_result_states[idx];
         const int64_t possible_match_state_idx
             = (possible_match.second)
-              ? planner_tree_.at(static_cast<size_t>(possible_match.first))
+              ? planner_tree_->at(static_cast<size_t>(possible_match.first))
                   .GetParentIndex()
               : possible_match.first;
         const UncertaintyPlanningTreeState& possible_match_tree_state
-            = planner_tree_.at(static_cast<size_t>(possible_match_state_idx));
+            = planner_tree_->at(static_cast<size_t>(possible_match_state_idx));
         const std::vector<int64_t>& child_state_indices
             = possible_match_tree_state.GetChildIndices();
         for (size_t cdx = 0; cdx < child_state_indices.size(); cdx++)
@@ -1163,38 +1468,11 @@ private:
           + " child states", 1);
       // Check if the current config matches one or more of the expected result
       // states
-      std::vector<std::pair<int64_t, bool>> expected_result_child_state_matches;
-      for (size_t idx = 0; idx < expected_possible_result_child_states.size();
-           idx++)
-      {
-        const std::pair<int64_t, bool>& possible_match
-            = expected_possible_result_child_states[idx];
-        const int64_t possible_match_state_idx
-            = (possible_match.second)
-              ? planner_tree_.at(static_cast<size_t>(possible_match.first))
-                  .GetParentIndex()
-              : possible_match.first;
-        const UncertaintyPlanningTreeState& possible_match_tree_state
-            = planner_tree_.at(static_cast<size_t>(possible_match_state_idx));
-        const UncertaintyPlanningState& possible_match_state
-            = possible_match_tree_state.GetValueImmutable();
-        const std::vector<Configuration, ConfigAlloc>&
-            possible_match_node_particles
-                = possible_match_state.GetParticlePositionsImmutable().Value();
-        const bool is_cluster_member
-            = particle_clustering_fn(
-                possible_match_node_particles, current_config);
-        // If the current config is part of the cluster
-        if (is_cluster_member)
-        {
-          const Configuration possible_match_state_expectation
-              = possible_match_state.GetExpectation();
-          Log("Possible result child state matches with expectation "
-              + common_robotics_utilities::print::Print(
-                  possible_match_state_expectation), 1);
-          expected_result_child_state_matches.push_back(possible_match);
-        }
-      }
+      const std::vector<std::pair<int64_t, bool>>
+          expected_result_child_state_matches
+              = MatchPossibleResultStates(
+                  expected_possible_result_child_states, current_config,
+                  state_clustering_fn);
       if (expected_result_child_state_matches.size() > 0)
       {
         Log("Result state matched "
@@ -1204,36 +1482,10 @@ private:
             + " expected results child states", 1);
         // WE CANNOT LEARN ACROSS PARENT->CHILD BRANCHES
         // Select the current best-distance result state as THE result state
-        std::pair<int64_t, bool> best_result_state(-1, false);
-        double best_distance = std::numeric_limits<double>::infinity();
-        for (size_t idx = 0; idx < expected_result_child_state_matches.size();
-             idx++)
-        {
-          const std::pair<int64_t, bool>& result_match
-              = expected_result_child_state_matches[idx];
-          const int64_t result_match_state_idx
-              = (result_match.second)
-                ? planner_tree_.at(static_cast<size_t>(result_match.first))
-                    .GetParentIndex()
-                : result_match.first;
-          const double result_match_distance
-              = policy_dijkstras_result_.GetNodeDistance(
-                  result_match_state_idx);
-          if (result_match_distance < best_distance)
-          {
-            best_result_state = result_match;
-            best_distance = result_match_distance;
-          }
-        }
-        if (best_result_state.first < 0)
-        {
-          throw std::runtime_error("Could not identify best result state");
-        }
+        const std::pair<int64_t, bool> best_result_state
+            = SelectBestResultState(expected_result_child_state_matches);
         const int64_t result_state_index
-            = (best_result_state.second)
-              ? planner_tree_.at(static_cast<size_t>(best_result_state.first))
-                  .GetParentIndex()
-              : best_result_state.first;
+            = ResultStateIndex(best_result_state);
         if (best_result_state.second == false)
         {
           Log("Selected best match result child state (forward movement): "
@@ -1262,7 +1514,7 @@ private:
                 "state", 3);
           const int64_t best_matching_branch_jump_index
               = FindBestMatchingStateInPolicy(
-                  current_config, particle_clustering_fn);
+                  current_config, state_clustering_fn);
           if (best_matching_branch_jump_index >= 0)
           {
             Log("Branch jumping found a best-matching state with index "
@@ -1285,16 +1537,16 @@ private:
             + " child states, adding a new state", 3);
         // Compute the parameters of the new node
         const uint64_t new_child_state_id
-            = planner_tree_.size() + UINT64_C(1000000000);
+            = planner_tree_->size() + UINT64_C(1000000000);
         // These will get updated in the recursive call
         // (that's why the reached counts are zero)
         const uint32_t reached_count = 0u;
         const double effective_edge_Pfeasibility = 0.0;
         const double parent_motion_Pfeasibility
-            = planner_tree_.at(static_cast<size_t>(previous_state_index))
+            = planner_tree_->at(static_cast<size_t>(previous_state_index))
                 .GetValueImmutable().GetMotionPfeasibility();
         const double step_size
-            = planner_tree_.at(static_cast<size_t>(previous_state_index))
+            = planner_tree_->at(static_cast<size_t>(previous_state_index))
                 .GetValueImmutable().GetStepSize();
         // Basic prior assuming that actions are reversible
         const uint32_t reverse_attempt_count = 1u;
@@ -1303,10 +1555,10 @@ private:
         const uint64_t transition_id = performed_transition_id;
         // Get a new transition ID for the reverse
         const uint64_t reverse_transition_id
-            = planner_tree_.size() + UINT64_C(1000000000);
+            = planner_tree_->size() + UINT64_C(1000000000);
         // Get some params
         const uint64_t previous_state_reverse_transition_id
-            = planner_tree_.at(static_cast<size_t>(previous_state_index))
+            = planner_tree_->at(static_cast<size_t>(previous_state_index))
                 .GetValueImmutable().GetReverseTransitionId();
         const bool desired_transition_is_reversal
             = (performed_transition_id == previous_state_reverse_transition_id)
@@ -1337,7 +1589,7 @@ private:
             while (parent_index < 0)
             {
               const UncertaintyPlanningTreeState& candidate_parent_tree_state
-                  = planner_tree_.at(static_cast<size_t>(working_index));
+                  = planner_tree_->at(static_cast<size_t>(working_index));
               const UncertaintyPlanningState& candidate_parent_state
                   = candidate_parent_tree_state.GetValueImmutable();
               const uint64_t candidate_parent_state_id
@@ -1356,13 +1608,13 @@ private:
             }
             acting_parent_state_index = parent_index;
             const UncertaintyPlanningTreeState& parent_tree_state
-                = planner_tree_.at(static_cast<size_t>(parent_index));
+                = planner_tree_->at(static_cast<size_t>(parent_index));
             const UncertaintyPlanningState& parent_state
                 = parent_tree_state.GetValueImmutable();
             command = parent_state.GetExpectation();
             // This value doesn't really matter
             attempt_count
-                = planner_tree_.at(static_cast<size_t>(previous_state_index))
+                = planner_tree_->at(static_cast<size_t>(previous_state_index))
                     .GetValueImmutable().GetReverseAttemptAndReachedCounts()
                         .first;
             // Split IDs aren't actually used, other than > 0 meaning children
@@ -1375,16 +1627,16 @@ private:
           else
           {
             const int64_t parent_index
-                = planner_tree_.at(static_cast<size_t>(previous_state_index))
+                = planner_tree_->at(static_cast<size_t>(previous_state_index))
                     .GetParentIndex();
             const UncertaintyPlanningTreeState& parent_tree_state
-                = planner_tree_.at(static_cast<size_t>(parent_index));
+                = planner_tree_->at(static_cast<size_t>(parent_index));
             const UncertaintyPlanningState& parent_state
                 = parent_tree_state.GetValueImmutable();
             command = parent_state.GetExpectation();
             // This value doesn't really matter
             attempt_count
-                = planner_tree_.at(static_cast<size_t>(previous_state_index))
+                = planner_tree_->at(static_cast<size_t>(previous_state_index))
                     .GetValueImmutable().GetReverseAttemptAndReachedCounts()
                         .first;
             // Split IDs aren't actually used, other than > 0 meaning children
@@ -1405,7 +1657,7 @@ private:
           }
           const int64_t child_state_idx = first_possible_match.first;
           const UncertaintyPlanningTreeState& child_tree_state
-              = planner_tree_.at(static_cast<size_t>(child_state_idx));
+              = planner_tree_->at(static_cast<size_t>(child_state_idx));
           const UncertaintyPlanningState& child_state
               = child_tree_state.GetValueImmutable();
           command = child_state.GetCommand();
@@ -1425,13 +1677,14 @@ private:
         // We add a new child state to the graph
         const UncertaintyPlanningTreeState new_child_tree_state(
             new_child_state, acting_parent_state_index);
-        planner_tree_.push_back(new_child_tree_state);
+        DetachPlannerTree();
+        planner_tree_->push_back(new_child_tree_state);
         // Add the linkage to the parent (link to the last state we just added)
         const int64_t new_state_index
-            = static_cast<int64_t>(planner_tree_.size()) - 1;
+            = static_cast<int64_t>(planner_tree_->size()) - 1;
         // NOTE - by adding to the tree, we have broken any references already
         // held so we can't use the previous_index_tree_state any more!
-        planner_tree_.at(static_cast<size_t>(acting_parent_state_index))
+        planner_tree_->at(static_cast<size_t>(acting_parent_state_index))
             .AddChildIndex(new_state_index);
         // Update the policy graph with the new state
         RebuildPolicyGraph();
@@ -1439,7 +1692,7 @@ private:
         // (this time there will be an exact matching child state!)
         return QueryNormalBestAction(
             performed_transition_id, current_config, allow_branch_jumping,
-            link_runtime_states_to_planned_parent, particle_clustering_fn);
+            link_runtime_states_to_planned_parent, state_clustering_fn);
       }
     }
   }
@@ -1450,6 +1703,7 @@ private:
       const std::vector<std::pair<int64_t, bool>>&
           expected_result_state_matches)
   {
+    DetachPlannerTree();
     // If there was one possible result state and it matches
     // This should be the most likely case, and requires the least editing of
     // the tree
@@ -1464,7 +1718,7 @@ private:
       if (result_match.second == false)
       {
         UncertaintyPlanningTreeState& result_tree_state
-            = planner_tree_.at(static_cast<size_t>(result_match.first));
+            = planner_tree_->at(static_cast<size_t>(result_match.first));
         UncertaintyPlanningState& result_state
             = result_tree_state.GetValueMutable();
         const std::pair<uint32_t, uint32_t> counts
@@ -1480,7 +1734,7 @@ private:
       else
       {
         UncertaintyPlanningTreeState& result_child_tree_state
-            = planner_tree_.at(static_cast<size_t>(result_match.first));
+            = planner_tree_->at(static_cast<size_t>(result_match.first));
         UncertaintyPlanningState& result_child_state
             = result_child_tree_state.GetValueMutable();
         const std::pair<uint32_t, uint32_t> counts
@@ -1510,11 +1764,11 @@ private:
             = expected_result_state_matches[idx];
         const int64_t result_match_state_idx
             = (result_match.second)
-              ? planner_tree_.at(static_cast<size_t>(result_match.first))
+              ? planner_tree_->at(static_cast<size_t>(result_match.first))
                   .GetParentIndex()
               : result_match.first;
         const double result_match_distance
-            = policy_dijkstras_result_.GetNodeDistance(result_match_state_idx);
+            = policy_dijkstras_result_->GetNodeDistance(result_match_state_idx);
         if (result_match_distance < best_distance)
         {
           best_result_state = result_match;
@@ -1527,7 +1781,7 @@ private:
       }
       const int64_t result_state_index
           = (best_result_state.second)
-            ? planner_tree_.at(static_cast<size_t>(best_result_state.first))
+            ? planner_tree_->at(static_cast<size_t>(best_result_state.first))
                 .GetParentIndex()
             : best_result_state.first;
       if (best_result_state.second == false)
@@ -1547,7 +1801,7 @@ private:
         const std::pair<int64_t, bool>& possible_result_match
             = expected_possible_result_states[idx];
         UncertaintyPlanningTreeState& possible_result_tree_state
-            = planner_tree_.at(static_cast<size_t>(
+            = planner_tree_->at(static_cast<size_t>(
                 possible_result_match.first));
         UncertaintyPlanningState& possible_result_state
             = possible_result_tree_state.GetValueMutable();
@@ -1616,24 +1870,25 @@ private:
 
   void UpdatePlannerTreeProbabilities()
   {
+    DetachPlannerTree();
     // Let's update the entire tree. This is slower than it could be, but I
     // don't want to miss anything
     UpdateChildTransitionProbabilities(0);
     // Backtrack up the tree and update P(->goal) probabilities
-    for (int64_t idx = (static_cast<int64_t>(planner_tree_.size()) - 1);
+    for (int64_t idx = (static_cast<int64_t>(planner_tree_->size()) - 1);
          idx >= 0; idx--)
     {
       UpdateStateGoalReachedProbability(idx);
     }
     // Forward pass through the tree to update P(->goal) for leaf nodes
-    for (size_t idx = 1; idx < planner_tree_.size(); idx++)
+    for (size_t idx = 1; idx < planner_tree_->size(); idx++)
     {
       // Get the current state
-      UncertaintyPlanningTreeState& current_state = planner_tree_[idx];
+      UncertaintyPlanningTreeState& current_state = (*planner_tree_)[idx];
       const int64_t parent_index = current_state.GetParentIndex();
       // Get the parent state
       const UncertaintyPlanningTreeState& parent_state
-          = planner_tree_.at(static_cast<size_t>(parent_index));
+          = planner_tree_->at(static_cast<size_t>(parent_index));
       // If the current state is on a goal branch
       if (current_state.GetValueImmutable().GetGoalPfeasibility() > 0.0)
       {
@@ -1661,7 +1916,7 @@ private:
     // Gather all the children, split them by transition, and recompute the
     // P(->)estimated edge probabilities
     const UncertaintyPlanningTreeState& current_tree_state
-        = planner_tree_.at(static_cast<size_t>(current_state_index));
+        = planner_tree_->at(static_cast<size_t>(current_state_index));
     const std::vector<int64_t>& child_state_indices
         = current_tree_state.GetChildIndices();
     // Split them by transition IDs
@@ -1670,7 +1925,7 @@ private:
     {
       const int64_t child_state_index = child_state_indices[idx];
       const UncertaintyPlanningTreeState& child_tree_state
-          = planner_tree_.at(static_cast<size_t>(child_state_index));
+          = planner_tree_->at(static_cast<size_t>(child_state_index));
       const UncertaintyPlanningState& child_state
           = child_tree_state.GetValueImmutable();
       const uint64_t child_state_transition_id
@@ -1698,48 +1953,26 @@ private:
   {
     // Now that we have the forward-propagated states, we go back and update
     // their effective edge P(feasibility)
+    // Only if a state has nominally independent outcomes can we expect
+    // particles that return to the parent to actually reach a different outcome
+    // in future repeats
+    RetryProbabilitySolver retry_solver;
+    for (size_t idx = 0; idx < transition_child_states.size(); idx++)
+    {
+      const int64_t current_state_index = transition_child_states[idx];
+      retry_solver.AddOutcome(
+          planner_tree_->at(static_cast<size_t>(current_state_index))
+              .GetValueImmutable());
+    }
     for (size_t idx = 0; idx < transition_child_states.size(); idx++)
     {
       const int64_t current_state_index = transition_child_states[idx];
       UncertaintyPlanningTreeState& current_tree_state
-          = planner_tree_.at(static_cast<size_t>(current_state_index));
+          = planner_tree_->at(static_cast<size_t>(current_state_index));
       UncertaintyPlanningState& current_state
           = current_tree_state.GetValueMutable();
-      double percent_active = 1.0;
-      double p_reached = 0.0;
-      for (uint32_t try_attempt = 0; try_attempt < edge_attempt_threshold_;
-           try_attempt++)
-      {
-        // How many particles got to our state on this attempt?
-        p_reached += (percent_active * current_state.GetRawEdgePfeasibility());
-        // Update the percent of particles that are still usefully active
-        double updated_percent_active = 0.0;
-        for (size_t other_idx = 0; other_idx < transition_child_states.size();
-             other_idx++)
-        {
-          if (other_idx != idx)
-          {
-            const int64_t other_state_index
-                = transition_child_states[other_idx];
-            const UncertaintyPlanningTreeState& other_tree_state
-                = planner_tree_.at(static_cast<size_t>(other_state_index));
-            const UncertaintyPlanningState& other_state
-                = other_tree_state.GetValueImmutable();
-            // Only if this state has nominally independent outcomes can we
-            // expect particles that return to the parent to actually reach a
-            // different outcome in future repeats
-            if (other_state.IsActionOutcomeNominallyIndependent())
-            {
-              const double p_reached_other
-                  = percent_active * other_state.GetRawEdgePfeasibility();
-              const double p_returned_to_parent
-                  = p_reached_other * other_state.GetReverseEdgePfeasibility();
-              updated_percent_active += p_returned_to_parent;
-            }
-          }
-        }
-        percent_active = updated_percent_active;
-      }
+      double p_reached
+          = retry_solver.ComputeReachedProbability(idx, edge_attempt_threshold_);
       if ((p_reached >= 0.0) && (p_reached <= 1.0))
       {
         current_state.SetEffectiveEdgePfeasibility(p_reached);
@@ -1761,7 +1994,7 @@ private:
   void UpdateStateGoalReachedProbability(const int64_t current_state_index)
   {
     UncertaintyPlanningTreeState& current_tree_state
-        = planner_tree_.at(static_cast<size_t>(current_state_index));
+        = planner_tree_->at(static_cast<size_t>(current_state_index));
     // Check all the children of the current node, and update the node's goal
     // reached probability accordingly
     //
@@ -1786,7 +2019,7 @@ private:
       const int64_t& current_child_index
           = current_tree_state.GetChildIndices()[idx];
       const uint64_t& child_transition_id
-          = planner_tree_.at(static_cast<size_t>(current_child_index))
+          = planner_tree_->at(static_cast<size_t>(current_child_index))
               .GetValueImmutable().GetTransitionId();
       effective_child_branches[child_transition_id]
           .push_back(current_child_index);
@@ -1844,7 +2077,7 @@ private:
       const int64_t& current_child_index
           = child_node_indices[idx];
       const UncertaintyPlanningState& current_child
-          = planner_tree_.at(static_cast<size_t>(current_child_index))
+          = planner_tree_->at(static_cast<size_t>(current_child_index))
               .GetValueImmutable();
       child_states[idx] = current_child;
     }
@@ -1875,6 +2108,14 @@ private:
       // We do this the right way
       std::vector<double> action_outcomes_dependent_child_p_goal_reached;
       std::vector<double> action_outcomes_independent_child_p_goal_reached;
+      // CORRECTION (TODO: is this right?) If it is not independent, we cannot
+      // reach it if we are not there! Only if a state has nominally independent
+      // outcomes can we expect particles that return to the parent to actually
+      // reach a different outcome in future repeats
+      RetryProbabilitySolver retry_solver(child_nodes);
+      // Children with negative P(goal feasibility) cannot reach the goal
+      // directly, and thus get P(goal reached)=0 here
+      retry_solver.ClampNegativeGoalProbabilities();
       // For each child state, we compute the probability that we'll end up at
       // each of the result states, accounting for try/retry with reversibility
       // This lets us compare child states as if they were separate actions, so
@@ -1886,68 +2127,12 @@ private:
         // For the selected child, we keep track of the probability that we
         // reach the goal directly via the child state AND the probability that
         // we reach the goal from unintended other child states
-        double percent_active = 1.0;
-        double p_we_reached_goal = 0.0;
-        double p_others_reached_goal = 0.0;
-        for (uint32_t try_attempt = 0;
-             try_attempt < planner_action_try_attempts; try_attempt++)
-        {
-          // How many particles got to our state on this attempt?
-          const double p_reached
-              = percent_active * current_child.GetRawEdgePfeasibility();
-          // Children with negative P(goal feasibility) cannot reach the goal
-          // directly, and thus get P(goal reached)=0 here
-          const double raw_child_goal_Pfeasibility
-              = current_child.GetGoalPfeasibility();
-          const double child_goal_Pfeasibility
-              = (raw_child_goal_Pfeasibility > 0.0)
-                ? raw_child_goal_Pfeasibility : 0.0;
-          const double p_we_reached = p_reached * child_goal_Pfeasibility;
-          p_we_reached_goal += p_we_reached;
-          // Update the percent of particles that are still usefully active
-          // and the probability that the goal was reached via a different child
-          double updated_percent_active = 0.0;
-          double p_others_reached = 0.0;
-          for (size_t other_idx = 0; other_idx < child_nodes.size();
-               other_idx++)
-          {
-            if (other_idx != idx)
-            {
-              // Get the other child
-              const UncertaintyPlanningState& other_child
-                  = child_nodes[other_idx];
-              // CORRECTION (TODO: is this right?) If it is not independent, we
-              // cannot reach it if we are not there! Only if this state has
-              // nominally independent outcomes can we expect particles that
-              // return to the parent to actually reach a different outcome in
-              // future repeats
-              if (other_child.IsActionOutcomeNominallyIndependent())
-              {
-                const double p_reached_other
-                    = percent_active * other_child.GetRawEdgePfeasibility();
-                const double p_stuck_at_other
-                    = p_reached_other
-                      * (1.0 - other_child.GetReverseEdgePfeasibility());
-                // Children with negative P(goal feasibility) cannot reach the
-                // goal directly, and thus get P(goal reached)=0 here
-                const double raw_other_child_goal_Pfeasibility
-                    = other_child.GetGoalPfeasibility();
-                const double other_child_goal_Pfeasibility
-                    = (raw_other_child_goal_Pfeasibility > 0.0)
-                        ? raw_other_child_goal_Pfeasibility : 0.0;
-                const double p_reached_goal_from_other
-                    = p_stuck_at_other * other_child_goal_Pfeasibility;
-                p_others_reached += p_reached_goal_from_other;
-                const double p_returned_to_parent
-                    = p_reached_other
-                      * other_child.GetReverseEdgePfeasibility();
-                updated_percent_active += p_returned_to_parent;
-              }
-            }
-          }
-          p_others_reached_goal += p_others_reached;
-          percent_active = updated_percent_active;
-        }
+        const double p_we_reached_goal
+            = retry_solver.ComputeDirectGoalReachedProbability(
+                idx, planner_action_try_attempts);
+        const double p_others_reached_goal
+            = retry_solver.ComputeIndirectGoalReachedProbability(
+                idx, planner_action_try_attempts);
         double p_reached_goal = p_we_reached_goal + p_others_reached_goal;
         if ((p_reached_goal < 0.0) || (p_reached_goal > 1.0))
         {
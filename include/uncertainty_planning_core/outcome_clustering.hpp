@@ -0,0 +1,1131 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <atomic>
+#include <Eigen/Geometry>
+#include <omp.h>
+#include <common_robotics_utilities/openmp_helpers.hpp>
+#include <common_robotics_utilities/serialization.hpp>
+#include <uncertainty_planning_core/simple_outcome_clustering_interface.hpp>
+
+namespace uncertainty_planning_core
+{
+/*
+ * Union-find (disjoint set) over particle indices.
+ */
+class ParticleUnionFind
+{
+private:
+  std::vector<size_t> parents_;
+  std::vector<uint32_t> ranks_;
+
+public:
+  explicit ParticleUnionFind(const size_t num_elements)
+      : parents_(num_elements), ranks_(num_elements, 0u)
+  {
+    for (size_t idx = 0; idx < num_elements; idx++)
+    {
+      parents_[idx] = idx;
+    }
+  }
+
+  size_t Size() const { return parents_.size(); }
+
+  // Adds a new singleton set and returns its element
+  size_t AddElement()
+  {
+    const size_t element = parents_.size();
+    parents_.push_back(element);
+    ranks_.push_back(0u);
+    return element;
+  }
+
+  size_t Find(const size_t element)
+  {
+    size_t root = element;
+    while (parents_[root] != root)
+    {
+      root = parents_[root];
+    }
+    // Path compression
+    size_t current = element;
+    while (parents_[current] != root)
+    {
+      const size_t next = parents_[current];
+      parents_[current] = root;
+      current = next;
+    }
+    return root;
+  }
+
+  // Returns true if first and second were in different sets
+  bool Union(const size_t first, const size_t second)
+  {
+    size_t first_root = Find(first);
+    size_t second_root = Find(second);
+    if (first_root == second_root)
+    {
+      return false;
+    }
+    if (ranks_[first_root] < ranks_[second_root])
+    {
+      std::swap(first_root, second_root);
+    }
+    parents_[second_root] = first_root;
+    if (ranks_[first_root] == ranks_[second_root])
+    {
+      ranks_[first_root]++;
+    }
+    return true;
+  }
+
+  // Sets are ordered by their smallest element, and each set is sorted
+  std::vector<std::vector<size_t>> GetSets()
+  {
+    std::vector<int64_t> root_set_index(parents_.size(), -1);
+    std::vector<std::vector<size_t>> sets;
+    for (size_t idx = 0; idx < parents_.size(); idx++)
+    {
+      const size_t root = Find(idx);
+      if (root_set_index[root] < 0)
+      {
+        root_set_index[root] = static_cast<int64_t>(sets.size());
+        sets.push_back(std::vector<size_t>());
+      }
+      sets[static_cast<size_t>(root_set_index[root])].push_back(idx);
+    }
+    return sets;
+  }
+};
+
+/*
+ * Axis-aligned bounding box of a cluster, used as its cluster descriptor so
+ * that particles far from the cluster are rejected without scanning it.
+ */
+class ClusterBoundingBox
+{
+private:
+  Eigen::VectorXd lower_;
+  Eigen::VectorXd upper_;
+
+public:
+  ClusterBoundingBox() {}
+
+  explicit ClusterBoundingBox(const std::vector<Eigen::VectorXd>& points)
+  {
+    if (points.size() > 0)
+    {
+      lower_ = points.front();
+      upper_ = points.front();
+      for (size_t idx = 1; idx < points.size(); idx++)
+      {
+        lower_ = lower_.cwiseMin(points[idx]);
+        upper_ = upper_.cwiseMax(points[idx]);
+      }
+    }
+  }
+
+  static ClusterBoundingBox Deserialize(const std::vector<uint8_t>& buffer)
+  {
+    using common_robotics_utilities::serialization::DeserializeVectorXd;
+    ClusterBoundingBox bounding_box;
+    if (buffer.size() > 0)
+    {
+      const std::pair<Eigen::VectorXd, uint64_t> deserialized_lower
+          = DeserializeVectorXd(buffer, 0);
+      const std::pair<Eigen::VectorXd, uint64_t> deserialized_upper
+          = DeserializeVectorXd(buffer, deserialized_lower.second);
+      bounding_box.lower_ = deserialized_lower.first;
+      bounding_box.upper_ = deserialized_upper.first;
+    }
+    return bounding_box;
+  }
+
+  std::vector<uint8_t> Serialize() const
+  {
+    using common_robotics_utilities::serialization::SerializeVectorXd;
+    std::vector<uint8_t> buffer;
+    if (IsValid())
+    {
+      SerializeVectorXd(lower_, buffer);
+      SerializeVectorXd(upper_, buffer);
+    }
+    return buffer;
+  }
+
+  bool IsValid() const
+  {
+    return (lower_.size() > 0) && (lower_.size() == upper_.size());
+  }
+
+  // Is point within distance of the box along every dimension?
+  bool IsWithinDistance(const Eigen::VectorXd& point,
+                        const double distance) const
+  {
+    if (point.size() != lower_.size())
+    {
+      throw std::invalid_argument("point does not match bounding box size");
+    }
+    return ((point - lower_).array() >= -distance).all()
+           && ((upper_ - point).array() >= -distance).all();
+  }
+};
+
+/*
+ * Static KD-tree over a set of points, for Euclidean radius queries.
+ */
+class VectorXdKDTree
+{
+private:
+  struct KDTreeNode
+  {
+    // Leaves have split_dimension = -1 and contain points [begin, end)
+    int64_t split_dimension = -1;
+    double split_value = 0.0;
+    size_t begin = 0;
+    size_t end = 0;
+    int64_t left_child = -1;
+    int64_t right_child = -1;
+  };
+
+  std::vector<Eigen::VectorXd> points_;
+  std::vector<size_t> point_indices_;
+  std::vector<KDTreeNode> nodes_;
+  size_t leaf_size_ = 16;
+
+  int64_t BuildNode(const size_t begin, const size_t end)
+  {
+    const int64_t node_index = static_cast<int64_t>(nodes_.size());
+    KDTreeNode node;
+    node.begin = begin;
+    node.end = end;
+    nodes_.push_back(node);
+    if ((end - begin) <= leaf_size_)
+    {
+      return node_index;
+    }
+    // Split at the median of the dimension with the largest extent
+    Eigen::VectorXd lower = points_[point_indices_[begin]];
+    Eigen::VectorXd upper = lower;
+    for (size_t idx = begin + 1; idx < end; idx++)
+    {
+      lower = lower.cwiseMin(points_[point_indices_[idx]]);
+      upper = upper.cwiseMax(points_[point_indices_[idx]]);
+    }
+    Eigen::VectorXd::Index split_dimension = 0;
+    const double split_extent = (upper - lower).maxCoeff(&split_dimension);
+    // All points are identical, so there's nothing to split
+    if (split_extent <= 0.0)
+    {
+      return node_index;
+    }
+    const size_t middle = begin + ((end - begin) / 2);
+    std::nth_element(
+        point_indices_.begin() + static_cast<ptrdiff_t>(begin),
+        point_indices_.begin() + static_cast<ptrdiff_t>(middle),
+        point_indices_.begin() + static_cast<ptrdiff_t>(end),
+        [&] (const size_t first, const size_t second)
+    {
+      return points_[first](split_dimension) < points_[second](split_dimension);
+    });
+    const double split_value = points_[point_indices_[middle]](split_dimension);
+    const int64_t left_child = BuildNode(begin, middle);
+    const int64_t right_child = BuildNode(middle, end);
+    KDTreeNode& split_node = nodes_[static_cast<size_t>(node_index)];
+    split_node.split_dimension = static_cast<int64_t>(split_dimension);
+    split_node.split_value = split_value;
+    split_node.left_child = left_child;
+    split_node.right_child = right_child;
+    return node_index;
+  }
+
+public:
+  VectorXdKDTree() {}
+
+  explicit VectorXdKDTree(const std::vector<Eigen::VectorXd>& points,
+                          const size_t leaf_size = 16)
+      : points_(points), point_indices_(points.size()),
+        leaf_size_(std::max(leaf_size, static_cast<size_t>(1)))
+  {
+    for (size_t idx = 0; idx < point_indices_.size(); idx++)
+    {
+      point_indices_[idx] = idx;
+    }
+    if (points_.size() > 0)
+    {
+      BuildNode(0, points_.size());
+    }
+  }
+
+  size_t Size() const { return points_.size(); }
+
+  /*
+   * Calls visit_fn with the index of each point within radius of query, until
+   * visit_fn returns false. Returns false if the search was stopped early.
+   */
+  bool RadiusSearch(const Eigen::VectorXd& query, const double radius,
+                    const std::function<bool(const size_t)>& visit_fn) const
+  {
+    if (nodes_.empty())
+    {
+      return true;
+    }
+    const double squared_radius = radius * radius;
+    std::vector<int64_t> node_stack(1, 0);
+    while (node_stack.size() > 0)
+    {
+      const KDTreeNode& node
+          = nodes_[static_cast<size_t>(node_stack.back())];
+      node_stack.pop_back();
+      if (node.split_dimension < 0)
+      {
+        for (size_t idx = node.begin; idx < node.end; idx++)
+        {
+          const size_t point_index = point_indices_[idx];
+          if ((points_[point_index] - query).squaredNorm() <= squared_radius)
+          {
+            if (!visit_fn(point_index))
+            {
+              return false;
+            }
+          }
+        }
+      }
+      else
+      {
+        const double query_value = query(node.split_dimension);
+        if ((query_value - radius) <= node.split_value)
+        {
+          node_stack.push_back(node.left_child);
+        }
+        if ((query_value + radius) >= node.split_value)
+        {
+          node_stack.push_back(node.right_child);
+        }
+      }
+    }
+    return true;
+  }
+
+  bool HasPointWithinRadius(const Eigen::VectorXd& query,
+                            const double radius) const
+  {
+    return !RadiusSearch(query, radius, [] (const size_t) { return false; });
+  }
+};
+
+/*
+ * Connected-components outcome clustering: two particles are in the same
+ * cluster if they are linked by a chain of particles, each within
+ * distance_threshold of the next as measured by the robot's
+ * ComputeConfigurationDistance(), which must be thread safe.
+ *
+ * If a grid embedding function is provided, particles are hashed into grid
+ * cells of side distance_threshold over their embedded coordinates, and only
+ * particles in the same or adjacent cells are compared. This is exact as long
+ * as the embedding never overestimates distance, i.e. for all a and b,
+ * ||embed(a) - embed(b)||_inf <= ComputeConfigurationDistance(a, b) - for
+ * VectorXd configurations with Euclidean distance, the identity works.
+ * Without an embedding, all pairs of particles are compared.
+ */
+template<typename Configuration,
+         typename ConfigAlloc=std::allocator<Configuration>>
+class GridOutcomeClustering
+    : public SimpleOutcomeClusteringInterface<Configuration, ConfigAlloc>
+{
+public:
+  typedef std::function<Eigen::VectorXd(const Configuration&)>
+      GridEmbeddingFn;
+
+protected:
+  typedef typename SimpleOutcomeClusteringInterface<
+      Configuration, ConfigAlloc>::Robot Robot;
+  typedef std::vector<int64_t> GridCell;
+
+  struct GridCellHasher
+  {
+    size_t operator()(const GridCell& cell) const
+    {
+      size_t hash = 0;
+      for (size_t idx = 0; idx < cell.size(); idx++)
+      {
+        hash ^= std::hash<int64_t>()(cell[idx]) + 0x9e3779b9
+                + (hash << 6) + (hash >> 2);
+      }
+      return hash;
+    }
+  };
+
+  typedef std::unordered_map<GridCell, std::vector<size_t>, GridCellHasher>
+      GridCellMap;
+
+  double distance_threshold_;
+  GridEmbeddingFn grid_embedding_fn_;
+  int32_t debug_level_ = 0;
+  // Membership tests may run concurrently (e.g. policy matching on a thread
+  // pool), so the statistics are atomic
+  std::atomic<uint64_t> particles_clustered_;
+  std::atomic<uint64_t> distance_evaluations_;
+  std::atomic<uint64_t> membership_tests_;
+  std::atomic<uint64_t> descriptor_rejections_;
+
+  GridCell ComputeGridCell(const Eigen::VectorXd& embedded_config) const
+  {
+    GridCell cell(static_cast<size_t>(embedded_config.size()));
+    for (size_t idx = 0; idx < cell.size(); idx++)
+    {
+      cell[idx] = static_cast<int64_t>(std::floor(
+          embedded_config(static_cast<ptrdiff_t>(idx)) / distance_threshold_));
+    }
+    return cell;
+  }
+
+  template<typename ConfigFn>
+  GridCellMap BuildGridCellMap(const size_t num_configs,
+                               const ConfigFn& config_fn) const
+  {
+    std::vector<GridCell> cells(num_configs);
+    #pragma omp parallel for
+    for (int64_t idx = 0; idx < static_cast<int64_t>(num_configs); idx++)
+    {
+      cells[static_cast<size_t>(idx)] = ComputeGridCell(
+          grid_embedding_fn_(config_fn(static_cast<size_t>(idx))));
+    }
+    GridCellMap cell_map;
+    for (size_t idx = 0; idx < cells.size(); idx++)
+    {
+      cell_map[cells[idx]].push_back(idx);
+    }
+    return cell_map;
+  }
+
+  static bool AreAdjacentCells(const GridCell& first, const GridCell& second)
+  {
+    if (first.size() != second.size())
+    {
+      return false;
+    }
+    for (size_t idx = 0; idx < first.size(); idx++)
+    {
+      const int64_t offset = first[idx] - second[idx];
+      if ((offset < -1) || (offset > 1))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Returns the occupied cells adjacent to (and including) cell. In low
+   * dimensions we look up each of the 3^d neighboring cells, otherwise we scan
+   * the occupied cells.
+   */
+  std::vector<typename GridCellMap::const_iterator> FindAdjacentCells(
+      const GridCell& cell, const GridCellMap& cell_map) const
+  {
+    std::vector<typename GridCellMap::const_iterator> adjacent_cells;
+    size_t num_neighbor_cells = 1;
+    for (size_t idx = 0; idx < cell.size(); idx++)
+    {
+      num_neighbor_cells *= 3;
+      if (num_neighbor_cells > cell_map.size())
+      {
+        break;
+      }
+    }
+    if (num_neighbor_cells <= cell_map.size())
+    {
+      GridCell neighbor_cell(cell.size());
+      for (size_t neighbor = 0; neighbor < num_neighbor_cells; neighbor++)
+      {
+        size_t remaining = neighbor;
+        for (size_t idx = 0; idx < cell.size(); idx++)
+        {
+          neighbor_cell[idx]
+              = cell[idx] + static_cast<int64_t>(remaining % 3) - 1;
+          remaining /= 3;
+        }
+        const auto found_cell = cell_map.find(neighbor_cell);
+        if (found_cell != cell_map.end())
+        {
+          adjacent_cells.push_back(found_cell);
+        }
+      }
+    }
+    else
+    {
+      for (auto itr = cell_map.begin(); itr != cell_map.end(); ++itr)
+      {
+        if (AreAdjacentCells(cell, itr->first))
+        {
+          adjacent_cells.push_back(itr);
+        }
+      }
+    }
+    return adjacent_cells;
+  }
+
+  Eigen::VectorXd EmbedConfig(const Configuration& config) const
+  {
+    return grid_embedding_fn_(config);
+  }
+
+  /*
+   * Each added particle is compared with the particles added before it (only
+   * those in the same or adjacent grid cells, if there is a grid embedding),
+   * skipping particles it is already connected to. Particles are added on the
+   * calling thread, since clustering a chunk overlaps simulating the next.
+   */
+  class IncrementalGridOutcomeClustering
+      : public IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>
+  {
+  private:
+    // Not owned, and must outlive this
+    GridOutcomeClustering* clustering_;
+    std::shared_ptr<Robot> robot_;
+    std::vector<Configuration, ConfigAlloc> configs_;
+    ParticleUnionFind components_;
+    GridCellMap cell_map_;
+    uint64_t distance_evaluations_ = 0;
+
+    void Connect(const size_t particle_index, const size_t other_index)
+    {
+      if (components_.Find(particle_index) == components_.Find(other_index))
+      {
+        return;
+      }
+      distance_evaluations_++;
+      if (robot_->ComputeConfigurationDistance(
+              configs_[particle_index], configs_[other_index])
+          <= clustering_->distance_threshold_)
+      {
+        components_.Union(particle_index, other_index);
+      }
+    }
+
+  public:
+    IncrementalGridOutcomeClustering(GridOutcomeClustering* clustering,
+                                     const std::shared_ptr<Robot>& robot)
+        : clustering_(clustering), robot_(robot), components_(0u) {}
+
+    virtual void AddParticles(
+        const std::vector<SimulationResult<Configuration>>& particles,
+        const std::function<void(
+            const visualization_msgs::MarkerArray&)>& display_fn)
+    {
+      static_cast<void>(display_fn);
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        const size_t particle_index = components_.AddElement();
+        configs_.push_back(particles[idx].ResultConfig());
+        if (clustering_->grid_embedding_fn_)
+        {
+          const GridCell cell = clustering_->ComputeGridCell(
+              clustering_->EmbedConfig(configs_[particle_index]));
+          const std::vector<typename GridCellMap::const_iterator>
+              adjacent_cells = clustering_->FindAdjacentCells(cell, cell_map_);
+          for (size_t adx = 0; adx < adjacent_cells.size(); adx++)
+          {
+            const std::vector<size_t>& cell_particles
+                = adjacent_cells[adx]->second;
+            for (size_t pdx = 0; pdx < cell_particles.size(); pdx++)
+            {
+              Connect(particle_index, cell_particles[pdx]);
+            }
+          }
+          cell_map_[cell].push_back(particle_index);
+        }
+        else
+        {
+          for (size_t other_index = 0; other_index < particle_index;
+               other_index++)
+          {
+            Connect(particle_index, other_index);
+          }
+        }
+      }
+    }
+
+    virtual std::vector<std::vector<size_t>> FinishClustering(
+        const std::function<void(
+            const visualization_msgs::MarkerArray&)>& display_fn)
+    {
+      static_cast<void>(display_fn);
+      clustering_->particles_clustered_ += configs_.size();
+      clustering_->distance_evaluations_ += distance_evaluations_;
+      return components_.GetSets();
+    }
+  };
+
+public:
+  GridOutcomeClustering(const double distance_threshold,
+                        const GridEmbeddingFn& grid_embedding_fn
+                            = GridEmbeddingFn())
+      : distance_threshold_(distance_threshold),
+        grid_embedding_fn_(grid_embedding_fn), particles_clustered_(0),
+        distance_evaluations_(0), membership_tests_(0),
+        descriptor_rejections_(0)
+  {
+    if (distance_threshold_ <= 0.0)
+    {
+      throw std::invalid_argument("distance_threshold must be > 0");
+    }
+  }
+
+  virtual ~GridOutcomeClustering() {}
+
+  double GetDistanceThreshold() const { return distance_threshold_; }
+
+  virtual int32_t GetDebugLevel() const { return debug_level_; }
+
+  virtual int32_t SetDebugLevel(const int32_t debug_level)
+  {
+    debug_level_ = debug_level;
+    return debug_level_;
+  }
+
+  virtual std::map<std::string, double> GetStatistics() const
+  {
+    std::map<std::string, double> statistics;
+    statistics["Particles clustered"]
+        = static_cast<double>(particles_clustered_.load());
+    statistics["Clustering distance evaluations"]
+        = static_cast<double>(distance_evaluations_.load());
+    statistics["Cluster membership tests"]
+        = static_cast<double>(membership_tests_.load());
+    statistics["Cluster descriptor rejections"]
+        = static_cast<double>(descriptor_rejections_.load());
+    return statistics;
+  }
+
+  virtual void ResetStatistics()
+  {
+    particles_clustered_.store(0);
+    distance_evaluations_.store(0);
+    membership_tests_.store(0);
+    descriptor_rejections_.store(0);
+  }
+
+  /*
+   * Each thread connects particles using its own union-find, skipping pairs
+   * it already knows are connected, and the per-thread results are merged.
+   */
+  virtual std::vector<std::vector<size_t>> ClusterParticles(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<SimulationResult<Configuration>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    static_cast<void>(display_fn);
+    particles_clustered_ += particles.size();
+    const size_t num_threads = static_cast<size_t>(omp_get_max_threads());
+    std::vector<ParticleUnionFind> thread_components(
+        num_threads, ParticleUnionFind(particles.size()));
+    uint64_t distance_evaluations = 0;
+    // Connect particles first and second if they're within threshold
+    const auto connect_fn = [&] (ParticleUnionFind& components,
+                                 const size_t first, const size_t second)
+    {
+      if (components.Find(first) == components.Find(second))
+      {
+        return 0u;
+      }
+      if (robot->ComputeConfigurationDistance(
+              particles[first].ResultConfig(), particles[second].ResultConfig())
+          <= distance_threshold_)
+      {
+        components.Union(first, second);
+      }
+      return 1u;
+    };
+    if (grid_embedding_fn_)
+    {
+      const GridCellMap cell_map = BuildGridCellMap(
+          particles.size(), [&] (const size_t idx)
+      {
+        return particles[idx].ResultConfig();
+      });
+      std::vector<typename GridCellMap::const_iterator> occupied_cells;
+      occupied_cells.reserve(cell_map.size());
+      for (auto itr = cell_map.begin(); itr != cell_map.end(); ++itr)
+      {
+        occupied_cells.push_back(itr);
+      }
+      #pragma omp parallel for schedule(dynamic) reduction(+:distance_evaluations)
+      for (int64_t cell_idx = 0;
+           cell_idx < static_cast<int64_t>(occupied_cells.size());
+           cell_idx++)
+      {
+        ParticleUnionFind& components = thread_components[static_cast<size_t>(
+            common_robotics_utilities::openmp_helpers
+                ::GetContextOmpThreadNum())];
+        const auto& cell = occupied_cells[static_cast<size_t>(cell_idx)];
+        const std::vector<size_t>& cell_particles = cell->second;
+        const std::vector<typename GridCellMap::const_iterator>
+            adjacent_cells = FindAdjacentCells(cell->first, cell_map);
+        for (size_t adx = 0; adx < adjacent_cells.size(); adx++)
+        {
+          const auto& adjacent_cell = adjacent_cells[adx];
+          // Each pair of cells only needs to be checked once
+          if (adjacent_cell->first < cell->first)
+          {
+            continue;
+          }
+          const std::vector<size_t>& adjacent_particles
+              = adjacent_cell->second;
+          const bool same_cell = (adjacent_cell == cell);
+          for (size_t pdx = 0; pdx < cell_particles.size(); pdx++)
+          {
+            const size_t start_qdx = (same_cell) ? pdx + 1 : 0;
+            for (size_t qdx = start_qdx; qdx < adjacent_particles.size();
+                 qdx++)
+            {
+              distance_evaluations += connect_fn(
+                  components, cell_particles[pdx], adjacent_particles[qdx]);
+            }
+          }
+        }
+      }
+    }
+    else
+    {
+      #pragma omp parallel for schedule(dynamic) reduction(+:distance_evaluations)
+      for (int64_t idx = 0; idx < static_cast<int64_t>(particles.size());
+           idx++)
+      {
+        ParticleUnionFind& components = thread_components[static_cast<size_t>(
+            common_robotics_utilities::openmp_helpers
+                ::GetContextOmpThreadNum())];
+        for (size_t jdx = static_cast<size_t>(idx) + 1;
+             jdx < particles.size(); jdx++)
+        {
+          distance_evaluations
+              += connect_fn(components, static_cast<size_t>(idx), jdx);
+        }
+      }
+    }
+    distance_evaluations_ += distance_evaluations;
+    // Merge the per-thread components
+    ParticleUnionFind components(particles.size());
+    for (size_t thread = 0; thread < thread_components.size(); thread++)
+    {
+      ParticleUnionFind& current_thread_components = thread_components[thread];
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        components.Union(idx, current_thread_components.Find(idx));
+      }
+    }
+    return components.GetSets();
+  }
+
+  virtual std::unique_ptr<
+      IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>>
+  MakeIncrementalClustering(const std::shared_ptr<Robot>& robot)
+  {
+    return std::unique_ptr<
+        IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>>(
+            new IncrementalGridOutcomeClustering(this, robot));
+  }
+
+  virtual std::vector<uint8_t> IdentifyClusterMembers(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Configuration, ConfigAlloc>& cluster,
+      const std::vector<SimulationResult<Configuration>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    return IdentifyClusterMembersWithDescriptor(
+        robot, cluster, std::vector<uint8_t>(), particles, display_fn);
+  }
+
+  virtual std::vector<uint8_t> ComputeClusterDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Configuration, ConfigAlloc>& cluster)
+  {
+    static_cast<void>(robot);
+    if (!grid_embedding_fn_)
+    {
+      return std::vector<uint8_t>();
+    }
+    std::vector<Eigen::VectorXd> embedded_cluster(cluster.size());
+    for (size_t idx = 0; idx < cluster.size(); idx++)
+    {
+      embedded_cluster[idx] = EmbedConfig(cluster[idx]);
+    }
+    return ClusterBoundingBox(embedded_cluster).Serialize();
+  }
+
+  /*
+   * A particle is a member of the cluster if it is within distance_threshold
+   * of any particle in the cluster.
+   */
+  virtual std::vector<uint8_t> IdentifyClusterMembersWithDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Configuration, ConfigAlloc>& cluster,
+      const std::vector<uint8_t>& cluster_descriptor,
+      const std::vector<SimulationResult<Configuration>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    static_cast<void>(display_fn);
+    if (cluster.empty())
+    {
+      throw std::invalid_argument("cluster cannot be empty");
+    }
+    membership_tests_ += particles.size();
+    const ClusterBoundingBox bounding_box
+        = (grid_embedding_fn_)
+          ? ClusterBoundingBox::Deserialize(cluster_descriptor)
+          : ClusterBoundingBox();
+    std::vector<uint8_t> cluster_membership(particles.size(), 0x00);
+    // Reject particles outside the bounding box before doing any other work
+    std::vector<size_t> candidate_particles;
+    candidate_particles.reserve(particles.size());
+    for (size_t idx = 0; idx < particles.size(); idx++)
+    {
+      if (!bounding_box.IsValid()
+          || bounding_box.IsWithinDistance(
+              EmbedConfig(particles[idx].ResultConfig()), distance_threshold_))
+      {
+        candidate_particles.push_back(idx);
+      }
+    }
+    descriptor_rejections_ += particles.size() - candidate_particles.size();
+    if (candidate_particles.empty())
+    {
+      return cluster_membership;
+    }
+    uint64_t distance_evaluations = 0;
+    if (grid_embedding_fn_)
+    {
+      const GridCellMap cell_map = BuildGridCellMap(
+          cluster.size(), [&] (const size_t idx) { return cluster[idx]; });
+      #pragma omp parallel for reduction(+:distance_evaluations)
+      for (int64_t cdx = 0;
+           cdx < static_cast<int64_t>(candidate_particles.size()); cdx++)
+      {
+        const size_t particle_idx
+            = candidate_particles[static_cast<size_t>(cdx)];
+        const Configuration& particle = particles[particle_idx].ResultConfig();
+        const std::vector<typename GridCellMap::const_iterator>
+            adjacent_cells = FindAdjacentCells(
+                ComputeGridCell(EmbedConfig(particle)), cell_map);
+        bool is_member = false;
+        for (size_t adx = 0; (adx < adjacent_cells.size()) && !is_member;
+             adx++)
+        {
+          const std::vector<size_t>& cell_members = adjacent_cells[adx]->second;
+          for (size_t mdx = 0; (mdx < cell_members.size()) && !is_member;
+               mdx++)
+          {
+            distance_evaluations++;
+            is_member = (robot->ComputeConfigurationDistance(
+                             particle, cluster[cell_members[mdx]])
+                         <= distance_threshold_);
+          }
+        }
+        cluster_membership[particle_idx] = (is_member) ? 0x01 : 0x00;
+      }
+    }
+    else
+    {
+      #pragma omp parallel for reduction(+:distance_evaluations)
+      for (int64_t cdx = 0;
+           cdx < static_cast<int64_t>(candidate_particles.size()); cdx++)
+      {
+        const size_t particle_idx
+            = candidate_particles[static_cast<size_t>(cdx)];
+        const Configuration& particle = particles[particle_idx].ResultConfig();
+        bool is_member = false;
+        for (size_t mdx = 0; (mdx < cluster.size()) && !is_member; mdx++)
+        {
+          distance_evaluations++;
+          is_member = (robot->ComputeConfigurationDistance(
+                           particle, cluster[mdx])
+                       <= distance_threshold_);
+        }
+        cluster_membership[particle_idx] = (is_member) ? 0x01 : 0x00;
+      }
+    }
+    distance_evaluations_ += distance_evaluations;
+    return cluster_membership;
+  }
+};
+
+/*
+ * DBSCAN outcome clustering for VectorXd configurations, using Euclidean
+ * distance over the configurations (optionally weighted per dimension) and a
+ * KD-tree for neighborhood queries. The robot's distance function is not
+ * used.
+ *
+ * Particles with at least min_points particles (including themselves) within
+ * epsilon are core particles. A cluster is a connected set of core particles,
+ * each within epsilon of another, plus the other particles within epsilon of
+ * them. Particles in no cluster are noise and are left out of the returned
+ * clusters. The planner still counts noise particles as attempts of the
+ * propagation, so they lower the probability of reaching every outcome
+ * without producing an outcome of their own. With min_points = 1 (the
+ * default) there is no noise, and this is connected-components clustering.
+ */
+class KDTreeDBSCANOutcomeClustering
+    : public SimpleOutcomeClusteringInterface<
+        Eigen::VectorXd, std::allocator<Eigen::VectorXd>>
+{
+protected:
+  double epsilon_;
+  size_t min_points_;
+  Eigen::VectorXd dimension_weights_;
+  int32_t debug_level_ = 0;
+  // Membership tests may run concurrently, so the statistics are atomic
+  std::atomic<uint64_t> particles_clustered_;
+  std::atomic<uint64_t> noise_particles_;
+  std::atomic<uint64_t> membership_tests_;
+  std::atomic<uint64_t> descriptor_rejections_;
+
+  Eigen::VectorXd WeightConfig(const Eigen::VectorXd& config) const
+  {
+    if (dimension_weights_.size() == 0)
+    {
+      return config;
+    }
+    else if (dimension_weights_.size() == config.size())
+    {
+      return config.cwiseProduct(dimension_weights_);
+    }
+    else
+    {
+      throw std::invalid_argument(
+          "Configuration does not match dimension_weights size");
+    }
+  }
+
+  std::vector<Eigen::VectorXd> WeightConfigs(
+      const std::vector<Eigen::VectorXd>& configs) const
+  {
+    std::vector<Eigen::VectorXd> weighted_configs(configs.size());
+    for (size_t idx = 0; idx < configs.size(); idx++)
+    {
+      weighted_configs[idx] = WeightConfig(configs[idx]);
+    }
+    return weighted_configs;
+  }
+
+public:
+  KDTreeDBSCANOutcomeClustering(
+      const double epsilon, const size_t min_points = 1,
+      const Eigen::VectorXd& dimension_weights = Eigen::VectorXd())
+      : epsilon_(epsilon), min_points_(min_points),
+        dimension_weights_(dimension_weights), particles_clustered_(0),
+        noise_particles_(0), membership_tests_(0), descriptor_rejections_(0)
+  {
+    if (epsilon_ <= 0.0)
+    {
+      throw std::invalid_argument("epsilon must be > 0");
+    }
+    if (min_points_ < 1)
+    {
+      throw std::invalid_argument("min_points must be >= 1");
+    }
+    if ((dimension_weights_.array() < 0.0).any())
+    {
+      throw std::invalid_argument("dimension_weights must be >= 0");
+    }
+  }
+
+  virtual ~KDTreeDBSCANOutcomeClustering() {}
+
+  virtual int32_t GetDebugLevel() const { return debug_level_; }
+
+  virtual int32_t SetDebugLevel(const int32_t debug_level)
+  {
+    debug_level_ = debug_level;
+    return debug_level_;
+  }
+
+  virtual std::map<std::string, double> GetStatistics() const
+  {
+    std::map<std::string, double> statistics;
+    statistics["Particles clustered"]
+        = static_cast<double>(particles_clustered_.load());
+    statistics["Noise particles"] = static_cast<double>(noise_particles_.load());
+    statistics["Cluster membership tests"]
+        = static_cast<double>(membership_tests_.load());
+    statistics["Cluster descriptor rejections"]
+        = static_cast<double>(descriptor_rejections_.load());
+    return statistics;
+  }
+
+  virtual void ResetStatistics()
+  {
+    particles_clustered_.store(0);
+    noise_particles_.store(0);
+    membership_tests_.store(0);
+    descriptor_rejections_.store(0);
+  }
+
+  virtual std::vector<std::vector<size_t>> ClusterParticles(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<SimulationResult<Eigen::VectorXd>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    static_cast<void>(robot);
+    static_cast<void>(display_fn);
+    particles_clustered_ += particles.size();
+    std::vector<Eigen::VectorXd> points(particles.size());
+    for (size_t idx = 0; idx < particles.size(); idx++)
+    {
+      points[idx] = WeightConfig(particles[idx].ResultConfig());
+    }
+    const VectorXdKDTree kdtree(points);
+    // Identify core particles in parallel
+    std::vector<uint8_t> is_core(points.size(), 0x00);
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t idx = 0; idx < static_cast<int64_t>(points.size()); idx++)
+    {
+      size_t num_neighbors = 0;
+      kdtree.RadiusSearch(
+          points[static_cast<size_t>(idx)], epsilon_, [&] (const size_t)
+      {
+        num_neighbors++;
+        return (num_neighbors < min_points_);
+      });
+      is_core[static_cast<size_t>(idx)]
+          = (num_neighbors >= min_points_) ? 0x01 : 0x00;
+    }
+    // Grow clusters from the core particles
+    std::vector<int64_t> cluster_labels(points.size(), -1);
+    std::vector<std::vector<size_t>> clusters;
+    std::vector<size_t> expansion_queue;
+    for (size_t idx = 0; idx < points.size(); idx++)
+    {
+      if ((is_core[idx] == 0x00) || (cluster_labels[idx] >= 0))
+      {
+        continue;
+      }
+      const int64_t cluster_label = static_cast<int64_t>(clusters.size());
+      clusters.push_back(std::vector<size_t>());
+      std::vector<size_t>& cluster = clusters.back();
+      cluster_labels[idx] = cluster_label;
+      expansion_queue.assign(1, idx);
+      while (expansion_queue.size() > 0)
+      {
+        const size_t current_idx = expansion_queue.back();
+        expansion_queue.pop_back();
+        cluster.push_back(current_idx);
+        // Only core particles extend the cluster
+        if (is_core[current_idx] == 0x00)
+        {
+          continue;
+        }
+        kdtree.RadiusSearch(
+            points[current_idx], epsilon_, [&] (const size_t neighbor_idx)
+        {
+          if (cluster_labels[neighbor_idx] < 0)
+          {
+            cluster_labels[neighbor_idx] = cluster_label;
+            expansion_queue.push_back(neighbor_idx);
+          }
+          return true;
+        });
+      }
+      std::sort(cluster.begin(), cluster.end());
+    }
+    uint64_t noise_particles = 0;
+    for (size_t idx = 0; idx < cluster_labels.size(); idx++)
+    {
+      if (cluster_labels[idx] < 0)
+      {
+        noise_particles++;
+      }
+    }
+    noise_particles_ += noise_particles;
+    return clusters;
+  }
+
+  virtual std::vector<uint8_t> IdentifyClusterMembers(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Eigen::VectorXd>& cluster,
+      const std::vector<SimulationResult<Eigen::VectorXd>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    return IdentifyClusterMembersWithDescriptor(
+        robot, cluster, std::vector<uint8_t>(), particles, display_fn);
+  }
+
+  virtual std::vector<uint8_t> ComputeClusterDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Eigen::VectorXd>& cluster)
+  {
+    static_cast<void>(robot);
+    return ClusterBoundingBox(WeightConfigs(cluster)).Serialize();
+  }
+
+  /*
+   * A particle is a member of the cluster if it is within epsilon of any
+   * particle in the cluster.
+   */
+  virtual std::vector<uint8_t> IdentifyClusterMembersWithDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Eigen::VectorXd>& cluster,
+      const std::vector<uint8_t>& cluster_descriptor,
+      const std::vector<SimulationResult<Eigen::VectorXd>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    static_cast<void>(robot);
+    static_cast<void>(display_fn);
+    if (cluster.empty())
+    {
+      throw std::invalid_argument("cluster cannot be empty");
+    }
+    membership_tests_ += particles.size();
+    const ClusterBoundingBox bounding_box
+        = ClusterBoundingBox::Deserialize(cluster_descriptor);
+    std::vector<uint8_t> cluster_membership(particles.size(), 0x00);
+    // Reject particles outside the bounding box before building the KD-tree
+    std::vector<size_t> candidate_particles;
+    std::vector<Eigen::VectorXd> candidate_points;
+    candidate_particles.reserve(particles.size());
+    candidate_points.reserve(particles.size());
+    for (size_t idx = 0; idx < particles.size(); idx++)
+    {
+      const Eigen::VectorXd point = WeightConfig(particles[idx].ResultConfig());
+      if (!bounding_box.IsValid()
+          || bounding_box.IsWithinDistance(point, epsilon_))
+      {
+        candidate_particles.push_back(idx);
+        candidate_points.push_back(point);
+      }
+    }
+    descriptor_rejections_ += particles.size() - candidate_particles.size();
+    if (candidate_particles.empty())
+    {
+      return cluster_membership;
+    }
+    const VectorXdKDTree kdtree(WeightConfigs(cluster));
+    #pragma omp parallel for
+    for (int64_t cdx = 0;
+         cdx < static_cast<int64_t>(candidate_particles.size()); cdx++)
+    {
+      const bool is_member = kdtree.HasPointWithinRadius(
+          candidate_points[static_cast<size_t>(cdx)], epsilon_);
+      cluster_membership[candidate_particles[static_cast<size_t>(cdx)]]
+          = (is_member) ? 0x01 : 0x00;
+    }
+    return cluster_membership;
+  }
+};
+}  // namespace uncertainty_planning_core
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <condition_variable>
+#include <stdexcept>
+#include <functional>
+#include <Eigen/Geometry>
+#include <uncertainty_planning_core/execution_policy.hpp>
+
+namespace uncertainty_planning_core
+{
+/*
+ * Double-buffered execution policy that learns in the background.
+ *
+ * Action queries are answered from the most recently published immutable
+ * policy snapshot, and the observed outcomes are queued to a learner thread
+ * that applies them (attempt/reached count updates, new runtime states, graph
+ * rebuilds) to a private working copy. Once the queue is drained, the learner
+ * publishes a new snapshot.
+ *
+ * Queries never wait on learning unless the observed outcome matches no state
+ * in the current snapshot - answering such a query requires adding a new
+ * state, so the query waits for the learner to add it and publish.
+ *
+ * Since the snapshot may not yet include the outcomes just observed, the
+ * actions chosen depend on thread timing, and executions are not reproducible
+ * even with a seeded simulator. Use ExecutionPolicy::QueryBestAction directly
+ * if you need deterministic execution.
+ *
+ * If your particle clustering function is not thread safe, you will have a bad
+ * time!
+ */
+template<typename Configuration, typename ConfigSerializer,
+         typename ConfigAlloc=std::allocator<Configuration>>
+class AsyncPolicyLearner
+{
+public:
+  typedef ExecutionPolicy<Configuration, ConfigSerializer, ConfigAlloc>
+      Policy;
+  typedef std::shared_ptr<const Policy> PolicySnapshot;
+  typedef typename Policy::ParticleClusteringFn ParticleClusteringFn;
+  typedef typename Policy::StateClusteringFn StateClusteringFn;
+
+private:
+  struct PolicyObservation
+  {
+    uint64_t performed_transition_id = 0;
+    Configuration current_config;
+    bool allow_branch_jumping = false;
+    bool link_runtime_states_to_planned_parent = false;
+    // Only set if the query is waiting on the learner for its result
+    std::shared_ptr<std::promise<PolicyQueryResult<Configuration>>>
+        query_result;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  typedef std::deque<PolicyObservation,
+                     Eigen::aligned_allocator<PolicyObservation>>
+      PolicyObservationQueue;
+  typedef std::pair<
+      std::shared_ptr<std::promise<PolicyQueryResult<Configuration>>>,
+      PolicyQueryResult<Configuration>> ReadyQueryResult;
+
+  StateClusteringFn state_clustering_fn_;
+  // Only ever touched by the learner thread (or once the learner is idle)
+  Policy working_policy_;
+  // Published snapshot
+  mutable std::mutex snapshot_mutex_;
+  PolicySnapshot snapshot_;
+  // Observation queue
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::condition_variable idle_cv_;
+  PolicyObservationQueue observation_queue_;
+  bool learner_busy_ = false;
+  bool shutdown_ = false;
+  std::thread learner_thread_;
+
+public:
+  AsyncPolicyLearner(const Policy& initial_policy,
+                     const ParticleClusteringFn& particle_clustering_fn)
+      : AsyncPolicyLearner(
+          initial_policy,
+          Policy::MakeStateClusteringFn(particle_clustering_fn)) {}
+
+  AsyncPolicyLearner(const Policy& initial_policy,
+                     const StateClusteringFn& state_clustering_fn)
+      : state_clustering_fn_(state_clustering_fn),
+        working_policy_(initial_policy),
+        snapshot_(std::make_shared<const Policy>(initial_policy))
+  {
+    if (!initial_policy.IsInitialized())
+    {
+      throw std::invalid_argument("initial_policy is not initialized");
+    }
+    learner_thread_ = std::thread(&AsyncPolicyLearner::LearnerLoop, this);
+  }
+
+  AsyncPolicyLearner(const AsyncPolicyLearner&) = delete;
+
+  AsyncPolicyLearner& operator=(const AsyncPolicyLearner&) = delete;
+
+  ~AsyncPolicyLearner()
+  {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      shutdown_ = true;
+    }
+    queue_cv_.notify_all();
+    if (learner_thread_.joinable())
+    {
+      learner_thread_.join();
+    }
+  }
+
+  PolicySnapshot GetSnapshot() const
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    return snapshot_;
+  }
+
+  /*
+   * Queries the current snapshot for the next action and queues the observed
+   * outcome for learning.
+   */
+  PolicyQueryResult<Configuration> QueryBestAction(
+      const uint64_t performed_transition_id,
+      const Configuration& current_config, const bool allow_branch_jumping,
+      const bool link_runtime_states_to_planned_parent)
+  {
+    const PolicySnapshot snapshot = GetSnapshot();
+    const std::pair<bool, PolicyQueryResult<Configuration>> snapshot_result
+        = snapshot->QueryBestActionWithoutLearning(
+            performed_transition_id, current_config, allow_branch_jumping,
+            state_clustering_fn_);
+    // Starting queries do not update the policy, so there is nothing to learn
+    if (performed_transition_id == 0)
+    {
+      return snapshot_result.second;
+    }
+    PolicyObservation observation;
+    observation.performed_transition_id = performed_transition_id;
+    observation.current_config = current_config;
+    observation.allow_branch_jumping = allow_branch_jumping;
+    observation.link_runtime_states_to_planned_parent
+        = link_runtime_states_to_planned_parent;
+    if (snapshot_result.first)
+    {
+      EnqueueObservation(observation);
+      return snapshot_result.second;
+    }
+    else
+    {
+      observation.query_result
+          = std::make_shared<std::promise<PolicyQueryResult<Configuration>>>();
+      std::future<PolicyQueryResult<Configuration>> query_future
+          = observation.query_result->get_future();
+      EnqueueObservation(observation);
+      return query_future.get();
+    }
+  }
+
+  // Blocks until every queued observation has been learned and published
+  void WaitUntilIdle()
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    idle_cv_.wait(lock, [&] ()
+    {
+      return observation_queue_.empty() && !learner_busy_;
+    });
+  }
+
+  // Returns the policy with every queued observation learned
+  PolicySnapshot GetLearnedPolicy()
+  {
+    WaitUntilIdle();
+    return GetSnapshot();
+  }
+
+private:
+  void EnqueueObservation(const PolicyObservation& observation)
+  {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      observation_queue_.push_back(observation);
+    }
+    queue_cv_.notify_one();
+  }
+
+  void LearnerLoop()
+  {
+    while (true)
+    {
+      PolicyObservationQueue observations;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_cv_.wait(lock, [&] ()
+        {
+          return shutdown_ || !observation_queue_.empty();
+        });
+        if (observation_queue_.empty())
+        {
+          // Only reachable on shutdown
+          return;
+        }
+        observations.swap(observation_queue_);
+        learner_busy_ = true;
+      }
+      // Learn from the entire batch, then publish once
+      std::vector<ReadyQueryResult, Eigen::aligned_allocator<ReadyQueryResult>>
+          ready_results;
+      for (size_t idx = 0; idx < observations.size(); idx++)
+      {
+        const PolicyObservation& observation = observations[idx];
+        try
+        {
+          const PolicyQueryResult<Configuration> query_result
+              = working_policy_.QueryBestAction(
+                  observation.performed_transition_id,
+                  observation.current_config,
+                  observation.allow_branch_jumping,
+                  observation.link_runtime_states_to_planned_parent,
+                  state_clustering_fn_);
+          if (observation.query_result)
+          {
+            ready_results.push_back(
+                std::make_pair(observation.query_result, query_result));
+          }
+        }
+        catch (...)
+        {
+          if (observation.query_result)
+          {
+            observation.query_result->set_exception(std::current_exception());
+          }
+          else
+          {
+            working_policy_.Log(
+                "Background policy learning failed for transition "
+                + std::to_string(observation.performed_transition_id), 4);
+          }
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(snapshot_mutex_);
+        snapshot_ = std::make_shared<const Policy>(working_policy_);
+      }
+      // Waiting queries must see the snapshot containing their new states
+      for (size_t idx = 0; idx < ready_results.size(); idx++)
+      {
+        ready_results[idx].first->set_value(ready_results[idx].second);
+      }
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        learner_busy_ = false;
+      }
+      idle_cv_.notify_all();
+    }
+  }
+};
+}  // namespace uncertainty_planning_core
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+namespace uncertainty_planning_core
+{
+/*
+ * Try/retry probabilities for the outcomes of a single (split) transition.
+ *
+ * When an action is retried, particles that reach a nominally independent
+ * outcome j other than the one we want return to the parent with probability
+ * raw_j * reverse_j and try again. For outcome i, the fraction of particles
+ * still active at attempt t is therefore r_i^t, where
+ *
+ *   r_i = sum_{j != i, j independent} raw_j * reverse_j
+ *
+ * so every quantity accumulated over N attempts is a geometric series
+ * sum_{t=0}^{N-1} r_i^t = (1 - r_i^N) / (1 - r_i). The totals over all
+ * outcomes are shared, so each outcome is O(1) instead of O(attempts * k).
+ */
+class RetryProbabilitySolver
+{
+private:
+  struct RetryOutcome
+  {
+    double raw_edge_pfeasibility = 0.0;
+    double reverse_edge_pfeasibility = 0.0;
+    double goal_pfeasibility = 0.0;
+    bool action_outcome_nominally_independent = false;
+
+    // Probability of reaching this outcome and returning to the parent
+    double ReturnProbability() const
+    {
+      return (action_outcome_nominally_independent)
+             ? raw_edge_pfeasibility * reverse_edge_pfeasibility : 0.0;
+    }
+
+    // Probability of reaching this outcome, staying there, and then reaching
+    // the goal from it
+    double StuckGoalProbability() const
+    {
+      return (action_outcome_nominally_independent)
+             ? raw_edge_pfeasibility * (1.0 - reverse_edge_pfeasibility)
+               * goal_pfeasibility
+             : 0.0;
+    }
+  };
+
+  std::vector<RetryOutcome> outcomes_;
+  double total_return_probability_ = 0.0;
+  double total_stuck_goal_probability_ = 0.0;
+
+  void CheckOutcomeIndex(const size_t outcome_index) const
+  {
+    if (outcome_index >= outcomes_.size())
+    {
+      throw std::out_of_range("outcome_index out of range");
+    }
+  }
+
+public:
+  /*
+   * Returns sum_{t=0}^{attempts-1} return_rate^t. Close to 1 the closed form
+   * loses precision, so we sum the series directly instead.
+   */
+  static double ComputeGeometricSum(
+      const double return_rate, const uint32_t attempts)
+  {
+    if (return_rate <= 0.0)
+    {
+      return (attempts > 0u) ? 1.0 : 0.0;
+    }
+    else if (return_rate < (1.0 - 1e-6))
+    {
+      return (1.0 - std::pow(return_rate, static_cast<double>(attempts)))
+             / (1.0 - return_rate);
+    }
+    else
+    {
+      double geometric_sum = 0.0;
+      double term = 1.0;
+      for (uint32_t attempt = 0; attempt < attempts; attempt++)
+      {
+        geometric_sum += term;
+        term *= return_rate;
+      }
+      return geometric_sum;
+    }
+  }
+
+  RetryProbabilitySolver() {}
+
+  template<typename State>
+  explicit RetryProbabilitySolver(const std::vector<State>& outcome_states)
+  {
+    outcomes_.reserve(outcome_states.size());
+    for (size_t idx = 0; idx < outcome_states.size(); idx++)
+    {
+      AddOutcome(outcome_states[idx]);
+    }
+  }
+
+  template<typename State>
+  void AddOutcome(const State& outcome_state)
+  {
+    AddOutcome(outcome_state.GetRawEdgePfeasibility(),
+               outcome_state.GetReverseEdgePfeasibility(),
+               outcome_state.GetGoalPfeasibility(),
+               outcome_state.IsActionOutcomeNominallyIndependent());
+  }
+
+  void AddOutcome(const double raw_edge_pfeasibility,
+                  const double reverse_edge_pfeasibility,
+                  const double goal_pfeasibility,
+                  const bool action_outcome_nominally_independent)
+  {
+    RetryOutcome outcome;
+    outcome.raw_edge_pfeasibility = raw_edge_pfeasibility;
+    outcome.reverse_edge_pfeasibility = reverse_edge_pfeasibility;
+    outcome.goal_pfeasibility = goal_pfeasibility;
+    outcome.action_outcome_nominally_independent
+        = action_outcome_nominally_independent;
+    total_return_probability_ += outcome.ReturnProbability();
+    total_stuck_goal_probability_ += outcome.StuckGoalProbability();
+    outcomes_.push_back(outcome);
+  }
+
+  // Children with negative P(goal feasibility) cannot reach the goal directly,
+  // and thus get P(goal reached)=0
+  void ClampNegativeGoalProbabilities()
+  {
+    total_stuck_goal_probability_ = 0.0;
+    for (size_t idx = 0; idx < outcomes_.size(); idx++)
+    {
+      RetryOutcome& outcome = outcomes_[idx];
+      if (outcome.goal_pfeasibility < 0.0)
+      {
+        outcome.goal_pfeasibility = 0.0;
+      }
+      total_stuck_goal_probability_ += outcome.StuckGoalProbability();
+    }
+  }
+
+  size_t NumOutcomes() const { return outcomes_.size(); }
+
+  // Fraction of active particles that return to the parent after each attempt
+  // that doesn't reach the outcome
+  double ReturnRate(const size_t outcome_index) const
+  {
+    CheckOutcomeIndex(outcome_index);
+    const double return_rate = total_return_probability_
+        - outcomes_[outcome_index].ReturnProbability();
+    return (return_rate > 0.0) ? return_rate : 0.0;
+  }
+
+  // P(reached outcome) within attempts tries, i.e. the effective edge
+  // P(feasibility)
+  double ComputeReachedProbability(
+      const size_t outcome_index, const uint32_t attempts) const
+  {
+    return outcomes_.at(outcome_index).raw_edge_pfeasibility
+           * ComputeGeometricSum(ReturnRate(outcome_index), attempts);
+  }
+
+  // P(goal reached) via the outcome itself within attempts tries
+  double ComputeDirectGoalReachedProbability(
+      const size_t outcome_index, const uint32_t attempts) const
+  {
+    return ComputeReachedProbability(outcome_index, attempts)
+           * outcomes_.at(outcome_index).goal_pfeasibility;
+  }
+
+  // P(goal reached) via getting stuck at one of the other outcomes within
+  // attempts tries
+  double ComputeIndirectGoalReachedProbability(
+      const size_t outcome_index, const uint32_t attempts) const
+  {
+    const double other_stuck_goal_probability = total_stuck_goal_probability_
+        - outcomes_.at(outcome_index).StuckGoalProbability();
+    if (other_stuck_goal_probability <= 0.0)
+    {
+      return 0.0;
+    }
+    return other_stuck_goal_probability
+           * ComputeGeometricSum(ReturnRate(outcome_index), attempts);
+  }
+
+  /*
+   * Returns the number of attempts needed for P(reached outcome) to meet the
+   * threshold, or max_attempts if it can't be met.
+   */
+  uint32_t ComputeAttemptsToReach(
+      const size_t outcome_index, const double threshold,
+      const uint32_t max_attempts) const
+  {
+    const double raw_edge_pfeasibility
+        = outcomes_.at(outcome_index).raw_edge_pfeasibility;
+    const double return_rate = ReturnRate(outcome_index);
+    double p_reached = 0.0;
+    double percent_active = 1.0;
+    for (uint32_t attempt = 1; attempt <= max_attempts; attempt++)
+    {
+      p_reached += (percent_active * raw_edge_pfeasibility);
+      if (p_reached >= threshold)
+      {
+        return attempt;
+      }
+      percent_active *= return_rate;
+    }
+    return max_attempts;
+  }
+};
+}  // namespace uncertainty_planning_core
@@ -13,6 +13,29 @@
 
 namespace uncertainty_planning_core
 {
+/*
+ * Clusters a single set of particles that are added in chunks (e.g. as they
+ * finish simulating), doing the clustering work for each chunk as it is added.
+ * The indices of the final clusters refer to all added particles in the order
+ * they were added.
+ */
+template<typename Configuration,
+         typename ConfigAlloc=std::allocator<Configuration>>
+class IncrementalOutcomeClusteringInterface
+{
+public:
+  virtual ~IncrementalOutcomeClusteringInterface() {}
+
+  virtual void AddParticles(
+      const std::vector<SimulationResult<Configuration>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn) = 0;
+
+  virtual std::vector<std::vector<size_t>> FinishClustering(
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn) = 0;
+};
+
 template<typename Configuration,
          typename ConfigAlloc=std::allocator<Configuration>>
 class SimpleOutcomeClusteringInterface
@@ -44,5 +67,57 @@ public:
       const std::vector<SimulationResult<Configuration>>& particles,
       const std::function<void(
           const visualization_msgs::MarkerArray&)>& display_fn) = 0;
+
+  /*
+   * Cluster descriptors are compact, self-contained summaries of a cluster
+   * (e.g. a bounding box, convex hull, or KD-tree over its particles) computed
+   * once when a planner state is created and stored (and serialized) with it.
+   * Membership tests against the state during planning and policy execution
+   * then use the descriptor instead of re-scanning the cluster's particles.
+   *
+   * The default implementation produces no descriptor (an empty vector), in
+   * which case membership tests use IdentifyClusterMembers().
+   */
+  virtual std::vector<uint8_t> ComputeClusterDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Configuration, ConfigAlloc>& cluster)
+  {
+    static_cast<void>(robot);
+    static_cast<void>(cluster);
+    return std::vector<uint8_t>();
+  }
+
+  /*
+   * Same as IdentifyClusterMembers(), but may use cluster_descriptor (as
+   * produced by ComputeClusterDescriptor() for cluster) instead of cluster.
+   * cluster_descriptor is empty if the state has no descriptor.
+   */
+  virtual std::vector<uint8_t> IdentifyClusterMembersWithDescriptor(
+      const std::shared_ptr<Robot>& robot,
+      const std::vector<Configuration, ConfigAlloc>& cluster,
+      const std::vector<uint8_t>& cluster_descriptor,
+      const std::vector<SimulationResult<Configuration>>& particles,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    static_cast<void>(cluster_descriptor);
+    return IdentifyClusterMembers(robot, cluster, particles, display_fn);
+  }
+
+  /*
+   * Incremental clustering, used to overlap clustering with simulation.
+   * Returns a new incremental clusterer for a single set of particles, or
+   * nullptr if incremental clustering is not supported (the default), in
+   * which case the planner clusters all particles at once with
+   * ClusterParticles(). See IncrementalOutcomeClusteringInterface.
+   */
+  virtual std::unique_ptr<
+      IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>>
+  MakeIncrementalClustering(const std::shared_ptr<Robot>& robot)
+  {
+    static_cast<void>(robot);
+    return std::unique_ptr<
+        IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>>();
+  }
 };
 }  // namespace uncertainty_planning_core
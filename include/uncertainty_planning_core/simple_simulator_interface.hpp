@@ -12,6 +12,7 @@
 #include <memory>
 #include <chrono>
 #include <random>
+#include <iterator>
 #include <common_robotics_utilities/math.hpp>
 #include <common_robotics_utilities/print.hpp>
 #include <common_robotics_utilities/conversions.hpp>
@@ -27,8 +28,17 @@ template<typename Configuration,
 struct ForwardSimulationContactResolverStepTrace
 {
   std::vector<Configuration, ConfigAlloc> contact_resolution_steps;
+
+  // Keeps the capacity of contact_resolution_steps
+  void Reset() { contact_resolution_steps.clear(); }
 };
 
+/*
+ * Reset() keeps the storage of the cleared steps as spares, and
+ * AddContactResolverStep() reuses a spare before allocating a new step, so
+ * simulators that append steps through it reuse the nested storage of traces
+ * that are reset and refilled (e.g. in a ForwardSimulationTraceArena).
+ */
 template<typename Configuration,
          typename ConfigAlloc=std::allocator<Configuration>>
 struct ForwardSimulationResolverTrace
@@ -37,16 +47,126 @@ struct ForwardSimulationResolverTrace
   Eigen::VectorXd control_input_step;
   std::vector<ForwardSimulationContactResolverStepTrace
       <Configuration, ConfigAlloc>> contact_resolver_steps;
+  std::vector<ForwardSimulationContactResolverStepTrace
+      <Configuration, ConfigAlloc>> spare_contact_resolver_steps;
+
+  ForwardSimulationContactResolverStepTrace<Configuration, ConfigAlloc>&
+  AddContactResolverStep()
+  {
+    if (spare_contact_resolver_steps.empty())
+    {
+      contact_resolver_steps.emplace_back();
+    }
+    else
+    {
+      contact_resolver_steps.push_back(
+          std::move(spare_contact_resolver_steps.back()));
+      spare_contact_resolver_steps.pop_back();
+    }
+    return contact_resolver_steps.back();
+  }
+
+  void Reset()
+  {
+    for (size_t idx = 0; idx < contact_resolver_steps.size(); idx++)
+    {
+      contact_resolver_steps[idx].Reset();
+    }
+    spare_contact_resolver_steps.insert(
+        spare_contact_resolver_steps.end(),
+        std::make_move_iterator(contact_resolver_steps.begin()),
+        std::make_move_iterator(contact_resolver_steps.end()));
+    contact_resolver_steps.clear();
+  }
 };
 
+// See ForwardSimulationResolverTrace for how Reset() keeps nested storage
 template<typename Configuration,
          typename ConfigAlloc=std::allocator<Configuration>>
 struct ForwardSimulationStepTrace
 {
   std::vector<ForwardSimulationResolverTrace
       <Configuration, ConfigAlloc>> resolver_steps;
+  std::vector<ForwardSimulationResolverTrace
+      <Configuration, ConfigAlloc>> spare_resolver_steps;
+
+  ForwardSimulationResolverTrace<Configuration, ConfigAlloc>& AddResolverStep()
+  {
+    if (spare_resolver_steps.empty())
+    {
+      resolver_steps.emplace_back();
+    }
+    else
+    {
+      resolver_steps.push_back(std::move(spare_resolver_steps.back()));
+      spare_resolver_steps.pop_back();
+    }
+    return resolver_steps.back();
+  }
+
+  void Reset()
+  {
+    for (size_t idx = 0; idx < resolver_steps.size(); idx++)
+    {
+      resolver_steps[idx].Reset();
+    }
+    spare_resolver_steps.insert(
+        spare_resolver_steps.end(),
+        std::make_move_iterator(resolver_steps.begin()),
+        std::make_move_iterator(resolver_steps.end()));
+    resolver_steps.clear();
+  }
+};
+
+/*
+ * Caller-owned storage for the traces of a batch of simulations. Keep one
+ * around and pass it to every batch, so repeated batches (e.g. policy
+ * rollouts) reuse the same trace storage instead of building fresh traces.
+ */
+template<typename Configuration,
+         typename ConfigAlloc=std::allocator<Configuration>>
+class ForwardSimulationTraceArena
+{
+private:
+  std::vector<ForwardSimulationStepTrace<Configuration, ConfigAlloc>> traces_;
+  size_t num_active_traces_ = 0;
+
+public:
+  // Prepares num_traces empty traces, growing the arena only if needed
+  void Reset(const size_t num_traces)
+  {
+    if (traces_.size() < num_traces)
+    {
+      traces_.resize(num_traces);
+    }
+    for (size_t idx = 0; idx < num_traces; idx++)
+    {
+      traces_[idx].Reset();
+    }
+    num_active_traces_ = num_traces;
+  }
+
+  size_t Size() const { return num_active_traces_; }
+
+  ForwardSimulationStepTrace<Configuration, ConfigAlloc>& GetTrace(
+      const size_t index)
+  {
+    if (index >= num_active_traces_)
+    {
+      throw std::out_of_range("index out of range");
+    }
+    return traces_[index];
+  }
 
-  void Reset() { resolver_steps.clear(); }
+  const ForwardSimulationStepTrace<Configuration, ConfigAlloc>& GetTrace(
+      const size_t index) const
+  {
+    if (index >= num_active_traces_)
+    {
+      throw std::out_of_range("index out of range");
+    }
+    return traces_[index];
+  }
 };
 
 template<typename Configuration,
@@ -177,6 +297,15 @@ public:
 
   virtual void ResetStatistics() = 0;
 
+  /*
+   * Capability flag - return true if reversing a motion in which no particle
+   * made contact is guaranteed to return every particle to where it started.
+   * The planner then skips reverse simulation (and the cluster membership
+   * checks that go with it) for contact-free edges, including children of
+   * splits.
+   */
+  virtual bool ContactFreeMotionIsReversible() const { return false; }
+
   virtual bool CheckConfigCollision(
       const std::shared_ptr<Robot>& immutable_robot,
       const Configuration& config, const double inflation_ratio=0.0) const = 0;
@@ -206,6 +335,33 @@ public:
       const std::function<void(
           const visualization_msgs::MarkerArray&)>& display_fn) = 0;
 
+  /*
+   * Simulates a heterogeneous batch, where start_positions[idx] is moved
+   * towards target_positions[idx] (e.g. particles of different planner states,
+   * or steps of several policy rollouts). If enable_tracing is set, the trace
+   * of each simulation is stored in trace_arena.GetTrace(idx).
+   *
+   * The default implementation simulates each pair with ForwardSimulateRobot
+   * if tracing, and otherwise simulates each run of consecutive pairs with
+   * the same target with a single ForwardSimulateRobots call. Override it to
+   * amortize setup or vectorize across the batch.
+   */
+  virtual std::vector<SimulationResult<Configuration>>
+  ForwardSimulateRobotsBatch(
+      const std::shared_ptr<Robot>& immutable_robot,
+      const std::vector<Configuration, ConfigAlloc>& start_positions,
+      const std::vector<Configuration, ConfigAlloc>& target_positions,
+      const bool allow_contacts,
+      ForwardSimulationTraceArena<Configuration, ConfigAlloc>& trace_arena,
+      const bool enable_tracing,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    return SimulateRobotsBatch(
+        immutable_robot, start_positions, target_positions, allow_contacts,
+        trace_arena, enable_tracing, display_fn, false);
+  }
+
   virtual SimulationResult<Configuration> ReverseSimulateMutableRobot(
       const std::shared_ptr<Robot>& mutable_robot,
       const Configuration& target_position, const bool allow_contacts,
@@ -230,6 +386,100 @@ public:
       const bool allow_contacts,
       const std::function<void(
           const visualization_msgs::MarkerArray&)>& display_fn) = 0;
+
+  /*
+   * Reverse counterpart of ForwardSimulateRobotsBatch.
+   */
+  virtual std::vector<SimulationResult<Configuration>>
+  ReverseSimulateRobotsBatch(
+      const std::shared_ptr<Robot>& immutable_robot,
+      const std::vector<Configuration, ConfigAlloc>& start_positions,
+      const std::vector<Configuration, ConfigAlloc>& target_positions,
+      const bool allow_contacts,
+      ForwardSimulationTraceArena<Configuration, ConfigAlloc>& trace_arena,
+      const bool enable_tracing,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn)
+  {
+    return SimulateRobotsBatch(
+        immutable_robot, start_positions, target_positions, allow_contacts,
+        trace_arena, enable_tracing, display_fn, true);
+  }
+
+private:
+  std::vector<SimulationResult<Configuration>> SimulateRobotsBatch(
+      const std::shared_ptr<Robot>& immutable_robot,
+      const std::vector<Configuration, ConfigAlloc>& start_positions,
+      const std::vector<Configuration, ConfigAlloc>& target_positions,
+      const bool allow_contacts,
+      ForwardSimulationTraceArena<Configuration, ConfigAlloc>& trace_arena,
+      const bool enable_tracing,
+      const std::function<void(
+          const visualization_msgs::MarkerArray&)>& display_fn,
+      const bool simulate_reverse)
+  {
+    if (start_positions.size() != target_positions.size())
+    {
+      throw std::invalid_argument(
+          "start_positions.size() != target_positions.size()");
+    }
+    std::vector<SimulationResult<Configuration>> results;
+    results.reserve(start_positions.size());
+    if (enable_tracing == false)
+    {
+      // Simulate each run of pairs that share a target with a single
+      // ForwardSimulateRobots/ReverseSimulateRobots call, so simulators that
+      // parallelize those calls still do
+      trace_arena.Reset(0u);
+      size_t run_start = 0;
+      while (run_start < start_positions.size())
+      {
+        size_t run_end = run_start + 1;
+        while ((run_end < start_positions.size())
+               && (immutable_robot->ComputeConfigurationDistance(
+                       target_positions[run_start], target_positions[run_end])
+                   <= 0.0))
+        {
+          run_end++;
+        }
+        const std::vector<Configuration, ConfigAlloc> run_start_positions(
+            start_positions.begin() + static_cast<ptrdiff_t>(run_start),
+            start_positions.begin() + static_cast<ptrdiff_t>(run_end));
+        const std::vector<Configuration, ConfigAlloc> run_target_position(
+            1, target_positions[run_start]);
+        const std::vector<SimulationResult<Configuration>> run_results
+            = (simulate_reverse)
+              ? ReverseSimulateRobots(
+                  immutable_robot, run_start_positions, run_target_position,
+                  allow_contacts, display_fn)
+              : ForwardSimulateRobots(
+                  immutable_robot, run_start_positions, run_target_position,
+                  allow_contacts, display_fn);
+        results.insert(results.end(), run_results.begin(), run_results.end());
+        run_start = run_end;
+      }
+      return results;
+    }
+    trace_arena.Reset(start_positions.size());
+    for (size_t idx = 0; idx < start_positions.size(); idx++)
+    {
+      ForwardSimulationStepTrace<Configuration, ConfigAlloc>& trace
+          = trace_arena.GetTrace(idx);
+      if (simulate_reverse)
+      {
+        results.push_back(ReverseSimulateRobot(
+            immutable_robot, start_positions[idx], target_positions[idx],
+            allow_contacts, trace, enable_tracing, display_fn));
+      }
+      else
+      {
+        results.push_back(ForwardSimulateRobot(
+            immutable_robot, start_positions[idx], target_positions[idx],
+            allow_contacts, trace, enable_tracing, display_fn));
+      }
+    }
+    return results;
+  }
 };
 }  // namespace uncertainty_planning_core
 
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
+#include <functional>
+#include <memory>
+#include <Eigen/Geometry>
+#include <uncertainty_planning_core/simple_simulator_interface.hpp>
+
+namespace uncertainty_planning_core
+{
+/*
+ * LRU cache of propagated particle sets, keyed by the planner state that was
+ * propagated, the simulation mode, and the target. Targets within
+ * target_tolerance (as measured by the provided distance function) of a cached
+ * target are treated as the same target.
+ *
+ * The memory budget is expressed as the total number of particles (initial
+ * plus propagated) stored in the cache.
+ */
+template<typename Configuration,
+         typename ConfigAlloc=std::allocator<Configuration>>
+class SimulationResultCache
+{
+public:
+  typedef std::pair<std::vector<Configuration, ConfigAlloc>,
+                    std::vector<SimulationResult<Configuration>>> CachedResult;
+  typedef std::function<double(const Configuration&,
+                               const Configuration&)> DistanceFn;
+
+private:
+  struct CacheEntry
+  {
+    uint64_t state_id = 0;
+    bool simulate_reverse = false;
+    bool allow_contacts = false;
+    Configuration target;
+    CachedResult result;
+
+    size_t NumParticles() const
+    {
+      return result.first.size() + result.second.size();
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  typedef std::list<CacheEntry, Eigen::aligned_allocator<CacheEntry>>
+      CacheEntryList;
+
+  // Most recently used entries are at the front
+  CacheEntryList entries_;
+  std::unordered_map<uint64_t, std::vector<typename CacheEntryList::iterator>>
+      state_entries_;
+  size_t max_cached_particles_ = 0;
+  double target_tolerance_ = 0.0;
+  size_t cached_particles_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+
+  void EraseEntry(const typename CacheEntryList::iterator& entry)
+  {
+    auto found_state_entries = state_entries_.find(entry->state_id);
+    if (found_state_entries != state_entries_.end())
+    {
+      std::vector<typename CacheEntryList::iterator>& same_state_entries
+          = found_state_entries->second;
+      for (size_t idx = 0; idx < same_state_entries.size(); idx++)
+      {
+        if (same_state_entries[idx] == entry)
+        {
+          same_state_entries.erase(same_state_entries.begin()
+                                   + static_cast<ptrdiff_t>(idx));
+          break;
+        }
+      }
+      if (same_state_entries.empty())
+      {
+        state_entries_.erase(found_state_entries);
+      }
+    }
+    cached_particles_ -= entry->NumParticles();
+    entries_.erase(entry);
+  }
+
+public:
+  // Pass max_cached_particles = 0 to disable the cache (default)
+  void Configure(const size_t max_cached_particles,
+                 const double target_tolerance)
+  {
+    if (target_tolerance < 0.0)
+    {
+      throw std::invalid_argument("target_tolerance must be >= 0");
+    }
+    max_cached_particles_ = max_cached_particles;
+    target_tolerance_ = target_tolerance;
+    Clear();
+  }
+
+  bool IsEnabled() const { return max_cached_particles_ > 0; }
+
+  void Clear()
+  {
+    entries_.clear();
+    state_entries_.clear();
+    cached_particles_ = 0;
+  }
+
+  bool Lookup(const uint64_t state_id, const bool simulate_reverse,
+              const bool allow_contacts, const Configuration& target,
+              const DistanceFn& distance_fn, CachedResult& result)
+  {
+    if (!IsEnabled())
+    {
+      return false;
+    }
+    auto found_state_entries = state_entries_.find(state_id);
+    if (found_state_entries != state_entries_.end())
+    {
+      const std::vector<typename CacheEntryList::iterator>& same_state_entries
+          = found_state_entries->second;
+      for (size_t idx = 0; idx < same_state_entries.size(); idx++)
+      {
+        const typename CacheEntryList::iterator& entry
+            = same_state_entries[idx];
+        if ((entry->simulate_reverse == simulate_reverse)
+            && (entry->allow_contacts == allow_contacts)
+            && (distance_fn(entry->target, target) <= target_tolerance_))
+        {
+          // Mark as most recently used
+          entries_.splice(entries_.begin(), entries_, entry);
+          result = entry->result;
+          hits_++;
+          return true;
+        }
+      }
+    }
+    misses_++;
+    return false;
+  }
+
+  void Insert(const uint64_t state_id, const bool simulate_reverse,
+              const bool allow_contacts, const Configuration& target,
+              const CachedResult& result)
+  {
+    if (!IsEnabled())
+    {
+      return;
+    }
+    CacheEntry entry;
+    entry.state_id = state_id;
+    entry.simulate_reverse = simulate_reverse;
+    entry.allow_contacts = allow_contacts;
+    entry.target = target;
+    entry.result = result;
+    // Results bigger than the entire budget are never cached
+    if (entry.NumParticles() > max_cached_particles_)
+    {
+      return;
+    }
+    // Evict least recently used entries until the new entry fits
+    while ((cached_particles_ + entry.NumParticles()) > max_cached_particles_)
+    {
+      EraseEntry(std::prev(entries_.end()));
+      evictions_++;
+    }
+    cached_particles_ += entry.NumParticles();
+    entries_.push_front(std::move(entry));
+    state_entries_[state_id].push_back(entries_.begin());
+  }
+
+  void ResetStatistics()
+  {
+    hits_ = 0;
+    misses_ = 0;
+    evictions_ = 0;
+  }
+
+  std::map<std::string, double> GetStatistics() const
+  {
+    std::map<std::string, double> statistics;
+    const uint64_t lookups = hits_ + misses_;
+    statistics["Simulation cache hits"] = static_cast<double>(hits_);
+    statistics["Simulation cache misses"] = static_cast<double>(misses_);
+    statistics["Simulation cache hit rate"]
+        = (lookups > 0) ? static_cast<double>(hits_)
+                          / static_cast<double>(lookups) : 0.0;
+    statistics["Simulation cache evictions"]
+        = static_cast<double>(evictions_);
+    statistics["Simulation cache particles stored"]
+        = static_cast<double>(cached_particles_);
+    return statistics;
+  }
+};
+}  // namespace uncertainty_planning_core
@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -12,6 +13,15 @@
 #include <functional>
 #include <random>
 #include <atomic>
+#include <exception>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <Eigen/Geometry>
 #include <ros/ros.h>
 #include <visualization_msgs/Marker.h>
@@ -19,6 +29,8 @@
 #include <common_robotics_utilities/conversions.hpp>
 #include <common_robotics_utilities/print.hpp>
 #include <uncertainty_planning_core/uncertainty_planning_core.hpp>
+#include <uncertainty_planning_core/retry_probability_solver.hpp>
+#include <uncertainty_planning_core/policy_learner.hpp>
 #include <omp.h>
 
 namespace uncertainty_planning_core
@@ -70,6 +82,18 @@ public:
 
   /// Returns the name of the primitive
   virtual std::string Name() const = 0;
+
+  /// Returns true if GetOutcomes() may be called concurrently from multiple
+  /// threads. When every primitive the planner performs on a node's particles
+  /// is thread-safe, their outcomes are evaluated in parallel (with OpenMP,
+  /// so GetRandomGenerator() returns a separate generator for each thread).
+  virtual bool IsThreadSafe() const { return false; }
+
+  /// Returns true if GetOutcomes() always returns the same outcomes for the
+  /// same state. If the adapter's outcome cache is enabled, outcomes of such
+  /// primitives are memoized by state hash instead of being recomputed each
+  /// time the state is reached.
+  virtual bool HasDeterministicOutcomes() const { return false; }
 };
 
 template<typename State, typename StateAlloc=std::allocator<State>>
@@ -92,6 +116,8 @@ private:
       const State&)> execute_fn_;
   double ranking_;
   std::string name_;
+  bool is_thread_safe_;
+  bool has_deterministic_outcomes_;
 
 public:
 
@@ -101,12 +127,15 @@ public:
                 const State&)>& get_outcomes_fn,
       const std::function<std::vector<State, StateAlloc>(
                 const State&)>& execute_fn,
-      const double ranking, const std::string& name)
+      const double ranking, const std::string& name,
+      const bool is_thread_safe=false,
+      const bool has_deterministic_outcomes=false)
     : ActionPrimitiveInterface<State, StateAlloc>(),
       is_candidate_fn_(is_candidate_fn),
       get_outcomes_fn_(get_outcomes_fn),
       execute_fn_(execute_fn),
-      ranking_(ranking), name_(name) {}
+      ranking_(ranking), name_(name), is_thread_safe_(is_thread_safe),
+      has_deterministic_outcomes_(has_deterministic_outcomes) {}
 
   virtual bool IsCandidate(const State& state) const
   {
@@ -128,6 +157,13 @@ public:
   virtual double Ranking() const { return ranking_; }
 
   virtual std::string Name() const { return name_; }
+
+  virtual bool IsThreadSafe() const { return is_thread_safe_; }
+
+  virtual bool HasDeterministicOutcomes() const
+  {
+    return has_deterministic_outcomes_;
+  }
 };
 
 template<typename State, typename StateAlloc=std::allocator<State>>
@@ -296,6 +332,9 @@ private:
 
   typedef PolicyQueryResult<State> TaskPlanningPolicyQuery;
 
+  typedef AsyncPolicyLearner<
+            State, StateSerializer, StateAlloc> TaskPlanningPolicyLearner;
+
   typedef UncertaintyPlanningSpace<
             State, StateSerializer, StateAlloc, PRNG> TaskPlanningSpace;
 
@@ -330,20 +369,51 @@ private:
   uint64_t state_counter_;
   uint64_t transition_id_;
   uint64_t split_id_;
+  uint64_t transpositions_detected_;
+
+  std::function<uint64_t(const State&)> transposition_state_hash_fn_;
+  std::function<bool(const State&, const State&)> transposition_state_equal_fn_;
+
+  std::function<uint64_t(const State&)> cluster_state_hash_fn_;
+  std::function<bool(const State&, const State&)> cluster_state_equal_fn_;
+
+  std::function<void(const TaskPlanningPolicy&, const double)>
+      policy_snapshot_fn_;
 
   mutable std::vector<uncertainty_planning_core::PRNG> rngs_;
   mutable std::vector<std::uniform_real_distribution<double>>
     unit_real_distributions_;
 
+  // Outcome cache for primitives with deterministic outcomes, indexed by
+  // <primitive index, state hash>, matched by state equality, and evicted
+  // least-recently-used first
+  typedef std::vector<std::pair<State, bool>> PrimitiveOutcomes;
+  typedef std::pair<size_t, uint64_t> OutcomeCacheKey;
+
+  struct OutcomeCacheEntry
+  {
+    OutcomeCacheKey key;
+    State state;
+    std::shared_ptr<const PrimitiveOutcomes> outcomes;
+  };
+
+  typedef typename std::list<OutcomeCacheEntry>::iterator OutcomeCacheItr;
+
+  std::function<uint64_t(const State&)> outcome_cache_state_hash_fn_;
+  std::function<bool(const State&, const State&)> outcome_cache_state_equal_fn_;
+  size_t outcome_cache_max_outcomes_;
+  size_t outcome_cache_num_outcomes_;
+  std::map<OutcomeCacheKey, std::vector<OutcomeCacheItr>> outcome_cache_;
+  std::list<OutcomeCacheEntry> outcome_cache_lru_;
+  uint64_t outcome_cache_hits_;
+  uint64_t outcome_cache_misses_;
+  uint64_t outcome_cache_evictions_;
+  mutable std::mutex outcome_cache_mutex_;
+
   static inline size_t GetNumOMPThreads()
   {
     #if defined(_OPENMP)
-    size_t num_threads = 0;
-    #pragma omp parallel
-    {
-      num_threads = (size_t)omp_get_num_threads();
-    }
-    return num_threads;
+    return (size_t)omp_get_max_threads();
     #else
     return 1;
     #endif
@@ -369,63 +439,176 @@ private:
     }
   }
 
+  bool ClusterByStateIdentity() const
+  {
+    return (static_cast<bool>(cluster_state_hash_fn_)
+            && static_cast<bool>(cluster_state_equal_fn_));
+  }
+
+  /// Groups particles by readiness, or by state identity if state clustering
+  /// functions are set, in one pass of hashing. Clusters are returned in
+  /// order of readiness, then of their first particle.
   std::vector<std::vector<size_t>> ClusterParticlesImpl(
       const std::vector<SimulationResult<State>>& particles)
   {
-    std::map<uint64_t, std::vector<size_t>> cluster_map;
-    for (size_t idx = 0; idx < particles.size(); idx++)
+    std::vector<std::vector<size_t>> clusters;
+    // Readiness is computed once per cluster (or once per particle when
+    // clustering by readiness)
+    std::vector<uint64_t> cluster_readiness;
+    if (ClusterByStateIdentity())
     {
-      const State& config = particles[idx].ResultConfig();
-      const uint64_t particle_readiness
-          = ComputeStateReadiness(config);
-      cluster_map[particle_readiness].push_back(idx);
+      std::unordered_map<uint64_t, std::vector<size_t>> clusters_by_hash;
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        const State& config = particles[idx].ResultConfig();
+        std::vector<size_t>& candidate_clusters
+            = clusters_by_hash[cluster_state_hash_fn_(config)];
+        bool found_cluster = false;
+        for (size_t cdx = 0; cdx < candidate_clusters.size(); cdx++)
+        {
+          std::vector<size_t>& candidate_cluster
+              = clusters[candidate_clusters[cdx]];
+          if (cluster_state_equal_fn_(
+                  particles[candidate_cluster.front()].ResultConfig(), config))
+          {
+            candidate_cluster.push_back(idx);
+            found_cluster = true;
+            break;
+          }
+        }
+        if (!found_cluster)
+        {
+          candidate_clusters.push_back(clusters.size());
+          clusters.push_back(std::vector<size_t>(1, idx));
+          cluster_readiness.push_back(ComputeStateReadiness(config));
+        }
+      }
     }
-    std::vector<std::vector<size_t>> clusters;
-    for (auto itr = cluster_map.begin(); itr != cluster_map.end(); ++itr)
+    else
     {
-      clusters.push_back(itr->second);
+      std::unordered_map<uint64_t, size_t> cluster_index_by_readiness;
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        const State& config = particles[idx].ResultConfig();
+        const uint64_t particle_readiness = ComputeStateReadiness(config);
+        const auto inserted = cluster_index_by_readiness.insert(
+            std::make_pair(particle_readiness, clusters.size()));
+        if (inserted.second)
+        {
+          clusters.push_back(std::vector<size_t>());
+          cluster_readiness.push_back(particle_readiness);
+        }
+        clusters[inserted.first->second].push_back(idx);
+      }
     }
-    return clusters;
+    // Order the clusters deterministically
+    std::vector<std::pair<uint64_t, size_t>> cluster_order;
+    cluster_order.reserve(clusters.size());
+    for (size_t cdx = 0; cdx < clusters.size(); cdx++)
+    {
+      cluster_order.push_back(std::make_pair(cluster_readiness[cdx], cdx));
+    }
+    std::sort(cluster_order.begin(), cluster_order.end());
+    std::vector<std::vector<size_t>> ordered_clusters;
+    ordered_clusters.reserve(clusters.size());
+    for (size_t cdx = 0; cdx < cluster_order.size(); cdx++)
+    {
+      ordered_clusters.push_back(
+          std::move(clusters[cluster_order[cdx].second]));
+    }
+    return ordered_clusters;
+  }
+
+  /// Makes the outcome clustering function used in policy queries
+  typename TaskPlanningPolicy::StateClusteringFn MakePolicyStateClusteringFn()
+  {
+    return [this] (const TaskPlanningState& state, const State& result_state)
+    {
+      std::vector<SimulationResult<State>> result_particles;
+      result_particles.emplace_back(
+            SimulationResult<State>(result_state, result_state, false, false));
+      auto particles = state.GetParticlePositionsImmutable();
+      const std::vector<uint8_t> cluster_membership
+          = IdentifyClusterMembersImpl(
+              particles.Value(), state.GetClusterDescriptor(),
+              result_particles);
+      const uint8_t parent_cluster_membership = cluster_membership.at(0);
+      if (parent_cluster_membership > 0x00)
+      {
+          return true;
+      }
+      else
+      {
+          return false;
+      }
+    };
+  }
+
+  /// Cluster descriptors cache the readiness of the cluster
+  static std::vector<uint8_t> MakeClusterDescriptor(
+      const uint64_t cluster_readiness)
+  {
+    std::vector<uint8_t> cluster_descriptor;
+    common_robotics_utilities::serialization::SerializeMemcpyable<uint64_t>(
+        cluster_readiness, cluster_descriptor);
+    return cluster_descriptor;
   }
 
   std::vector<uint8_t> IdentifyClusterMembersImpl(
       const std::vector<State, StateAlloc>& cluster,
+      const std::vector<uint8_t>& cluster_descriptor,
       const std::vector<SimulationResult<State>>& particles)
   {
-    if (cluster.size() > 0)
+    if (cluster.size() == 0)
     {
-      const uint64_t parent_cluster_readiness
-          = ComputeStateReadiness(cluster[0]);
-      for (size_t idx = 1; idx < cluster.size(); idx++)
+      throw std::runtime_error("Invalid parent cluster with zero particles");
+    }
+    std::vector<uint8_t> particle_cluster_membership(particles.size(), 0x00);
+    if (ClusterByStateIdentity())
+    {
+      std::unordered_map<uint64_t, std::vector<size_t>> cluster_by_hash;
+      for (size_t idx = 0; idx < cluster.size(); idx++)
       {
-        const uint64_t current_particle_readiness
-            = ComputeStateReadiness(cluster[idx]);
-        if (parent_cluster_readiness != current_particle_readiness)
-        {
-          throw std::runtime_error("Invalid parent cluster");
-        }
+        cluster_by_hash[cluster_state_hash_fn_(cluster[idx])].push_back(idx);
       }
-      std::vector<uint8_t> particle_cluster_membership(particles.size(), 0x00);
       for (size_t idx = 0; idx < particles.size(); idx++)
       {
         const State& config = particles[idx].ResultConfig();
-        const uint64_t particle_readiness
-            = ComputeStateReadiness(config);
-        if (parent_cluster_readiness == particle_readiness)
+        const auto found_itr
+            = cluster_by_hash.find(cluster_state_hash_fn_(config));
+        if (found_itr == cluster_by_hash.end())
         {
-          particle_cluster_membership[idx] = 0x01;
+          continue;
         }
-        else
+        const std::vector<size_t>& candidate_indices = found_itr->second;
+        for (size_t cdx = 0; cdx < candidate_indices.size(); cdx++)
         {
-          particle_cluster_membership[idx] = 0x00;
+          if (cluster_state_equal_fn_(cluster[candidate_indices[cdx]], config))
+          {
+            particle_cluster_membership[idx] = 0x01;
+            break;
+          }
         }
       }
-      return particle_cluster_membership;
     }
     else
     {
-      throw std::runtime_error("Invalid parent cluster with zero particles");
+      const uint64_t parent_cluster_readiness
+          = (cluster_descriptor.size() == sizeof(uint64_t))
+            ? common_robotics_utilities::serialization
+                ::DeserializeMemcpyable<uint64_t>(cluster_descriptor, 0).first
+            : ComputeStateReadiness(cluster[0]);
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        const State& config = particles[idx].ResultConfig();
+        const uint64_t particle_readiness = ComputeStateReadiness(config);
+        if (parent_cluster_readiness == particle_readiness)
+        {
+          particle_cluster_membership[idx] = 0x01;
+        }
+      }
     }
+    return particle_cluster_membership;
   }
 
   std::vector<SimulationResult<State>> ForwardSimulatePrimitives(
@@ -442,18 +625,14 @@ private:
               "target_positions.size() must be 1 or start_positions.size()");
       }
     }
-    std::vector<SimulationResult<State>> propagated_points;
-    propagated_points.reserve(start_positions.size());
+    std::vector<int64_t> primitive_indices(start_positions.size(), -1);
     for (size_t idx = 0; idx < start_positions.size(); idx++)
     {
-      const State& initial_particle = start_positions[idx];
-      const std::vector<SimulationResult<State>> results
-          = PerformBestAvailablePrimitive(initial_particle);
-      propagated_points.insert(propagated_points.end(),
-                               results.begin(),
-                               results.end());
+      primitive_indices[idx]
+          = GetRequiredBestPrimitiveIndex(start_positions[idx]);
     }
-    propagated_points.shrink_to_fit();
+    const std::vector<SimulationResult<State>> propagated_points
+        = PerformPrimitives(start_positions, primitive_indices);
     Log("...finished primitive forward simulation", 1);
     return propagated_points;
   }
@@ -473,25 +652,125 @@ private:
               "target_positions.size() must be 1 or start_positions.size()");
       }
     }
-    std::vector<SimulationResult<State>> propagated_points;
-    propagated_points.reserve(start_positions.size());
+    std::vector<int64_t> primitive_indices(start_positions.size(), -1);
     for (size_t idx = 0; idx < start_positions.size(); idx++)
     {
       const State& initial_particle = start_positions[idx];
       const State& target_position
           = (target_positions.size() > 1) ? target_positions[idx]
                                           : target_positions[0];
-      const std::vector<SimulationResult<State>> results
-          = PerformTargettedPrimitive(initial_particle, target_position);
+      primitive_indices[idx]
+          = GetTargettedPrimitiveIndex(initial_particle, target_position);
+    }
+    const std::vector<SimulationResult<State>> propagated_points
+        = PerformPrimitives(start_positions, primitive_indices);
+    Log("...finished particle reverse simulation", 1);
+    return propagated_points;
+  }
+
+  /// Performs primitives_[primitive_indices[idx]] on each start position, or
+  /// passes the start position through unchanged if the index is -1. Results
+  /// are concatenated in start position order. If every primitive performed
+  /// is thread-safe, the particles are evaluated in parallel.
+  std::vector<SimulationResult<State>> PerformPrimitives(
+      const std::vector<State, StateAlloc>& start_positions,
+      const std::vector<int64_t>& primitive_indices)
+  {
+    bool all_primitives_thread_safe = true;
+    for (size_t idx = 0; idx < primitive_indices.size(); idx++)
+    {
+      const int64_t primitive_idx = primitive_indices[idx];
+      if ((primitive_idx >= 0)
+          && (primitives_[static_cast<size_t>(primitive_idx)]->IsThreadSafe()
+              == false))
+      {
+        all_primitives_thread_safe = false;
+        break;
+      }
+    }
+    std::vector<std::vector<SimulationResult<State>>> particle_results(
+        start_positions.size());
+    if (all_primitives_thread_safe && (start_positions.size() > 1))
+    {
+      Log("Evaluating primitive outcomes for "
+          + std::to_string(start_positions.size())
+          + " particles in parallel", 1);
+      std::vector<std::exception_ptr> particle_exceptions(
+          start_positions.size());
+      #pragma omp parallel for schedule(dynamic)
+      for (size_t idx = 0; idx < start_positions.size(); idx++)
+      {
+        try
+        {
+          particle_results[idx]
+              = PerformPrimitive(start_positions[idx], primitive_indices[idx]);
+        }
+        catch (...)
+        {
+          particle_exceptions[idx] = std::current_exception();
+        }
+      }
+      for (size_t idx = 0; idx < particle_exceptions.size(); idx++)
+      {
+        if (particle_exceptions[idx])
+        {
+          std::rethrow_exception(particle_exceptions[idx]);
+        }
+      }
+    }
+    else
+    {
+      for (size_t idx = 0; idx < start_positions.size(); idx++)
+      {
+        particle_results[idx]
+            = PerformPrimitive(start_positions[idx], primitive_indices[idx]);
+      }
+    }
+    std::vector<SimulationResult<State>> propagated_points;
+    propagated_points.reserve(start_positions.size());
+    for (size_t idx = 0; idx < particle_results.size(); idx++)
+    {
       propagated_points.insert(propagated_points.end(),
-                               results.begin(),
-                               results.end());
+                               particle_results[idx].begin(),
+                               particle_results[idx].end());
     }
     propagated_points.shrink_to_fit();
-    Log("...finished particle reverse simulation", 1);
     return propagated_points;
   }
 
+  std::vector<SimulationResult<State>>
+  PerformPrimitive(const State& start, const int64_t primitive_idx)
+  {
+    if (primitive_idx >= 0)
+    {
+      const ActionPrimitivePtr<State, StateAlloc>& primitive
+          = primitives_[static_cast<size_t>(primitive_idx)];
+      if ((outcome_cache_max_outcomes_ > 0)
+          && primitive->HasDeterministicOutcomes())
+      {
+        const OutcomeCacheKey key(static_cast<size_t>(primitive_idx),
+                                  outcome_cache_state_hash_fn_(start));
+        const std::shared_ptr<const PrimitiveOutcomes> cached_outcomes
+            = LookupCachedOutcomes(key, start);
+        if (cached_outcomes)
+        {
+          return PackagePrimitiveOutcomes(*cached_outcomes);
+        }
+        const std::shared_ptr<const PrimitiveOutcomes> outcomes
+            = std::make_shared<const PrimitiveOutcomes>(
+                primitive->GetOutcomes(start));
+        InsertCachedOutcomes(key, start, outcomes);
+        return PackagePrimitiveOutcomes(*outcomes);
+      }
+      return PackagePrimitiveOutcomes(primitive->GetOutcomes(start));
+    }
+    else
+    {
+      const std::vector<State, StateAlloc> outcome_configs(1, start);
+      return MakePrimitiveResults(outcome_configs, true);
+    }
+  }
+
   std::vector<SimulationResult<State>>
   MakePrimitiveResults(
       const std::vector<State, StateAlloc>& raw_primitive_results,
@@ -512,6 +791,13 @@ private:
   }
 
   int64_t GetBestPrimitiveIndex(const State& start)
+  {
+    return GetBestPrimitiveIndex(start, logging_fn_);
+  }
+
+  int64_t GetBestPrimitiveIndex(
+      const State& start,
+      const std::function<void(const std::string&, const int32_t)>& log_fn)
   {
     int64_t best_primitive_idx = -1;
     double best_primitive_ranking = 0.0;
@@ -521,9 +807,9 @@ private:
       if (primitive->IsCandidate(start))
       {
         const double primitive_ranking = primitive->Ranking();
-        Log("Considering available primitive ["
-            + primitive->Name() + "] with ranking "
-            + std::to_string(primitive_ranking), 1);
+        log_fn("Considering available primitive ["
+               + primitive->Name() + "] with ranking "
+               + std::to_string(primitive_ranking), 1);
         if (primitive_ranking >= best_primitive_ranking)
         {
           best_primitive_ranking = primitive_ranking;
@@ -534,36 +820,24 @@ private:
     return best_primitive_idx;
   }
 
-  std::vector<SimulationResult<State>>
-  PerformBestAvailablePrimitive(const State& start)
+  int64_t GetRequiredBestPrimitiveIndex(const State& start)
   {
-    const int64_t best_primitive_idx = GetBestPrimitiveIndex(start);
+    return GetRequiredBestPrimitiveIndex(start, logging_fn_);
+  }
+
+  int64_t GetRequiredBestPrimitiveIndex(
+      const State& start,
+      const std::function<void(const std::string&, const int32_t)>& log_fn)
+  {
+    const int64_t best_primitive_idx = GetBestPrimitiveIndex(start, log_fn);
     if (best_primitive_idx >= 0)
     {
       const ActionPrimitivePtr<State, StateAlloc>& best_primitive
           = primitives_[static_cast<size_t>(best_primitive_idx)];
-      Log("Performing best available primitive ["
-          + best_primitive->Name() + "] with ranking "
-          + std::to_string(best_primitive->Ranking()), 2);
-      const std::vector<std::pair<State, bool>> primitive_results
-          = best_primitive->GetOutcomes(start);
-      // Package the results
-      std::vector<SimulationResult<State>> complete_results;
-      complete_results.reserve(primitive_results.size());
-      for (size_t idx = 0; idx < primitive_results.size(); idx++)
-      {
-        const State& result_state = primitive_results[idx].first;
-        const bool outcome_is_nominally_independent
-            = primitive_results[idx].second;
-        const bool did_contact = false; // Contact has no meaning here
-        complete_results.emplace_back(
-              SimulationResult<State>(result_state,
-                               result_state,
-                               did_contact,
-                               outcome_is_nominally_independent));
-      }
-      complete_results.shrink_to_fit();
-      return complete_results;
+      log_fn("Performing best available primitive ["
+             + best_primitive->Name() + "] with ranking "
+             + std::to_string(best_primitive->Ranking()), 2);
+      return best_primitive_idx;
     }
     else
     {
@@ -573,6 +847,27 @@ private:
     }
   }
 
+  std::vector<SimulationResult<State>> PackagePrimitiveOutcomes(
+      const std::vector<std::pair<State, bool>>& primitive_results) const
+  {
+    std::vector<SimulationResult<State>> complete_results;
+    complete_results.reserve(primitive_results.size());
+    for (size_t idx = 0; idx < primitive_results.size(); idx++)
+    {
+      const State& result_state = primitive_results[idx].first;
+      const bool outcome_is_nominally_independent
+          = primitive_results[idx].second;
+      const bool did_contact = false; // Contact has no meaning here
+      complete_results.emplace_back(
+            SimulationResult<State>(result_state,
+                             result_state,
+                             did_contact,
+                             outcome_is_nominally_independent));
+    }
+    complete_results.shrink_to_fit();
+    return complete_results;
+  }
+
   std::vector<State, StateAlloc>
   ExecuteBestAvailablePrimitive(const State& start)
   {
@@ -599,84 +894,478 @@ private:
     }
   }
 
-  std::vector<SimulationResult<State>>
-  PerformTargettedPrimitive(const State& start, const State& target)
+  std::shared_ptr<const PrimitiveOutcomes>
+  LookupCachedOutcomes(const OutcomeCacheKey& key, const State& start)
+  {
+    std::lock_guard<std::mutex> lock(outcome_cache_mutex_);
+    const OutcomeCacheItr entry_itr = FindCachedOutcomes(key, start);
+    if (entry_itr != outcome_cache_lru_.end())
+    {
+      outcome_cache_hits_++;
+      outcome_cache_lru_.splice(outcome_cache_lru_.begin(),
+                                outcome_cache_lru_,
+                                entry_itr);
+      return entry_itr->outcomes;
+    }
+    else
+    {
+      outcome_cache_misses_++;
+      return std::shared_ptr<const PrimitiveOutcomes>();
+    }
+  }
+
+  void InsertCachedOutcomes(
+      const OutcomeCacheKey& key, const State& start,
+      const std::shared_ptr<const PrimitiveOutcomes>& outcomes)
+  {
+    std::lock_guard<std::mutex> lock(outcome_cache_mutex_);
+    // Outcome sets larger than the entire cache are never stored, and another
+    // thread may have already stored this state
+    if ((outcomes->size() > outcome_cache_max_outcomes_)
+        || (FindCachedOutcomes(key, start) != outcome_cache_lru_.end()))
+    {
+      return;
+    }
+    while ((outcome_cache_num_outcomes_ + outcomes->size())
+           > outcome_cache_max_outcomes_)
+    {
+      const OutcomeCacheItr evict_itr = std::prev(outcome_cache_lru_.end());
+      auto bucket_itr = outcome_cache_.find(evict_itr->key);
+      std::vector<OutcomeCacheItr>& bucket = bucket_itr->second;
+      bucket.erase(std::find(bucket.begin(), bucket.end(), evict_itr));
+      if (bucket.empty())
+      {
+        outcome_cache_.erase(bucket_itr);
+      }
+      outcome_cache_num_outcomes_ -= evict_itr->outcomes->size();
+      outcome_cache_lru_.erase(evict_itr);
+      outcome_cache_evictions_++;
+    }
+    OutcomeCacheEntry entry;
+    entry.key = key;
+    entry.state = start;
+    entry.outcomes = outcomes;
+    outcome_cache_lru_.push_front(entry);
+    outcome_cache_[key].push_back(outcome_cache_lru_.begin());
+    outcome_cache_num_outcomes_ += outcomes->size();
+  }
+
+  // Callers must hold outcome_cache_mutex_. Since hashes may collide, the
+  // cached state must also compare equal to start.
+  OutcomeCacheItr FindCachedOutcomes(
+      const OutcomeCacheKey& key, const State& start)
+  {
+    auto found_itr = outcome_cache_.find(key);
+    if (found_itr != outcome_cache_.end())
+    {
+      for (const OutcomeCacheItr& entry_itr : found_itr->second)
+      {
+        if (outcome_cache_state_equal_fn_(entry_itr->state, start))
+        {
+          return entry_itr;
+        }
+      }
+    }
+    return outcome_cache_lru_.end();
+  }
+
+  void ClearOutcomeCache()
+  {
+    std::lock_guard<std::mutex> lock(outcome_cache_mutex_);
+    outcome_cache_.clear();
+    outcome_cache_lru_.clear();
+    outcome_cache_num_outcomes_ = 0;
+  }
+
+  /// Simulates a single policy execution from initial_state, sampling the
+  /// outcome of each action uniformly from the outcomes of the primitive.
+  /// While the execution runs, a generator seeded with prng_seed replaces the
+  /// calling thread's GetRandomGenerator(), so the execution's outcomes depend
+  /// only on prng_seed as long as primitives draw from GetRandomGenerator().
+  /// Primitive selection is logged to log_fn rather than the registered
+  /// logging function.
+  /// Returns the number of steps taken to complete the execution, or -1 if the
+  /// execution did not complete in max_policy_exec_steps.
+  int64_t SimulateSinglePolicyExecution(
+      const State& initial_state,
+      const int64_t prng_seed,
+      const int64_t max_policy_exec_steps,
+      const std::function<TaskPlanningPolicyQuery(
+          const uint64_t, const State&)>& policy_query_fn,
+      const std::function<void(const std::string&, const int32_t)>& log_fn)
+  {
+    uncertainty_planning_core::PRNG& thread_prng = GetRandomGenerator();
+    uncertainty_planning_core::PRNG execution_prng(prng_seed);
+    std::swap(thread_prng, execution_prng);
+    try
+    {
+      const int64_t policy_exec_steps = SimulatePolicyExecutionSteps(
+          initial_state, max_policy_exec_steps, policy_query_fn, log_fn);
+      std::swap(thread_prng, execution_prng);
+      return policy_exec_steps;
+    }
+    catch (...)
+    {
+      std::swap(thread_prng, execution_prng);
+      throw;
+    }
+  }
+
+  int64_t SimulatePolicyExecutionSteps(
+      const State& initial_state,
+      const int64_t max_policy_exec_steps,
+      const std::function<TaskPlanningPolicyQuery(
+          const uint64_t, const State&)>& policy_query_fn,
+      const std::function<void(const std::string&, const int32_t)>& log_fn)
+  {
+    if (IsTaskCompleted(initial_state)
+        || IsSingleExecutionCompleted(initial_state))
+    {
+      return 0;
+    }
+    State current_state = initial_state;
+    uint64_t desired_transition_id = 0;
+    for (int64_t policy_exec_steps = 1;
+         policy_exec_steps <= max_policy_exec_steps; policy_exec_steps++)
+    {
+      const TaskPlanningPolicyQuery policy_query_response
+          = policy_query_fn(desired_transition_id, current_state);
+      desired_transition_id = policy_query_response.DesiredTransitionId();
+      // Reverse actions between states of equal readiness are no-ops, as in
+      // ExecutePolicy()
+      int64_t primitive_idx = -1;
+      if ((policy_query_response.IsReverseAction() == false)
+          || (ComputeStateReadiness(current_state)
+              != ComputeStateReadiness(policy_query_response.Action())))
+      {
+        primitive_idx
+            = GetRequiredBestPrimitiveIndex(current_state, log_fn);
+      }
+      const std::vector<SimulationResult<State>> outcomes
+          = PerformPrimitive(current_state, primitive_idx);
+      if (outcomes.empty())
+      {
+        throw std::runtime_error(
+            "Primitive produced no outcomes for state "
+            + common_robotics_utilities::print::Print(current_state));
+      }
+      std::uniform_int_distribution<size_t> outcome_dist(
+          0, outcomes.size() - 1);
+      current_state
+          = outcomes[outcome_dist(GetRandomGenerator())].ResultConfig();
+      if (IsTaskCompleted(current_state)
+          || IsSingleExecutionCompleted(current_state))
+      {
+        return policy_exec_steps;
+      }
+    }
+    return -1;
+  }
+
+  /// Returns the index of the primitive to perform to move start towards
+  /// target, or -1 if start should be passed through unchanged
+  int64_t GetTargettedPrimitiveIndex(const State& start, const State& target)
   {
     const uint64_t start_readiness = ComputeStateReadiness(start);
     const uint64_t target_readiness = ComputeStateReadiness(target);
     if (start_readiness < target_readiness)
     {
       Log("We are less ready than our parent", 2);
-      return PerformBestAvailablePrimitive(start);
+      return GetRequiredBestPrimitiveIndex(start);
     }
     else if (start_readiness > target_readiness)
     {
       Log("We are more ready than our parent", 2);
-      const std::vector<State, StateAlloc> outcome_configs(1, start);
-      return MakePrimitiveResults(outcome_configs, true);
+      return -1;
     }
     else
     {
       Log("Performed no-op reverse", 2);
-      const std::vector<State, StateAlloc> outcome_configs(1, start);
-      return MakePrimitiveResults(outcome_configs, true);
+      return -1;
     }
   }
 
-  int64_t NearestNeighborsFn(
-      const TaskPlanningTree& tree,
-      const TaskPlanningState& sampled_state) const
+  /// Max-heap of the tree states available for expansion, keyed by readiness
+  /// Each state's readiness is computed once, when the state is first seen in
+  /// the tree. States disabled for nearest neighbors are discarded lazily when
+  /// they reach the top of the heap (the planner never re-enables them).
+  class StateReadinessQueue
   {
-    UNUSED(sampled_state);
-    // We only consider the start state if nothing has been expanded further!
-    if (tree.size() == 1)
+  private:
+
+    // Entries are <readiness, -index> so that ties go to the lowest index
+    std::priority_queue<std::pair<uint64_t, int64_t>> queue_;
+    size_t num_indexed_states_;
+
+  public:
+
+    StateReadinessQueue() : num_indexed_states_(0) {}
+
+    void Reset()
     {
-      return 0;
+      queue_ = std::priority_queue<std::pair<uint64_t, int64_t>>();
+      num_indexed_states_ = 0;
     }
-    // Get the nearest neighbor (ignoring the disabled states)
-    std::vector<std::pair<int64_t, uint64_t>>
-        per_thread_bests(GetNumOMPThreads(),
-                         std::pair<int64_t, uint64_t>(-1, 0));
-    // Greedy best-first expansion strategy
-    #pragma omp parallel for
-    for (size_t idx = 1; idx < tree.size(); idx++)
+
+    template<typename ReadinessFn>
+    void IndexNewStates(const TaskPlanningTree& tree,
+                        const ReadinessFn& readiness_fn)
     {
-      auto& current_state = tree[idx];
-      // Only check against states enabled for NN checks
-      if (current_state.GetValueImmutable().UseForNearestNeighbors())
+      // The start state is never indexed, since it is only expanded when
+      // nothing else is in the tree
+      if (tree.size() < num_indexed_states_)
+      {
+        Reset();
+      }
+      for (size_t idx = std::max(num_indexed_states_, (size_t)1);
+           idx < tree.size(); idx++)
       {
         auto particles
-            = current_state.GetValueImmutable().GetParticlePositionsImmutable();
+            = tree[idx].GetValueImmutable().GetParticlePositionsImmutable();
         const State& representative_particle = particles.Value().at(0);
-        const uint64_t state_readiness
-            = ComputeStateReadiness(representative_particle);
-  #if defined(_OPENMP)
-        const size_t current_thread_id = (size_t)omp_get_thread_num();
-  #else
-        const size_t current_thread_id = 0;
-  #endif
-        if (state_readiness > per_thread_bests[current_thread_id].second)
+        queue_.push(std::make_pair(readiness_fn(representative_particle),
+                                   -static_cast<int64_t>(idx)));
+      }
+      num_indexed_states_ = tree.size();
+    }
+
+    int64_t GetBestState(const TaskPlanningTree& tree)
+    {
+      while (queue_.size() > 0)
+      {
+        const int64_t best_index = -queue_.top().second;
+        if (tree[(size_t)best_index].GetValueImmutable()
+                .UseForNearestNeighbors())
+        {
+          return best_index;
+        }
+        queue_.pop();
+      }
+      return -1;
+    }
+  };
+
+  /// Table of the tree states that new states may be identical to, keyed by a
+  /// hash of their particles. States are indexed when first seen in the tree.
+  /// Transpositions are never indexed, so every transposition refers to a
+  /// state that is expanded normally, and a transposition is never made to a
+  /// state that can reach the new state's parent, so the tree and its
+  /// transpositions always form a DAG. The table is disabled if either of the
+  /// state hash or equality functions is empty.
+  class StateTranspositionTable
+  {
+  private:
+
+    std::function<uint64_t(const State&)> state_hash_fn_;
+    std::function<bool(const State&, const State&)> state_equal_fn_;
+    std::unordered_map<uint64_t, std::vector<int64_t>> states_by_hash_;
+    // Indices of the transposition states linking to each state
+    std::unordered_map<int64_t, std::vector<int64_t>> incoming_transpositions_;
+    const TaskPlanningTree* tree_;
+    size_t num_indexed_states_;
+
+    // Returns <hash, index> for each particle, sorted so that identical
+    // particle multisets produce identical lists
+    std::vector<std::pair<uint64_t, size_t>> HashParticles(
+        const std::vector<State, StateAlloc>& particles) const
+    {
+      std::vector<std::pair<uint64_t, size_t>> particle_hashes;
+      particle_hashes.reserve(particles.size());
+      for (size_t idx = 0; idx < particles.size(); idx++)
+      {
+        particle_hashes.push_back(
+            std::make_pair(state_hash_fn_(particles[idx]), idx));
+      }
+      std::sort(particle_hashes.begin(), particle_hashes.end());
+      return particle_hashes;
+    }
+
+    static uint64_t CombineHashes(
+        const std::vector<std::pair<uint64_t, size_t>>& particle_hashes)
+    {
+      uint64_t combined_hash = particle_hashes.size();
+      for (size_t idx = 0; idx < particle_hashes.size(); idx++)
+      {
+        combined_hash ^= particle_hashes[idx].first + 0x9e3779b97f4a7c15ull
+                         + (combined_hash << 6) + (combined_hash >> 2);
+      }
+      return combined_hash;
+    }
+
+    // Particles with equal hashes are compared in sorted order, so a hash
+    // collision between different particles of one state can only cause a
+    // missed transposition, never a false one
+    bool ParticlesEqual(
+        const std::vector<State, StateAlloc>& particles,
+        const std::vector<std::pair<uint64_t, size_t>>& particle_hashes,
+        const std::vector<State, StateAlloc>& other_particles) const
+    {
+      if (particles.size() != other_particles.size())
+      {
+        return false;
+      }
+      const std::vector<std::pair<uint64_t, size_t>> other_particle_hashes
+          = HashParticles(other_particles);
+      for (size_t idx = 0; idx < particle_hashes.size(); idx++)
+      {
+        if (particle_hashes[idx].first != other_particle_hashes[idx].first)
+        {
+          return false;
+        }
+        const State& particle = particles[particle_hashes[idx].second];
+        const State& other_particle
+            = other_particles[other_particle_hashes[idx].second];
+        if (!state_equal_fn_(particle, other_particle))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Can target_index be reached from start_index by following child and
+    // transposition links? Searches backwards from target_index over parent
+    // and incoming transposition links, so the cost is bounded by the number
+    // of states that can reach target_index (its ancestors, plus those of the
+    // transposition states linking to it), not by the size of the tree.
+    bool CanReachState(const int64_t start_index,
+                       const int64_t target_index) const
+    {
+      std::unordered_set<int64_t> visited;
+      std::vector<int64_t> index_stack(1, target_index);
+      while (index_stack.size() > 0)
+      {
+        const int64_t current_index = index_stack.back();
+        index_stack.pop_back();
+        if (current_index == start_index)
+        {
+          return true;
+        }
+        if ((current_index < 0) || !visited.insert(current_index).second)
         {
-          per_thread_bests[current_thread_id].first = (int64_t)idx;
-          per_thread_bests[current_thread_id].second = state_readiness;
+          continue;
+        }
+        index_stack.push_back(
+            (*tree_)[static_cast<size_t>(current_index)].GetParentIndex());
+        const auto found_itr = incoming_transpositions_.find(current_index);
+        if (found_itr != incoming_transpositions_.end())
+        {
+          index_stack.insert(index_stack.end(), found_itr->second.begin(),
+                             found_itr->second.end());
         }
       }
+      return false;
     }
-    int64_t best_index = -1;
-    uint64_t best_state_readiness = 0;
-    for (size_t idx = 0; idx < per_thread_bests.size(); idx++)
+
+  public:
+
+    StateTranspositionTable(
+        const std::function<uint64_t(const State&)>& state_hash_fn,
+        const std::function<bool(const State&, const State&)>& state_equal_fn)
+      : state_hash_fn_(state_hash_fn), state_equal_fn_(state_equal_fn),
+        tree_(nullptr), num_indexed_states_(0) {}
+
+    bool IsEnabled() const
     {
-      const uint64_t thread_best_state_readiness = per_thread_bests[idx].second;
-      const int64_t thread_best_index = per_thread_bests[idx].first;
-      if (thread_best_index >= 0)
+      return (static_cast<bool>(state_hash_fn_)
+              && static_cast<bool>(state_equal_fn_));
+    }
+
+    void IndexNewStates(const TaskPlanningTree& tree)
+    {
+      if (!IsEnabled())
+      {
+        return;
+      }
+      if ((tree_ != &tree) || (tree.size() < num_indexed_states_))
       {
-        if (thread_best_state_readiness > best_state_readiness)
+        states_by_hash_.clear();
+        incoming_transpositions_.clear();
+        num_indexed_states_ = 0;
+      }
+      tree_ = &tree;
+      for (size_t idx = num_indexed_states_; idx < tree.size(); idx++)
+      {
+        const TaskPlanningState& state = tree[idx].GetValueImmutable();
+        if (state.IsTransposition())
         {
-          best_index = thread_best_index;
-          best_state_readiness = thread_best_state_readiness;
+          incoming_transpositions_[state.GetTranspositionIndex()].push_back(
+              static_cast<int64_t>(idx));
+          continue;
         }
+        auto particles = state.GetParticlePositionsImmutable();
+        const uint64_t state_hash
+            = CombineHashes(HashParticles(particles.Value()));
+        states_by_hash_[state_hash].push_back(static_cast<int64_t>(idx));
       }
+      num_indexed_states_ = tree.size();
     }
+
+    /// Returns the index of an indexed state with identical particles, or -1.
+    /// parent_index and parent_state_id identify the parent of the new state.
+    /// States that can reach the parent (e.g. the parent itself, if the action
+    /// left the state unchanged) are skipped, since a transposition to them
+    /// would create a cycle.
+    int64_t FindTransposition(
+        const std::vector<State, StateAlloc>& particles,
+        const int64_t parent_index, const uint64_t parent_state_id) const
+    {
+      if (!IsEnabled() || (tree_ == nullptr))
+      {
+        return -1;
+      }
+      // Without the parent, we can't rule out cycles
+      if ((parent_index < 0)
+          || (parent_index >= static_cast<int64_t>(tree_->size()))
+          || ((*tree_)[static_cast<size_t>(parent_index)].GetValueImmutable()
+                  .GetStateId() != parent_state_id))
+      {
+        return -1;
+      }
+      const std::vector<std::pair<uint64_t, size_t>> particle_hashes
+          = HashParticles(particles);
+      const auto found_itr
+          = states_by_hash_.find(CombineHashes(particle_hashes));
+      if (found_itr == states_by_hash_.end())
+      {
+        return -1;
+      }
+      const std::vector<int64_t>& candidate_indices = found_itr->second;
+      for (size_t idx = 0; idx < candidate_indices.size(); idx++)
+      {
+        const int64_t candidate_index = candidate_indices[idx];
+        auto candidate_particles
+            = (*tree_)[static_cast<size_t>(candidate_index)].GetValueImmutable()
+                .GetParticlePositionsImmutable();
+        if (ParticlesEqual(particles, particle_hashes,
+                           candidate_particles.Value())
+            && !CanReachState(candidate_index, parent_index))
+        {
+          return candidate_index;
+        }
+      }
+      return -1;
+    }
+  };
+
+  int64_t NearestNeighborsFn(
+      const TaskPlanningTree& tree,
+      const TaskPlanningState& sampled_state,
+      StateReadinessQueue& readiness_queue) const
+  {
+    UNUSED(sampled_state);
+    // We only consider the start state if nothing has been expanded further!
+    if (tree.size() == 1)
+    {
+      return 0;
+    }
+    // Get the nearest neighbor (ignoring the disabled states)
+    // Greedy best-first expansion strategy
+    readiness_queue.IndexNewStates(tree, [&] (const State& state)
+    {
+      return ComputeStateReadiness(state);
+    });
+    const int64_t best_index = readiness_queue.GetBestState(tree);
     if (best_index >= 0)
     {
       const TaskPlanningState& best_state
@@ -787,14 +1476,15 @@ private:
       parent_cluster_membership
           = IdentifyClusterMembersImpl(
               parent.GetParticlePositionsImmutable().Value(),
-              simulation_result);
+              parent.GetClusterDescriptor(), simulation_result);
     }
     else
     {
       const std::vector<State, StateAlloc> parent_cluster(
             1, parent.GetExpectation());
       parent_cluster_membership
-          = IdentifyClusterMembersImpl(parent_cluster, simulation_result);
+          = IdentifyClusterMembersImpl(
+              parent_cluster, std::vector<uint8_t>(), simulation_result);
     }
     uint32_t reached_parent = 0u;
     // Get the target position;
@@ -811,10 +1501,12 @@ private:
 
   std::vector<std::pair<TaskPlanningState, int64_t>>
   PerformStatePropagation(const TaskPlanningState& nearest,
+                          const int64_t nearest_index,
                           const TaskPlanningState& target,
                           const TaskStateRobotBasePtr& robot_ptr,
                           const double step_size,
-                          const uint32_t planner_action_try_attempts)
+                          const uint32_t planner_action_try_attempts,
+                          const StateTranspositionTable& transposition_table)
   {
     // Increment the transition ID
     transition_id_++;
@@ -871,11 +1563,26 @@ private:
               ((is_split_child) ? split_id_ : 0u),
               action_is_nominally_independent);
         propagated_state.UpdateStatistics(robot_ptr);
+        propagated_state.SetClusterDescriptor(MakeClusterDescriptor(
+            ComputeStateReadiness(particle_locations.front())));
         // Compute reversibility
         const std::pair<uint32_t, uint32_t> reverse_edge_check
             = ComputeReverseEdgeProbability(nearest, propagated_state);
         propagated_state.UpdateReverseAttemptAndReachedCounts(
               reverse_edge_check.first, reverse_edge_check.second);
+        // Identical states reached along other paths are not expanded again
+        const int64_t transposition_index
+            = transposition_table.FindTransposition(
+                particle_locations, nearest_index, nearest.GetStateId());
+        if (transposition_index >= 0)
+        {
+          Log("New state " + std::to_string(state_counter_)
+              + " is identical to tree state "
+              + std::to_string(transposition_index), 1);
+          propagated_state.SetTranspositionIndex(transposition_index);
+          propagated_state.DisableForNearestNeighbors();
+          transpositions_detected_++;
+        }
         // Store the state
         result_states[idx].first = propagated_state;
         result_states[idx].second = -1;
@@ -888,44 +1595,19 @@ private:
     {
       // Now that we have the forward-propagated states, we go back and update
       // their effective edge P(feasibility)
+      // Only if a state has nominally independent outcomes can we expect
+      // particles that return to the parent to actually reach a different
+      // outcome in future repeats
+      RetryProbabilitySolver retry_solver;
+      for (size_t idx = 0; idx < result_states.size(); idx++)
+      {
+        retry_solver.AddOutcome(result_states[idx].first);
+      }
       for (size_t idx = 0; idx < result_states.size(); idx++)
       {
         TaskPlanningState& current_state = result_states[idx].first;
-        double percent_active = 1.0;
-        double p_reached = 0.0;
-        for (uint32_t try_attempt = 0;
-             try_attempt < planner_action_try_attempts;
-             try_attempt++)
-        {
-          // How many particles got to our state on this attempt?
-          p_reached
-              += (percent_active * current_state.GetRawEdgePfeasibility());
-          // Update the percent of particles that are still usefully active
-          double updated_percent_active = 0.0;
-          for (size_t other_idx = 0;
-               other_idx < result_states.size();
-               other_idx++)
-          {
-            if (other_idx != idx)
-            {
-              const TaskPlanningState& other_state
-                  = result_states[other_idx].first;
-              // Only if this state has nominally independent outcomes can we
-              // expect particles that return to the parent to actually reach
-              // a different outcome in future repeats
-              if (other_state.IsActionOutcomeNominallyIndependent())
-              {
-                const double p_reached_other
-                    = percent_active * other_state.GetRawEdgePfeasibility();
-                const double p_returned_to_parent
-                    = p_reached_other
-                      * other_state.GetReverseEdgePfeasibility();
-                updated_percent_active += p_returned_to_parent;
-              }
-            }
-          }
-          percent_active = updated_percent_active;
-        }
+        double p_reached = retry_solver.ComputeReachedProbability(
+            idx, planner_action_try_attempts);
         if ((p_reached >= 0.0) && (p_reached <= 1.0))
         {
           current_state.SetEffectiveEdgePfeasibility(p_reached);
@@ -1008,7 +1690,9 @@ public:
       task_completed_fn_(task_completed_fn),
       logging_fn_(logging_fn),
       drawing_fn_(drawing_fn),
-      debug_level_(debug_level)
+      debug_level_(debug_level),
+      outcome_cache_max_outcomes_(0),
+      outcome_cache_num_outcomes_(0)
   {
     ResetGenerators(prng_seed);
     ResetStatistics();
@@ -1058,11 +1742,18 @@ public:
                                      clustering_ptr,
                                      logging_fn_);
     const std::chrono::duration<double> planner_time_limit(time_limit);
+    StateReadinessQueue readiness_queue;
+    StateTranspositionTable transposition_table(
+        transposition_state_hash_fn_, transposition_state_equal_fn_);
+    // Propagation always starts from the state just selected
+    int64_t nearest_index = -1;
     const std::function<int64_t(const TaskPlanningTree&,
                                 const TaskPlanningState&)> nearest_neighbor_fn
         = [&] (const TaskPlanningTree& tree, const TaskPlanningState& sample)
     {
-      return NearestNeighborsFn(tree, sample);
+      transposition_table.IndexNewStates(tree);
+      nearest_index = NearestNeighborsFn(tree, sample, readiness_queue);
+      return nearest_index;
     };
     const std::function<std::vector<std::pair<TaskPlanningState, int64_t>>(
           const TaskPlanningState&,
@@ -1070,7 +1761,8 @@ public:
         = [&] (const TaskPlanningState& start, const TaskPlanningState& target)
     {
       return PerformStatePropagation(
-            start, target, robot_ptr, step_size, edge_attempt_count);
+            start, nearest_index, target, robot_ptr, step_size,
+            edge_attempt_count, transposition_table);
     };
     const std::function<bool(const State&)> goal_reached_fn
         = [&] (const State& candidate)
@@ -1083,6 +1775,7 @@ public:
       return uncertainty_planning_core::UserGoalCheckWrapperFn(
             candidate_goal_state, goal_reached_fn);
     };
+    planning_space.SetPolicySnapshotCallback(policy_snapshot_fn_);
     ResetStatistics();
     return planning_space.PlanGoalSampling(start_state, 0.0,
                                            nearest_neighbor_fn,
@@ -1133,26 +1826,8 @@ public:
     int64_t successful_executions = 0;
     bool task_execution_successful = false;
     // Make outcome clustering function used in policy queries
-    std::function<bool(const std::vector<State, StateAlloc>&, const State&)>
-        policy_outcome_clustering_fn
-        = [&] (const std::vector<State, StateAlloc>& particles,
-               const State& result_state)
-    {
-      std::vector<SimulationResult<State>> result_particles;
-      result_particles.emplace_back(
-            SimulationResult<State>(result_state, result_state, false, false));
-      const std::vector<uint8_t> cluster_membership
-          = IdentifyClusterMembersImpl(particles, result_particles);
-      const uint8_t parent_cluster_membership = cluster_membership.at(0);
-      if (parent_cluster_membership > 0x00)
-      {
-          return true;
-      }
-      else
-      {
-          return false;
-      }
-    };
+    const typename TaskPlanningPolicy::StateClusteringFn
+        policy_outcome_clustering_fn = MakePolicyStateClusteringFn();
     // Execute until done or out of iterations
     while ((task_execution_successful == false)
            && (num_executions < max_policy_executions))
@@ -1329,6 +2004,165 @@ public:
     return std::make_pair(policy, policy_statistics);
   }
 
+  /// Simulate executions of a task policy, using the outcomes returned by
+  /// each primitive's GetOutcomes() as a sampled simulator of Execute()
+  /// Executions are independent, and run in parallel if every registered
+  /// primitive is thread-safe (see ActionPrimitiveInterface::IsThreadSafe()),
+  /// in which case the state readiness, completion, and clustering functions
+  /// are also called concurrently.
+  /// Returns the policy (with edge transition probabilities learned from all
+  /// simulated executions, if enabled) and a <string, double> dictionary of
+  /// simulation statistics
+  /// Parameters:
+  /// - Task policy
+  /// - Function to produce the initial state of each execution (called
+  ///   serially, once per execution, before any execution starts)
+  /// - Number of executions to simulate
+  /// - Max number of execution steps in each execution
+  /// - Allow branch jumping in policy queries
+  /// - Learn transition probabilities from all simulated executions. Outcomes
+  ///   are learned in the order they are observed, so with parallel
+  ///   executions the learned policy may differ between runs. Otherwise, each
+  ///   execution learns only within itself, like ExecutePolicy() without
+  ///   cumulative learning.
+  std::pair<TaskPlanningPolicy, std::map<std::string, double>>
+  SimulatePolicy(const TaskPlanningPolicy& starting_policy,
+                 const std::function<State(void)>& exec_initialization_fn,
+                 const int64_t num_policy_executions,
+                 const int64_t max_policy_exec_steps,
+                 const bool allow_branch_jumping,
+                 const bool enable_learning)
+  {
+    if (num_policy_executions <= 0)
+    {
+      throw std::invalid_argument("num_policy_executions must be > 0");
+    }
+    // Initial states and per-execution PRNG seeds are drawn serially, and each
+    // execution draws only from its own generator (see
+    // SimulateSinglePolicyExecution()), so without cumulative learning the
+    // sampled outcomes do not depend on scheduling
+    std::uniform_int_distribution<int64_t>
+        seed_dist(0, std::numeric_limits<int64_t>::max());
+    std::vector<State, StateAlloc> initial_states;
+    std::vector<int64_t> prng_seeds;
+    initial_states.reserve(static_cast<size_t>(num_policy_executions));
+    prng_seeds.reserve(static_cast<size_t>(num_policy_executions));
+    for (int64_t idx = 0; idx < num_policy_executions; idx++)
+    {
+      initial_states.push_back(exec_initialization_fn());
+      prng_seeds.push_back(seed_dist(GetRandomGenerator()));
+    }
+    // Policy and primitive selection logging is silenced, since thousands of
+    // executions may be logging from many threads at once
+    TaskPlanningPolicy simulation_policy = starting_policy;
+    const std::function<void(const std::string&, const int32_t)> null_logger
+        = [] (const std::string&, const int32_t) {};
+    simulation_policy.RegisterLoggingFunction(null_logger);
+    const typename TaskPlanningPolicy::StateClusteringFn
+        policy_outcome_clustering_fn = MakePolicyStateClusteringFn();
+    std::unique_ptr<TaskPlanningPolicyLearner> policy_learner;
+    if (enable_learning)
+    {
+      policy_learner.reset(new TaskPlanningPolicyLearner(
+          simulation_policy, policy_outcome_clustering_fn));
+    }
+    bool all_primitives_thread_safe = true;
+    for (size_t idx = 0; idx < primitives_.size(); idx++)
+    {
+      if (primitives_[idx]->IsThreadSafe() == false)
+      {
+        all_primitives_thread_safe = false;
+      }
+    }
+    Log("Simulating " + std::to_string(num_policy_executions)
+        + " policy executions "
+        + ((all_primitives_thread_safe) ? "in parallel" : "serially"), 2);
+    std::vector<int64_t> execution_steps(initial_states.size(), -1);
+    std::vector<std::exception_ptr> execution_exceptions(initial_states.size());
+    #pragma omp parallel for schedule(dynamic) if (all_primitives_thread_safe)
+    for (int64_t idx = 0; idx < num_policy_executions; idx++)
+    {
+      try
+      {
+        std::function<TaskPlanningPolicyQuery(const uint64_t, const State&)>
+            policy_query_fn;
+        // Without cumulative learning, each execution learns on its own copy
+        // of the policy (which shares the planner tree until modified)
+        std::unique_ptr<TaskPlanningPolicy> working_policy;
+        if (policy_learner)
+        {
+          policy_query_fn = [&] (const uint64_t performed_transition_id,
+                                 const State& current_state)
+          {
+            return policy_learner->QueryBestAction(
+                performed_transition_id, current_state, allow_branch_jumping,
+                true);
+          };
+        }
+        else
+        {
+          working_policy.reset(new TaskPlanningPolicy(simulation_policy));
+          policy_query_fn = [&] (const uint64_t performed_transition_id,
+                                 const State& current_state)
+          {
+            return working_policy->QueryBestAction(
+                performed_transition_id, current_state, allow_branch_jumping,
+                true, policy_outcome_clustering_fn);
+          };
+        }
+        execution_steps[static_cast<size_t>(idx)]
+            = SimulateSinglePolicyExecution(
+                initial_states[static_cast<size_t>(idx)],
+                prng_seeds[static_cast<size_t>(idx)], max_policy_exec_steps,
+                policy_query_fn, null_logger);
+      }
+      catch (...)
+      {
+        execution_exceptions[static_cast<size_t>(idx)]
+            = std::current_exception();
+      }
+    }
+    for (size_t idx = 0; idx < execution_exceptions.size(); idx++)
+    {
+      if (execution_exceptions[idx])
+      {
+        std::rethrow_exception(execution_exceptions[idx]);
+      }
+    }
+    // Aggregate the results
+    int64_t successful_executions = 0;
+    int64_t successful_execution_steps = 0;
+    for (size_t idx = 0; idx < execution_steps.size(); idx++)
+    {
+      if (execution_steps[idx] >= 0)
+      {
+        successful_executions++;
+        successful_execution_steps += execution_steps[idx];
+      }
+    }
+    TaskPlanningPolicy result_policy
+        = (policy_learner) ? *(policy_learner->GetLearnedPolicy())
+                           : starting_policy;
+    result_policy.RegisterLoggingFunction(logging_fn_);
+    const double policy_success
+        = (double)successful_executions / (double)num_policy_executions;
+    Log("Simulated " + std::to_string(num_policy_executions)
+        + " policy executions, of which "
+        + std::to_string(successful_executions) + " were successful", 2);
+    std::map<std::string, double> policy_statistics;
+    policy_statistics["Execution policy success"] = policy_success;
+    policy_statistics["successful policy executions"]
+        = static_cast<double>(successful_executions);
+    policy_statistics["number of policy executions"]
+        = static_cast<double>(num_policy_executions);
+    policy_statistics["mean successful policy execution steps"]
+        = (successful_executions > 0)
+            ? (double)successful_execution_steps
+                / (double)successful_executions
+            : 0.0;
+    return std::make_pair(result_policy, policy_statistics);
+  }
+
   /// Add a new primitive
   /// Primitives must have unique names, but they can have the same ranking
   /// If multiple primitives share the same ranking and are candidates for a
@@ -1363,6 +2197,31 @@ public:
   void ClearPrimitives()
   {
     primitives_.clear();
+    // Cached outcomes are keyed by primitive index
+    ClearOutcomeCache();
+  }
+
+  /// Enable memoization of GetOutcomes() for primitives that report
+  /// HasDeterministicOutcomes(). Outcomes are looked up by primitive and by
+  /// state_hash_fn(state), and are only reused for a state that compares equal
+  /// under state_equal_fn, so hash collisions cost a cache miss rather than
+  /// returning another state's outcomes. States that are equal must hash
+  /// equal. max_cached_outcomes bounds the total number of outcome states held
+  /// in the cache; 0 disables the cache (the default).
+  void SetOutcomeCache(
+      const std::function<uint64_t(const State&)>& state_hash_fn,
+      const std::function<bool(const State&, const State&)>& state_equal_fn,
+      const size_t max_cached_outcomes)
+  {
+    if ((max_cached_outcomes > 0) && !(state_hash_fn && state_equal_fn))
+    {
+      throw std::invalid_argument(
+          "state_hash_fn and state_equal_fn must be provided");
+    }
+    ClearOutcomeCache();
+    outcome_cache_state_hash_fn_ = state_hash_fn;
+    outcome_cache_state_equal_fn_ = state_equal_fn;
+    outcome_cache_max_outcomes_ = max_cached_outcomes;
   }
 
   std::string GetBestPrimitiveName(const State& state)
@@ -1398,6 +2257,51 @@ public:
     task_completed_fn_ = fn;
   }
 
+  /// Cluster outcomes by state identity rather than by readiness alone
+  /// Outcome states are in the same cluster only if state_equal_fn says they
+  /// are equal, and identical states must hash identically with
+  /// state_hash_fn. Pass empty functions to cluster by readiness (the
+  /// default).
+  void SetStateClusteringFns(
+      const std::function<uint64_t(const State&)>& state_hash_fn,
+      const std::function<bool(const State&, const State&)>& state_equal_fn)
+  {
+    cluster_state_hash_fn_ = state_hash_fn;
+    cluster_state_equal_fn_ = state_equal_fn;
+  }
+
+  /// Enable transposition detection (graph search mode) in PlanPolicy
+  /// When a new state has the same particles as a state already in the tree
+  /// (compared with state_hash_fn and state_equal_fn), it is added as a
+  /// transposition of that state instead of being expanded again, so the
+  /// planned policy is a DAG rather than a tree. States that can reach the new
+  /// state's parent (e.g. the parent itself, after an action that changes
+  /// nothing) are never used, since that would create a cycle. Identical
+  /// states must hash identically. Pass empty functions to disable (the
+  /// default).
+  void SetStateTranspositionFns(
+      const std::function<uint64_t(const State&)>& state_hash_fn,
+      const std::function<bool(const State&, const State&)>& state_equal_fn)
+  {
+    transposition_state_hash_fn_ = state_hash_fn;
+    transposition_state_equal_fn_ = state_equal_fn;
+  }
+
+  /// Enable anytime planning in PlanPolicy
+  /// While planning, policy_snapshot_fn is called with a snapshot of the
+  /// policy and its P(task completed) each time P(task completed) improves and
+  /// is at least minimum_goal_candiate_probability, so execution can start
+  /// before planning finishes. Snapshots are built incrementally from the
+  /// planner tree. The function is called from the planning thread, so it
+  /// should return quickly; copying the policy is cheap. Pass an empty
+  /// function to disable (the default).
+  void SetPolicySnapshotCallback(
+      const std::function<void(const TaskPlanningPolicy&, const double)>&
+          policy_snapshot_fn)
+  {
+    policy_snapshot_fn_ = policy_snapshot_fn;
+  }
+
   virtual int32_t GetDebugLevel() const
   {
     return debug_level_;
@@ -1425,6 +2329,18 @@ public:
     statistics["state_counter"] = (double)state_counter_;
     statistics["transition_id"] = (double)transition_id_;
     statistics["split_id"] = (double)split_id_;
+    statistics["transpositions_detected"] = (double)transpositions_detected_;
+    std::lock_guard<std::mutex> lock(outcome_cache_mutex_);
+    const uint64_t outcome_cache_queries
+        = outcome_cache_hits_ + outcome_cache_misses_;
+    statistics["outcome_cache_hits"] = (double)outcome_cache_hits_;
+    statistics["outcome_cache_misses"] = (double)outcome_cache_misses_;
+    statistics["outcome_cache_hit_rate"]
+        = (outcome_cache_queries > 0)
+            ? (double)outcome_cache_hits_ / (double)outcome_cache_queries
+            : 0.0;
+    statistics["outcome_cache_evictions"] = (double)outcome_cache_evictions_;
+    statistics["outcome_cache_outcomes"] = (double)outcome_cache_num_outcomes_;
     return statistics;
   }
 
@@ -1433,6 +2349,11 @@ public:
     state_counter_ = 0;
     transition_id_ = 0;
     split_id_ = 0;
+    transpositions_detected_ = 0;
+    std::lock_guard<std::mutex> lock(outcome_cache_mutex_);
+    outcome_cache_hits_ = 0;
+    outcome_cache_misses_ = 0;
+    outcome_cache_evictions_ = 0;
   }
 
   virtual std::vector<std::vector<size_t>> ClusterParticles(
@@ -1453,7 +2374,32 @@ public:
   {
     UNUSED(robot);
     UNUSED(display_fn);
-    return IdentifyClusterMembersImpl(cluster, particles);
+    return IdentifyClusterMembersImpl(
+        cluster, std::vector<uint8_t>(), particles);
+  }
+
+  virtual std::vector<uint8_t> ComputeClusterDescriptor(
+    const TaskStateRobotBasePtr& robot,
+    const std::vector<State, StateAlloc>& cluster)
+  {
+    UNUSED(robot);
+    if (cluster.size() > 0)
+    {
+      return MakeClusterDescriptor(ComputeStateReadiness(cluster.front()));
+    }
+    return std::vector<uint8_t>();
+  }
+
+  virtual std::vector<uint8_t> IdentifyClusterMembersWithDescriptor(
+    const TaskStateRobotBasePtr& robot,
+    const std::vector<State, StateAlloc>& cluster,
+    const std::vector<uint8_t>& cluster_descriptor,
+    const std::vector<SimulationResult<State>>& particles,
+    const DisplayFn& display_fn)
+  {
+    UNUSED(robot);
+    UNUSED(display_fn);
+    return IdentifyClusterMembersImpl(cluster, cluster_descriptor, particles);
   }
 
   virtual State Sample(uncertainty_planning_core::PRNG& prng)
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <common_robotics_utilities/openmp_helpers.hpp>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace uncertainty_planning_core
+{
+/*
+ * Pads T with a full cache line on each side, so that values written by
+ * different threads (e.g. adjacent elements of a vector) never share a cache
+ * line. Padding is used instead of alignas(64), since std::allocator does not
+ * honor over-aligned types before C++17.
+ */
+template<typename T>
+struct CacheLinePadded
+{
+  uint8_t leading_padding[64];
+  T value;
+  uint8_t trailing_padding[64];
+};
+
+/*
+ * Work-stealing thread pool for the library's parallel loops.
+ *
+ * ParallelForChunks() splits a range into chunks, queues them, and then helps
+ * run queued chunks until its own chunks are done. Idle workers steal chunks
+ * from the other workers' queues. Since waiting callers keep running chunks,
+ * calling ParallelForChunks() from inside a chunk (nested parallelism) uses
+ * the same threads instead of creating more.
+ *
+ * Worker threads limit OpenMP to a single thread, so OpenMP parallel regions
+ * in user code called from a chunk (e.g. distance or clustering functions)
+ * don't oversubscribe the cores.
+ *
+ * Chunks are identified by index, so per-chunk results (e.g. the best element
+ * of each chunk) can be stored without knowing which thread ran the chunk.
+ */
+class ThreadPool
+{
+public:
+  typedef std::function<void(const size_t, const int64_t, const int64_t)>
+      ChunkFn;
+
+private:
+  struct ParallelForJob
+  {
+    const ChunkFn* chunk_fn = nullptr;
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    size_t remaining_chunks = 0;
+    std::exception_ptr exception;
+  };
+
+  struct ChunkTask
+  {
+    ParallelForJob* job = nullptr;
+    size_t chunk_index = 0;
+    int64_t chunk_begin = 0;
+    int64_t chunk_end = 0;
+  };
+
+  struct TaskQueue
+  {
+    std::mutex mutex;
+    std::deque<ChunkTask> tasks;
+  };
+
+  size_t num_threads_;
+  // One queue per worker thread
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> queued_tasks_;
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool shutdown_ = false;
+
+  // Pool and queue of the current thread, if it is a worker thread
+  static const ThreadPool*& CurrentPool()
+  {
+    static thread_local const ThreadPool* current_pool = nullptr;
+    return current_pool;
+  }
+
+  static size_t& CurrentQueueIndex()
+  {
+    static thread_local size_t current_queue_index = 0;
+    return current_queue_index;
+  }
+
+  bool IsWorkerThread() const { return CurrentPool() == this; }
+
+  void PushTask(const size_t queue_index, const ChunkTask& task)
+  {
+    TaskQueue& queue = *queues_.at(queue_index);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+
+  /*
+   * Workers take the most recently queued task from their own queue, and
+   * steal the oldest queued task from other queues. Pass own_queue_index >=
+   * queues_.size() to only steal.
+   */
+  bool TryPopTask(const size_t own_queue_index, ChunkTask& task)
+  {
+    if (own_queue_index < queues_.size())
+    {
+      TaskQueue& own_queue = *queues_[own_queue_index];
+      std::lock_guard<std::mutex> lock(own_queue.mutex);
+      if (own_queue.tasks.size() > 0)
+      {
+        task = own_queue.tasks.back();
+        own_queue.tasks.pop_back();
+        queued_tasks_--;
+        return true;
+      }
+    }
+    const size_t start_index
+        = (own_queue_index < queues_.size()) ? own_queue_index + 1 : 0;
+    for (size_t offset = 0; offset < queues_.size(); offset++)
+    {
+      const size_t queue_index = (start_index + offset) % queues_.size();
+      if (queue_index == own_queue_index)
+      {
+        continue;
+      }
+      TaskQueue& queue = *queues_[queue_index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.size() > 0)
+      {
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        queued_tasks_--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void RunTask(const ChunkTask& task)
+  {
+    ParallelForJob& job = *task.job;
+    std::exception_ptr exception;
+    try
+    {
+      (*job.chunk_fn)(task.chunk_index, task.chunk_begin, task.chunk_end);
+    }
+    catch (...)
+    {
+      exception = std::current_exception();
+    }
+    // Once the last chunk is done, the caller may destroy the job as soon as
+    // we release the lock, so we must not touch the job after that
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (exception && !job.exception)
+    {
+      job.exception = exception;
+    }
+    job.remaining_chunks--;
+    if (job.remaining_chunks == 0)
+    {
+      job.done_cv.notify_all();
+    }
+  }
+
+  void WorkerLoop(const size_t queue_index)
+  {
+    CurrentPool() = this;
+    CurrentQueueIndex() = queue_index;
+#if defined(_OPENMP)
+    omp_set_num_threads(1);
+#endif
+    while (true)
+    {
+      ChunkTask task;
+      if (TryPopTask(queue_index, task))
+      {
+        RunTask(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      sleep_cv_.wait(lock, [&] ()
+      {
+        return shutdown_ || (queued_tasks_.load() > 0);
+      });
+      if (shutdown_)
+      {
+        return;
+      }
+    }
+  }
+
+public:
+  /*
+   * num_threads includes the calling thread, so num_threads - 1 worker
+   * threads are started. Pass 0 to use the OpenMP thread count.
+   */
+  explicit ThreadPool(const size_t num_threads)
+      : num_threads_(num_threads), queued_tasks_(0)
+  {
+    if (num_threads_ == 0)
+    {
+      num_threads_ = static_cast<size_t>(std::max(
+          common_robotics_utilities::openmp_helpers::GetMaxOmpThreads(), 1));
+    }
+    for (size_t idx = 0; idx < (num_threads_ - 1); idx++)
+    {
+      queues_.emplace_back(new TaskQueue());
+    }
+    for (size_t idx = 0; idx < queues_.size(); idx++)
+    {
+      workers_.emplace_back(&ThreadPool::WorkerLoop, this, idx);
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      shutdown_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (size_t idx = 0; idx < workers_.size(); idx++)
+    {
+      workers_[idx].join();
+    }
+  }
+
+  // Library-wide pool, used unless a separate pool is configured
+  static std::shared_ptr<ThreadPool> GetSharedPool()
+  {
+    static const std::shared_ptr<ThreadPool> shared_pool
+        = std::make_shared<ThreadPool>(0);
+    return shared_pool;
+  }
+
+  size_t NumThreads() const { return num_threads_; }
+
+  // Picks a grain size giving a few chunks per thread
+  size_t DefaultGrainSize(const int64_t begin, const int64_t end) const
+  {
+    if (end <= begin)
+    {
+      return 1;
+    }
+    const size_t num_elements = static_cast<size_t>(end - begin);
+    return std::max(num_elements / (num_threads_ * 4), static_cast<size_t>(1));
+  }
+
+  static size_t NumChunks(const int64_t begin, const int64_t end,
+                          const size_t grain_size)
+  {
+    if (end <= begin)
+    {
+      return 0;
+    }
+    if (grain_size == 0)
+    {
+      throw std::invalid_argument("grain_size must be > 0");
+    }
+    const size_t num_elements = static_cast<size_t>(end - begin);
+    return (num_elements + grain_size - 1) / grain_size;
+  }
+
+  /*
+   * Calls chunk_fn(chunk_index, chunk_begin, chunk_end) for each of the
+   * NumChunks(begin, end, grain_size) chunks of [begin, end), in parallel,
+   * and returns once all chunks are done. If any chunk throws, the first
+   * exception is rethrown once all chunks are done.
+   */
+  void ParallelForChunks(const int64_t begin, const int64_t end,
+                         const size_t grain_size, const ChunkFn& chunk_fn)
+  {
+    const size_t num_chunks = NumChunks(begin, end, grain_size);
+    const auto chunk_begin_fn = [&] (const size_t chunk_index)
+    {
+      return begin + static_cast<int64_t>(chunk_index * grain_size);
+    };
+    const auto chunk_end_fn = [&] (const size_t chunk_index)
+    {
+      return std::min(chunk_begin_fn(chunk_index)
+                      + static_cast<int64_t>(grain_size), end);
+    };
+    // Don't bother queueing work that won't run in parallel
+    if ((num_chunks <= 1) || queues_.empty())
+    {
+      for (size_t chunk_index = 0; chunk_index < num_chunks; chunk_index++)
+      {
+        chunk_fn(chunk_index, chunk_begin_fn(chunk_index),
+                 chunk_end_fn(chunk_index));
+      }
+      return;
+    }
+    ParallelForJob job;
+    job.chunk_fn = &chunk_fn;
+    job.remaining_chunks = num_chunks;
+    // Workers queue their chunks locally (other workers will steal them),
+    // other callers spread them over the workers
+    const bool is_worker_thread = IsWorkerThread();
+    const size_t own_queue_index
+        = (is_worker_thread) ? CurrentQueueIndex() : queues_.size();
+    for (size_t chunk_index = 0; chunk_index < num_chunks; chunk_index++)
+    {
+      ChunkTask task;
+      task.job = &job;
+      task.chunk_index = chunk_index;
+      task.chunk_begin = chunk_begin_fn(chunk_index);
+      task.chunk_end = chunk_end_fn(chunk_index);
+      const size_t queue_index = (is_worker_thread)
+                                 ? own_queue_index
+                                 : (chunk_index % queues_.size());
+      // Count the task first, so the count never goes negative
+      queued_tasks_++;
+      PushTask(queue_index, task);
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    sleep_cv_.notify_all();
+    // Help out until our chunks are done
+    while (true)
+    {
+      {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (job.remaining_chunks == 0)
+        {
+          break;
+        }
+      }
+      ChunkTask task;
+      if (TryPopTask(own_queue_index, task))
+      {
+        RunTask(task);
+      }
+      else
+      {
+        // All our chunks have been taken by other threads
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done_cv.wait(lock, [&] () { return job.remaining_chunks == 0; });
+        break;
+      }
+    }
+    if (job.exception)
+    {
+      std::rethrow_exception(job.exception);
+    }
+  }
+
+  /*
+   * Finds the index in [begin, end) with the best value, in parallel.
+   * candidate_fn(index, value) sets the value of index, and returns false if
+   * index should be skipped. is_better_fn(first, second) returns true if
+   * first is strictly better than second. Only values better than
+   * initial_value are selected, and ties go to the lowest index. Returns
+   * (-1, initial_value) if no value is selected.
+   */
+  template<typename Value, typename CandidateFn, typename IsBetterFn>
+  std::pair<int64_t, Value> ParallelArgBest(
+      const int64_t begin, const int64_t end, const size_t grain_size,
+      const Value& initial_value, const CandidateFn& candidate_fn,
+      const IsBetterFn& is_better_fn)
+  {
+    std::vector<CacheLinePadded<std::pair<int64_t, Value>>> chunk_bests(
+        NumChunks(begin, end, grain_size));
+    ParallelForChunks(
+        begin, end, grain_size,
+        [&] (const size_t chunk_index, const int64_t chunk_begin,
+             const int64_t chunk_end)
+    {
+      // Track the chunk's best locally and only store it once at the end
+      std::pair<int64_t, Value> chunk_best(-1, initial_value);
+      Value value = initial_value;
+      for (int64_t index = chunk_begin; index < chunk_end; index++)
+      {
+        if (candidate_fn(index, value)
+            && is_better_fn(value, chunk_best.second))
+        {
+          chunk_best.first = index;
+          chunk_best.second = value;
+        }
+      }
+      chunk_bests[chunk_index].value = chunk_best;
+    });
+    std::pair<int64_t, Value> best(-1, initial_value);
+    for (size_t chunk_index = 0; chunk_index < chunk_bests.size();
+         chunk_index++)
+    {
+      const std::pair<int64_t, Value>& chunk_best
+          = chunk_bests[chunk_index].value;
+      if ((chunk_best.first >= 0)
+          && is_better_fn(chunk_best.second, best.second))
+      {
+        best = chunk_best;
+      }
+    }
+    return best;
+  }
+
+  // Calls element_fn(index) for each index in [begin, end), in parallel
+  void ParallelFor(const int64_t begin, const int64_t end,
+                   const size_t grain_size,
+                   const std::function<void(const int64_t)>& element_fn)
+  {
+    ParallelForChunks(
+        begin, end, grain_size,
+        [&] (const size_t, const int64_t chunk_begin, const int64_t chunk_end)
+    {
+      for (int64_t index = chunk_begin; index < chunk_end; index++)
+      {
+        element_fn(index);
+      }
+    });
+  }
+};
+}  // namespace uncertainty_planning_core
@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -13,6 +17,7 @@
 #include <random>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
 #include <atomic>
 #include <common_robotics_utilities/color_builder.hpp>
 #include <common_robotics_utilities/math.hpp>
@@ -26,7 +31,11 @@
 #include <uncertainty_planning_core/simple_outcome_clustering_interface.hpp>
 #include <uncertainty_planning_core/uncertainty_planner_state.hpp>
 #include <uncertainty_planning_core/simple_simulator_interface.hpp>
+#include <uncertainty_planning_core/retry_probability_solver.hpp>
+#include <uncertainty_planning_core/simulation_result_cache.hpp>
+#include <uncertainty_planning_core/thread_pool.hpp>
 #include <uncertainty_planning_core/execution_policy.hpp>
+#include <uncertainty_planning_core/policy_learner.hpp>
 #include <ros/ros.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <common_robotics_utilities/conversions.hpp>
@@ -46,6 +55,7 @@ namespace uncertainty_planning_core
         typedef common_robotics_utilities::simple_robot_model_interface::SimpleRobotModelInterface<Configuration, ConfigAlloc> Robot;
         typedef UncertaintyPlannerState<Configuration, ConfigSerializer, ConfigAlloc> UncertaintyPlanningState;
         typedef ExecutionPolicy<Configuration, ConfigSerializer, ConfigAlloc> UncertaintyPlanningPolicy;
+        typedef AsyncPolicyLearner<Configuration, ConfigSerializer, ConfigAlloc> UncertaintyPlanningPolicyLearner;
         typedef common_robotics_utilities::simple_rrt_planner::SimpleRRTPlannerState<UncertaintyPlanningState> UncertaintyPlanningTreeState;
         typedef std::vector<UncertaintyPlanningTreeState> UncertaintyPlanningTree;
         typedef common_robotics_utilities::simple_graph::Graph<UncertaintyPlanningState> ExecutionPolicyGraph;
@@ -62,6 +72,8 @@ namespace uncertainty_planning_core
         typedef std::function<double(const UncertaintyPlanningState&)> GoalReachedProbabilityFn;
         typedef std::function<bool(const UncertaintyPlanningState&)> PlanningStateGoalCheckFn;
         typedef std::function<bool(const Configuration&)> ConfigGoalCheckFn;
+        typedef std::function<void(const UncertaintyPlanningPolicy&, const double)> PolicySnapshotFn;
+        typedef std::shared_ptr<const UncertaintyPlanningPolicy> PolicySnapshot;
 
         typedef std::function<std::vector<Configuration, ConfigAlloc>(const Configuration&, const Configuration&, const Configuration&, const bool, const bool)> ExecutionMovementFn;
 
@@ -88,67 +100,38 @@ namespace uncertainty_planning_core
         uint64_t goal_candidates_evaluated_;
         uint64_t goal_reaching_performed_;
         uint64_t goal_reaching_successful_;
+        size_t pipelined_propagation_chunk_size_;
+        size_t adaptive_particle_batch_size_;
+        size_t adaptive_particle_max_count_;
+        double adaptive_particle_interval_halfwidth_;
+        double adaptive_particle_confidence_z_;
+        SimulationResultCache<Configuration, ConfigAlloc> simulation_cache_;
+        ForwardSimulationTraceArena<Configuration, ConfigAlloc> reverse_check_trace_arena_;
+        std::shared_ptr<ThreadPool> thread_pool_;
         double total_goal_reached_probability_;
         double time_to_first_solution_;
+        // Index of the state that planning starts from (the tree root, or the root of a replanned subtree)
+        int64_t planning_root_index_;
         double elapsed_clustering_time_;
         double elapsed_simulation_time_;
         UncertaintyPlanningTree nearest_neighbors_storage_;
+        // Per-node cache of P(goal reached) for each outgoing transition, keyed by node index then transition id
+        std::unordered_map<int64_t, std::map<uint64_t, double>> transition_goal_probability_cache_;
+        // Transpositions in the tree, keyed by the index of the state they duplicate
+        std::unordered_map<int64_t, std::vector<int64_t>> transpositions_by_state_index_;
+        // Pruned copy of the planner tree, extended after each goal is reached, used to publish anytime policy snapshots
+        UncertaintyPlanningTree live_policy_tree_;
+        // Index of each planner tree state in the live policy tree, or -1 if the state has not been added to it
+        std::vector<int64_t> live_policy_tree_indices_;
+        bool anytime_policy_enabled_;
+        PolicySnapshotFn policy_snapshot_fn_;
+        // Latest policy snapshot and its P(goal reached), which can be read from other threads while planning
+        mutable std::mutex policy_snapshot_mutex_;
+        PolicySnapshot policy_snapshot_;
+        double published_policy_goal_reached_probability_;
+        bool background_policy_learning_enabled_;
         LoggingFn logging_fn_;
 
-        inline static size_t GetNumOMPThreads()
-        {
-            #if defined(_OPENMP)
-            size_t num_threads = 0;
-            #pragma omp parallel
-            {
-                num_threads = (size_t)omp_get_num_threads();
-            }
-            return num_threads;
-            #else
-            return 1;
-            #endif
-        }
-
-        /*
-         * Private helper function - needs well-formed inputs, so it isn't safe to expose to external code
-         */
-        inline static void ExtractChildStates(
-                const UncertaintyPlanningTree& raw_planner_tree,
-                const int64_t raw_parent_index,
-                const int64_t pruned_parent_index,
-                UncertaintyPlanningTree& pruned_planner_tree)
-        {
-            if (raw_planner_tree.at((size_t)raw_parent_index).IsInitialized() == false)
-            {
-                throw std::invalid_argument("raw_parent_state is uninitialized");
-            }
-            if (pruned_planner_tree.at((size_t)pruned_parent_index).IsInitialized() == false)
-            {
-                throw std::invalid_argument("pruned_parent_state is uninitialized");
-            }
-            // Clear the child indices, so we can update them with new values later
-            pruned_planner_tree[(size_t)pruned_parent_index].ClearChildIndicies();
-            const std::vector<int64_t>& current_child_indices = raw_planner_tree[(size_t)raw_parent_index].GetChildIndices();
-            for (size_t idx = 0; idx < current_child_indices.size(); idx++)
-            {
-                const int64_t raw_child_index = current_child_indices[idx];
-                const UncertaintyPlanningTreeState& current_child_state = raw_planner_tree.at((size_t)raw_child_index);
-                if (current_child_state.GetParentIndex() >= 0)
-                {
-                    // Get the new child index
-                    const int64_t pruned_child_index = (int64_t)pruned_planner_tree.size();
-                    // Add to the pruned tree
-                    pruned_planner_tree.push_back(current_child_state);
-                    // Update parent indices
-                    pruned_planner_tree[(size_t)pruned_child_index].SetParentIndex(pruned_parent_index);
-                    // Update the parent
-                    pruned_planner_tree[(size_t)pruned_parent_index].AddChildIndex(pruned_child_index);
-                    // Recursive call
-                    ExtractChildStates(raw_planner_tree, raw_child_index, pruned_child_index, pruned_planner_tree);
-                }
-            }
-        }
-
         void Log(const std::string& message, const int32_t level) const
         {
           logging_fn_(message, level);
@@ -187,11 +170,167 @@ namespace uncertainty_planning_core
             , sampler_ptr_(sampler_ptr)
             , simulator_ptr_(simulator_ptr)
             , clustering_ptr_(clustering_ptr)
+            , pipelined_propagation_chunk_size_(0)
+            , adaptive_particle_batch_size_(0)
+            , adaptive_particle_max_count_(0)
+            , adaptive_particle_interval_halfwidth_(0.0)
+            , adaptive_particle_confidence_z_(0.0)
+            , thread_pool_(ThreadPool::GetSharedPool())
+            , anytime_policy_enabled_(false)
+            , background_policy_learning_enabled_(false)
             , logging_fn_(logging_fn)
         {
             Reset();
         }
 
+        /*
+         * Enables pipelined forward propagation, where particles are simulated in chunks of the provided size,
+         * and each chunk is clustered (using the incremental clustering interface) while the next chunk is simulated.
+         * Only used if the clustering implementation supports incremental clustering (e.g. GridOutcomeClustering), and
+         * the simulator and the robot's distance function must support being called from two threads at once.
+         * Pass 0 to disable (default).
+         */
+        inline void SetPipelinedPropagationChunkSize(const size_t chunk_size)
+        {
+            pipelined_propagation_chunk_size_ = chunk_size;
+        }
+
+        inline size_t GetPipelinedPropagationChunkSize() const
+        {
+            return pipelined_propagation_chunk_size_;
+        }
+
+        /*
+         * Sets the number of threads (including the calling thread) used for this planner's parallel loops, e.g.
+         * nearest-neighbor queries. Pass 0 to use the library-wide shared thread pool (default).
+         */
+        inline void SetNumThreads(const size_t num_threads)
+        {
+            if (num_threads == 0)
+            {
+                thread_pool_ = ThreadPool::GetSharedPool();
+            }
+            else
+            {
+                thread_pool_ = std::make_shared<ThreadPool>(num_threads);
+            }
+        }
+
+        inline size_t GetNumThreads() const
+        {
+            return thread_pool_->NumThreads();
+        }
+
+        inline const std::shared_ptr<ThreadPool>& GetThreadPool() const
+        {
+            return thread_pool_;
+        }
+
+        /*
+         * Enables anytime planning, where the provided function is called with a policy snapshot and its P(goal reached)
+         * during planning, whenever P(goal reached) improves and is at least the goal probability threshold. Snapshots
+         * are extracted from a pruned copy of the planner tree that is extended after each goal is reached, rather than
+         * postprocessing and pruning the whole tree. The function is called from the planning thread, so it should be
+         * quick (copying the policy is cheap). Pass an empty function to disable (default).
+         */
+        inline void SetPolicySnapshotCallback(const PolicySnapshotFn& policy_snapshot_fn)
+        {
+            policy_snapshot_fn_ = policy_snapshot_fn;
+        }
+
+        /*
+         * Enables anytime planning without a callback. The latest policy snapshot (published under the same conditions
+         * as SetPolicySnapshotCallback) can then be retrieved with GetPolicySnapshot from any thread while PlanGoalState or
+         * PlanGoalSampling is running, so execution can begin as soon as a solution exists. In anytime mode, the final
+         * policy is also extracted from the live policy tree rather than from the whole planner tree.
+         */
+        inline void SetAnytimePolicyEnabled(const bool enabled)
+        {
+            anytime_policy_enabled_ = enabled;
+        }
+
+        inline bool IsAnytimePolicyEnabled() const
+        {
+            return (anytime_policy_enabled_ || static_cast<bool>(policy_snapshot_fn_));
+        }
+
+        /*
+         * Enables learning from policy execution outcomes on a background thread (see AsyncPolicyLearner), so that
+         * learning never blocks the execution loop. By default (disabled), each outcome is learned before the next
+         * action is queried.
+         *
+         * With background learning, the next action is chosen from the latest published snapshot, which may not yet
+         * include the outcomes just observed, so the chosen actions (and hence seeded simulations) depend on thread
+         * timing and are not reproducible. The clustering implementation is also called from the learner thread at
+         * the same time as from the execution thread, so it must be thread safe.
+         */
+        inline void SetBackgroundPolicyLearningEnabled(const bool enabled)
+        {
+            background_policy_learning_enabled_ = enabled;
+        }
+
+        inline bool IsBackgroundPolicyLearningEnabled() const
+        {
+            return background_policy_learning_enabled_;
+        }
+
+        /*
+         * Returns the latest policy snapshot and its P(goal reached), or a null snapshot if none has been published since
+         * planning started. Safe to call from any thread.
+         */
+        inline std::pair<PolicySnapshot, double> GetPolicySnapshot() const
+        {
+            std::lock_guard<std::mutex> lock(policy_snapshot_mutex_);
+            return std::make_pair(policy_snapshot_, published_policy_goal_reached_probability_);
+        }
+
+        /*
+         * Enables caching of forward propagations by (propagated state, target). A repeated expansion of the same state
+         * towards (nearly) the same target is skipped instead of simulated, since it would only add copies of the children
+         * of the earlier expansion (and their reverse edge checks) to the tree. Each skipped expansion is counted as a
+         * simulation cache hit. Targets within target_tolerance (configuration distance) of a cached target count as the
+         * same target. The cache holds at most max_cached_particles particles, evicting the least recently used results
+         * first. The adaptive and pipelined propagation modes bypass the cache.
+         * Pass max_cached_particles = 0 to disable (default).
+         */
+        inline void SetSimulationCacheBudget(
+                const size_t max_cached_particles,
+                const double target_tolerance)
+        {
+            simulation_cache_.Configure(max_cached_particles, target_tolerance);
+        }
+
+        /*
+         * Enables adaptive particle counts for forward propagation. Particles are simulated in batches that double the
+         * number simulated so far (starting with batch_size), and after each batch the particles are clustered and
+         * simulation stops once the Wilson score interval (with the provided z, e.g. 1.96 for 95% confidence) on the
+         * proportion of particles reaching every outcome cluster has a half-width of at most interval_halfwidth, or once
+         * max_particles have been simulated. Since the batches grow geometrically, the total clustering work is within a
+         * small constant factor of clustering the final particles once. If max_particles is more than the normal number
+         * of particles, the extra particles are resampled from the parent; if it is 0, the normal number of particles is
+         * the maximum.
+         * Pass batch_size = 0 to disable (default).
+         */
+        inline void SetAdaptiveParticleCount(
+                const size_t batch_size,
+                const size_t max_particles,
+                const double interval_halfwidth,
+                const double confidence_z=1.96)
+        {
+            if ((batch_size > 0u) && (interval_halfwidth <= 0.0))
+            {
+                throw std::invalid_argument("interval_halfwidth must be > 0");
+            }
+            if ((batch_size > 0u) && (confidence_z <= 0.0))
+            {
+                throw std::invalid_argument("confidence_z must be > 0");
+            }
+            adaptive_particle_batch_size_ = batch_size;
+            adaptive_particle_max_count_ = max_particles;
+            adaptive_particle_interval_halfwidth_ = interval_halfwidth;
+            adaptive_particle_confidence_z_ = confidence_z;
+        }
+
         inline void Reset()
         {
             state_counter_ = 0;
@@ -205,6 +344,11 @@ namespace uncertainty_planning_core
             goal_reaching_performed_ = 0;
             goal_reaching_successful_ = 0;
             nearest_neighbors_storage_.clear();
+            planning_root_index_ = 0;
+            transition_goal_probability_cache_.clear();
+            transpositions_by_state_index_.clear();
+            ResetLivePolicyTree();
+            simulation_cache_.Clear();
         }
 
         /*
@@ -313,41 +457,23 @@ namespace uncertainty_planning_core
                 const UncertaintyPlanningTree& planner_nodes,
                 const UncertaintyPlanningState& random_state,
                 const DistanceFn& state_distance_fn,
+                ThreadPool& thread_pool,
                 const LoggingFn& logging_fn)
         {
             // Get the nearest neighbor (ignoring the disabled states)
-            std::vector<std::pair<int64_t, double>> per_thread_bests(GetNumOMPThreads(), std::pair<int64_t, double>(-1, INFINITY));
-            #pragma omp parallel for
-            for (size_t idx = 0; idx < planner_nodes.size(); idx++)
+            const int64_t num_nodes = (int64_t)planner_nodes.size();
+            const std::pair<int64_t, double> nearest = thread_pool.ParallelArgBest(0, num_nodes, thread_pool.DefaultGrainSize(0, num_nodes), (double)INFINITY, [&] (const int64_t idx, double& state_distance)
             {
-                const UncertaintyPlanningTreeState& current_state = planner_nodes[idx];
+                const UncertaintyPlanningTreeState& current_state = planner_nodes[(size_t)idx];
                 // Only check against states enabled for NN checks
                 if (current_state.GetValueImmutable().UseForNearestNeighbors())
                 {
-                    const double state_distance = state_distance_fn(current_state.GetValueImmutable(), random_state);
-#if defined(_OPENMP)
-                    const size_t current_thread_id = (size_t)omp_get_thread_num();
-#else
-                    const size_t current_thread_id = 0;
-#endif
-                    if (state_distance < per_thread_bests[current_thread_id].second)
-                    {
-                        per_thread_bests[current_thread_id].first = (int64_t)idx;
-                        per_thread_bests[current_thread_id].second = state_distance;
-                    }
-                }
-            }
-            int64_t best_index = -1;
-            double best_distance = INFINITY;
-            for (size_t idx = 0; idx < per_thread_bests.size(); idx++)
-            {
-                const double& thread_minimum_distance = per_thread_bests[idx].second;
-                if (thread_minimum_distance < best_distance)
-                {
-                    best_index = per_thread_bests[idx].first;
-                    best_distance = thread_minimum_distance;
+                    state_distance = state_distance_fn(current_state.GetValueImmutable(), random_state);
+                    return true;
                 }
-            }
+                return false;
+            }, std::less<double>());
+            const int64_t best_index = nearest.first;
             logging_fn("Selected node " + std::to_string(best_index) + " as nearest neighbor (Qnear)", 3);
             return best_index;
         }
@@ -370,16 +496,84 @@ namespace uncertainty_planning_core
                 const double policy_marker_size,
                 const double p_goal_termination_threshold,
                 const DisplayFn& display_fn)
+        {
+            return PlanGoalSampling(UncertaintyPlanningTree(1, UncertaintyPlanningTreeState(start_state)),
+                                    goal_bias,
+                                    nearest_neighbor_fn,
+                                    forward_propagation_fn,
+                                    user_goal_check_fn,
+                                    time_limit,
+                                    edge_attempt_count,
+                                    policy_action_attempt_count,
+                                    allow_contacts,
+                                    include_spur_actions,
+                                    policy_marker_size,
+                                    p_goal_termination_threshold,
+                                    display_fn);
+        }
+
+        /*
+         * Warm-start version of PlanGoalSampling, which continues planning from the provided planner tree (e.g. loaded with
+         * LoadPlannerTree, or the raw tree of a loaded policy) rather than from a tree containing only the start state. The
+         * root of the tree is the start state. See SeedPlannerTree for how the tree is revalidated against the new goal.
+         */
+        inline std::pair<UncertaintyPlanningPolicy, Statistics> PlanGoalSampling(
+                const UncertaintyPlanningTree& warm_start_tree,
+                const double goal_bias,
+                const NearestNeighborFn& nearest_neighbor_fn,
+                const ForwardPropagationFn& forward_propagation_fn,
+                const GoalReachedProbabilityFn& user_goal_check_fn,
+                const std::chrono::duration<double>& time_limit,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count,
+                const bool allow_contacts,
+                const bool include_spur_actions,
+                const double policy_marker_size,
+                const double p_goal_termination_threshold,
+                const DisplayFn& display_fn)
         {
             // Bind the helper functions
             const auto start_time = std::chrono::high_resolution_clock::now();
+            // States seeded from a warm-start tree have already been checked against the goal
+            size_t num_checked_seed_states = 0;
             PlanningStateGoalCheckFn goal_reached_fn = [&] (const UncertaintyPlanningState& goal_candidate)
             {
+                if (nearest_neighbors_storage_.size() <= num_checked_seed_states)
+                {
+                    return false;
+                }
                 return GoalReachedGoalFunction(goal_candidate, user_goal_check_fn, edge_attempt_count, allow_contacts);
             };
+            // It "shouldn't" matter what the goal state actually is, since it's more of a virtual node to tie the policy graph together
+            // But it probably needs to be collision-free
+            auto valid_goal_sampling_fn = [&] ()
+            {
+                while (true)
+                {
+                    const Configuration goal_sample = sampler_ptr_->SampleGoal(simulator_ptr_->GetRandomGenerator());
+                    if (simulator_ptr_->CheckConfigCollision(robot_ptr_, goal_sample) == false)
+                    {
+                        return goal_sample;
+                    }
+                }
+            };
+            // The virtual goal is sampled once, either for the first policy snapshot or after planning has finished
+            std::vector<Configuration, ConfigAlloc> virtual_goal_storage;
+            auto virtual_goal_fn = [&] () -> const Configuration&
+            {
+                if (virtual_goal_storage.empty())
+                {
+                    virtual_goal_storage.push_back(valid_goal_sampling_fn());
+                }
+                return virtual_goal_storage.front();
+            };
             std::function<void(UncertaintyPlanningTree&, const int64_t)> goal_reached_callback = [&] (UncertaintyPlanningTree& tree, const int64_t new_goal_state_idx)
             {
-                return GoalReachedCallback(tree, new_goal_state_idx, edge_attempt_count, start_time);
+                GoalReachedCallback(tree, new_goal_state_idx, edge_attempt_count, include_spur_actions, start_time);
+                if (ShouldPublishPolicySnapshot())
+                {
+                    PublishPolicySnapshot(virtual_goal_fn(), edge_attempt_count, policy_action_attempt_count);
+                }
             };
             std::uniform_real_distribution<double> goal_bias_distribution(0.0, 1.0);
             std::function<UncertaintyPlanningState(void)> complete_sampling_fn = [&] (void)
@@ -402,9 +596,15 @@ namespace uncertainty_planning_core
             // Call the planner
             total_goal_reached_probability_ = 0.0;
             time_to_first_solution_ = 0.0;
+            planning_root_index_ = 0;
+            transition_goal_probability_cache_.clear();
+            transpositions_by_state_index_.clear();
+            ResetLivePolicyTree();
+            simulation_cache_.Clear();
+            simulation_cache_.ResetStatistics();
             simulator_ptr_->ResetStatistics();
             clustering_ptr_->ResetStatistics();
-            nearest_neighbors_storage_.emplace_back(UncertaintyPlanningTreeState(start_state));
+            num_checked_seed_states = SeedPlannerTree(warm_start_tree, [&] (const int64_t candidate_index) { return GoalReachedGoalFunction(candidate_index, user_goal_check_fn); }, goal_reached_callback);
             auto planning_results = common_robotics_utilities::simple_rrt_planner::RRTPlanMultiPath(
                         nearest_neighbors_storage_,
                         complete_sampling_fn,
@@ -414,23 +614,9 @@ namespace uncertainty_planning_core
                         goal_reached_fn,
                         goal_reached_callback,
                         termination_check_fn);
-            // It "shouldn't" matter what the goal state actually is, since it's more of a virtual node to tie the policy graph together
-            // But it probably needs to be collision-free
-            auto valid_goal_sampling_fn = [&] ()
-            {
-                while (true)
-                {
-                    const Configuration goal_sample = sampler_ptr_->SampleGoal(simulator_ptr_->GetRandomGenerator());
-                    if (simulator_ptr_->CheckConfigCollision(robot_ptr_, goal_sample) == false)
-                    {
-                        return goal_sample;
-                    }
-                }
-            };
-            const Configuration virtual_goal = valid_goal_sampling_fn();
             return ProcessPlanningResults(
                         planning_results,
-                        virtual_goal,
+                        virtual_goal_fn(),
                         edge_attempt_count,
                         policy_action_attempt_count,
                         include_spur_actions,
@@ -513,7 +699,7 @@ namespace uncertainty_planning_core
             {
                 return StateDistance(state1, state2);
             };
-            NearestNeighborFn nearest_neighbor_fn = [&] (const UncertaintyPlanningTree& tree, const UncertaintyPlanningState& new_state) { return GetNearestNeighbor(tree, new_state, state_distance_fn, logging_fn_); };
+            NearestNeighborFn nearest_neighbor_fn = [&] (const UncertaintyPlanningTree& tree, const UncertaintyPlanningState& new_state) { return GetNearestNeighbor(tree, new_state, state_distance_fn, *thread_pool_, logging_fn_); };
             UncertaintyPlanningState start_state(start);
             return PlanGoalSampling(start_state,
                                     goal_bias,
@@ -544,6 +730,136 @@ namespace uncertainty_planning_core
                 const double p_goal_termination_threshold,
                 const DisplayFn& display_fn)
         {
+            return PlanGoalState(UncertaintyPlanningTree(1, UncertaintyPlanningTreeState(UncertaintyPlanningState(start))),
+                                 goal,
+                                 goal_bias,
+                                 time_limit,
+                                 edge_attempt_count,
+                                 policy_action_attempt_count,
+                                 allow_contacts,
+                                 include_reverse_actions,
+                                 include_spur_actions,
+                                 policy_marker_size,
+                                 p_goal_termination_threshold,
+                                 display_fn);
+        }
+
+        /*
+         * Warm-start version of PlanGoalState, which continues planning from the provided planner tree (e.g. loaded with
+         * LoadPlannerTree, or the raw tree of a loaded policy) rather than from a tree containing only the start state. The
+         * root of the tree is the start state. See SeedPlannerTree for how the tree is revalidated against the new goal.
+         */
+        inline std::pair<UncertaintyPlanningPolicy, Statistics> PlanGoalState(
+                const UncertaintyPlanningTree& warm_start_tree,
+                const Configuration& goal,
+                const double goal_bias,
+                const std::chrono::duration<double>& time_limit,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count,
+                const bool allow_contacts,
+                const bool include_reverse_actions,
+                const bool include_spur_actions,
+                const double policy_marker_size,
+                const double p_goal_termination_threshold,
+                const DisplayFn& display_fn)
+        {
+            return PlanGoalStateFromTree(warm_start_tree,
+                                         0,
+                                         goal,
+                                         goal_bias,
+                                         time_limit,
+                                         edge_attempt_count,
+                                         policy_action_attempt_count,
+                                         allow_contacts,
+                                         include_reverse_actions,
+                                         include_spur_actions,
+                                         policy_marker_size,
+                                         p_goal_termination_threshold,
+                                         display_fn);
+        }
+
+        /*
+         * Replans from the current configuration when executing a policy has gone wrong, e.g. PerformSinglePolicyExecution
+         * ran out of steps, or QueryBestAction had to add many unexpected states. Rather than planning from scratch, a state
+         * for the current configuration is linked into the policy tree as a child of the best-matching policy state, and
+         * only the subtree below it is grown (see PlanGoalState for the parameters) until it reaches the goal with
+         * p_goal_termination_threshold or the time limit is reached. The rest of the policy tree is revalidated against the
+         * goal but never expanded, so the work is proportional to the local uncertainty rather than to the whole task.
+         * Returns the policy with the new subtree spliced in, or the provided policy if the subtree did not reach the goal.
+         */
+        inline std::pair<UncertaintyPlanningPolicy, Statistics> ReplanPolicyFromConfiguration(
+                const UncertaintyPlanningPolicy& policy,
+                const Configuration& current_config,
+                const Configuration& goal,
+                const double goal_bias,
+                const std::chrono::duration<double>& time_limit,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count,
+                const bool allow_contacts,
+                const bool include_reverse_actions,
+                const bool include_spur_actions,
+                const double policy_marker_size,
+                const double p_goal_termination_threshold,
+                const DisplayFn& display_fn)
+        {
+            if (policy.IsInitialized() == false)
+            {
+                throw std::invalid_argument("Cannot replan from an uninitialized policy");
+            }
+            UncertaintyPlanningTree replanning_tree = policy.GetRawPolicyTree();
+            const int64_t matched_state_index = FindBestMatchingStateInTree(replanning_tree, current_config);
+            const int64_t replanning_root_index = AddReplanningRootState(replanning_tree, matched_state_index, current_config);
+            Log("Replanning from current configuration, linked to policy state " + std::to_string(matched_state_index) + " of " + std::to_string(replanning_tree.size() - 1), 2);
+            std::pair<UncertaintyPlanningPolicy, Statistics> replanning_results = PlanGoalStateFromTree(replanning_tree,
+                                                                                                       replanning_root_index,
+                                                                                                       goal,
+                                                                                                       goal_bias,
+                                                                                                       time_limit,
+                                                                                                       edge_attempt_count,
+                                                                                                       policy_action_attempt_count,
+                                                                                                       allow_contacts,
+                                                                                                       include_reverse_actions,
+                                                                                                       include_spur_actions,
+                                                                                                       policy_marker_size,
+                                                                                                       p_goal_termination_threshold,
+                                                                                                       display_fn);
+            const bool replanning_succeeded = (total_goal_reached_probability_ >= goal_probability_threshold_);
+            replanning_results.second["Replanning matched policy state"] = (double)matched_state_index;
+            replanning_results.second["Replanning succeeded"] = (replanning_succeeded) ? 1.0 : 0.0;
+            if (!replanning_succeeded)
+            {
+                Log("Replanned subtree failed to reach the goal, keeping the original policy", 3);
+                replanning_results.first = policy;
+            }
+            return replanning_results;
+        }
+
+    protected:
+
+        /*
+         * Plans from the state at planning_root_index of the provided tree. Only that state and its descendants are
+         * expanded, and planning terminates based on that state's P(goal reached). See SeedPlannerTree.
+         */
+        inline std::pair<UncertaintyPlanningPolicy, Statistics> PlanGoalStateFromTree(
+                const UncertaintyPlanningTree& warm_start_tree,
+                const int64_t planning_root_index,
+                const Configuration& goal,
+                const double goal_bias,
+                const std::chrono::duration<double>& time_limit,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count,
+                const bool allow_contacts,
+                const bool include_reverse_actions,
+                const bool include_spur_actions,
+                const double policy_marker_size,
+                const double p_goal_termination_threshold,
+                const DisplayFn& display_fn)
+        {
+            if ((planning_root_index < 0) || (planning_root_index >= (int64_t)warm_start_tree.size()))
+            {
+                throw std::invalid_argument("planning_root_index is out of range of warm_start_tree");
+            }
+            const Configuration start = warm_start_tree[(size_t)planning_root_index].GetValueImmutable().GetExpectation();
             // Draw the simulation environment
             display_fn(MakeEraseMarkers());
             display_fn(MakeEnvironmentDisplayRep());
@@ -568,7 +884,6 @@ namespace uncertainty_planning_core
                 std::cout << "Press ENTER to start planning..." << std::endl;
                 std::cin.get();
             }
-            UncertaintyPlanningState start_state(start);
             UncertaintyPlanningState goal_state(goal);
             // Bind the helper functions
             const std::chrono::time_point<std::chrono::high_resolution_clock> start_time = std::chrono::high_resolution_clock::now();
@@ -576,9 +891,25 @@ namespace uncertainty_planning_core
             {
                 return StateDistance(state1, state2);
             };
-            NearestNeighborFn nearest_neighbor_fn = [&] (const UncertaintyPlanningTree& tree, const UncertaintyPlanningState& new_state) { return GetNearestNeighbor(tree, new_state, state_distance_fn, logging_fn_); };
-            std::function<bool(const UncertaintyPlanningState&)> goal_reached_fn = [&] (const UncertaintyPlanningState& goal_candidate) { return GoalReachedGoalState(goal_candidate, goal_state, edge_attempt_count, allow_contacts); };
-            std::function<void(UncertaintyPlanningTree&, const int64_t)> goal_reached_callback = [&] (UncertaintyPlanningTree& tree, const int64_t new_goal_state_idx) { return GoalReachedCallback(tree, new_goal_state_idx, edge_attempt_count, start_time); };
+            NearestNeighborFn nearest_neighbor_fn = [&] (const UncertaintyPlanningTree& tree, const UncertaintyPlanningState& new_state) { return GetNearestNeighbor(tree, new_state, state_distance_fn, *thread_pool_, logging_fn_); };
+            // States seeded from a warm-start tree have already been checked against the goal
+            size_t num_checked_seed_states = 0;
+            std::function<bool(const UncertaintyPlanningState&)> goal_reached_fn = [&] (const UncertaintyPlanningState& goal_candidate)
+            {
+                if (nearest_neighbors_storage_.size() <= num_checked_seed_states)
+                {
+                    return false;
+                }
+                return GoalReachedGoalState(goal_candidate, goal_state, edge_attempt_count, allow_contacts);
+            };
+            std::function<void(UncertaintyPlanningTree&, const int64_t)> goal_reached_callback = [&] (UncertaintyPlanningTree& tree, const int64_t new_goal_state_idx)
+            {
+                GoalReachedCallback(tree, new_goal_state_idx, edge_attempt_count, include_spur_actions, start_time);
+                if (ShouldPublishPolicySnapshot())
+                {
+                    PublishPolicySnapshot(goal, edge_attempt_count, policy_action_attempt_count);
+                }
+            };
             std::uniform_real_distribution<double> goal_bias_distribution(0.0, 1.0);
             std::function<UncertaintyPlanningState(void)> complete_sampling_fn = [&](void)
             {
@@ -596,17 +927,156 @@ namespace uncertainty_planning_core
             ForwardPropagationFn forward_propagation_fn = [&] (const UncertaintyPlanningState& nearest, const UncertaintyPlanningState& target) { return PropagateForwardsAndDraw(nearest, target, edge_attempt_count, allow_contacts, include_reverse_actions, display_fn); };
             std::function<bool(const int64_t)> termination_check_fn = [&] (const int64_t) { return PlannerTerminationCheck(start_time, time_limit, p_goal_termination_threshold); };
             // Call the planner
-            // Call the planner
             total_goal_reached_probability_ = 0.0;
             time_to_first_solution_ = 0.0;
+            planning_root_index_ = planning_root_index;
+            transition_goal_probability_cache_.clear();
+            transpositions_by_state_index_.clear();
+            ResetLivePolicyTree();
+            simulation_cache_.Clear();
+            simulation_cache_.ResetStatistics();
             simulator_ptr_->ResetStatistics();
             clustering_ptr_->ResetStatistics();
-            nearest_neighbors_storage_.emplace_back(UncertaintyPlanningTreeState(start_state));
+            num_checked_seed_states = SeedPlannerTree(warm_start_tree, [&] (const int64_t candidate_index) { return GoalReachedGoalState(candidate_index, goal_state); }, goal_reached_callback);
             auto planning_results = common_robotics_utilities::simple_rrt_planner::RRTPlanMultiPath(nearest_neighbors_storage_, complete_sampling_fn, nearest_neighbor_fn, forward_propagation_fn, {}, goal_reached_fn, goal_reached_callback, termination_check_fn);
             return ProcessPlanningResults(planning_results, goal, edge_attempt_count, policy_action_attempt_count, include_spur_actions, policy_marker_size, display_fn);
         }
 
-    protected:
+        /*
+         * Finds the policy tree state that best matches the provided configuration, using the same distance as nearest
+         * neighbors. Transpositions are never matched, since they must remain leaves.
+         */
+        inline int64_t FindBestMatchingStateInTree(
+                const UncertaintyPlanningTree& planner_tree,
+                const Configuration& config) const
+        {
+            const UncertaintyPlanningState config_state(config);
+            const int64_t num_states = (int64_t)planner_tree.size();
+            const std::pair<int64_t, double> best_match = thread_pool_->ParallelArgBest(0, num_states, thread_pool_->DefaultGrainSize(0, num_states), (double)INFINITY, [&] (const int64_t idx, double& state_distance)
+            {
+                const UncertaintyPlanningState& candidate_state = planner_tree[(size_t)idx].GetValueImmutable();
+                if (candidate_state.IsTransposition())
+                {
+                    return false;
+                }
+                state_distance = StateDistance(candidate_state, config_state);
+                return true;
+            }, std::less<double>());
+            if (best_match.first < 0)
+            {
+                throw std::runtime_error("Failed to find a policy state matching the current configuration");
+            }
+            return best_match.first;
+        }
+
+        /*
+         * Adds a state for the provided configuration to the tree as a child of the matched state, with a new transition of
+         * its own, so that it doesn't change any of the matched state's existing transitions. Since we know we're there,
+         * the transition is treated as certain and reversible (like the priors for unexpected states added during policy
+         * execution), and the new state's P(motion feasibility) is 1. Returns the index of the new state.
+         */
+        inline int64_t AddReplanningRootState(
+                UncertaintyPlanningTree& planner_tree,
+                const int64_t matched_state_index,
+                const Configuration& config)
+        {
+            UpdateIdCountersFromTree(planner_tree);
+            const UncertaintyPlanningState& matched_state = planner_tree[(size_t)matched_state_index].GetValueImmutable();
+            state_counter_++;
+            const uint64_t forward_transition_id = ++transition_id_;
+            const uint64_t reverse_transition_id = ++transition_id_;
+            UncertaintyPlanningState replanning_root_state(state_counter_, config, 1u, 1u, 1.0, 1u, 1u, 1.0, matched_state.GetStepSize(), config, forward_transition_id, reverse_transition_id, 0u, true);
+            replanning_root_state.UpdateStatistics(robot_ptr_);
+            replanning_root_state.SetClusterDescriptor(clustering_ptr_->ComputeClusterDescriptor(robot_ptr_, replanning_root_state.GetParticlePositionsImmutable().Value()));
+            const int64_t replanning_root_index = (int64_t)planner_tree.size();
+            planner_tree.emplace_back(UncertaintyPlanningTreeState(replanning_root_state, matched_state_index));
+            planner_tree[(size_t)matched_state_index].AddChildIndex(replanning_root_index);
+            return replanning_root_index;
+        }
+
+        /*
+         * Moves the state, transition, and split id counters past the largest ids in the tree. Ids of states added at
+         * runtime by ExecutionPolicy (>= 1000000000) are ignored, so new states are still recognized as planned states.
+         */
+        inline void UpdateIdCountersFromTree(const UncertaintyPlanningTree& planner_tree)
+        {
+            const uint64_t runtime_id_start = UINT64_C(1000000000);
+            auto planned_id = [&] (const uint64_t id) { return (id < runtime_id_start) ? id : UINT64_C(0); };
+            for (size_t idx = 0; idx < planner_tree.size(); idx++)
+            {
+                const UncertaintyPlanningState& current_state = planner_tree[idx].GetValueImmutable();
+                state_counter_ = std::max(state_counter_, planned_id(current_state.GetStateId()));
+                transition_id_ = std::max(transition_id_, std::max(planned_id(current_state.GetTransitionId()), planned_id(current_state.GetReverseTransitionId())));
+                split_id_ = std::max(split_id_, planned_id(current_state.GetSplitId()));
+            }
+        }
+
+        /*
+         * Seeds the planner tree for PlanGoalState/PlanGoalSampling. A tree containing only the start state is added as-is,
+         * and its goal check is left to the planner. Otherwise, the planner tree is replaced with the warm-start tree, which
+         * is revalidated against the current goal:
+         * 1) State, transition, and split ids of new states continue from the largest ids in the tree, so they can't collide
+         * 2) Every state's P(goal reached) is cleared, and every state from the planning root onwards (the whole tree, unless
+         *    replanning) except transpositions is re-enabled for nearest neighbors, so it can be expanded again
+         * 3) Leaf states are checked against the new goal in parent-before-child order, and the goal reached callback is
+         *    called for those that reach it, which rebuilds the goal branches, blacklists them, and registers transpositions
+         * Returns the number of seeded states that have already been checked against the goal.
+         */
+        inline size_t SeedPlannerTree(
+                const UncertaintyPlanningTree& warm_start_tree,
+                const std::function<bool(const int64_t)>& seed_state_goal_check_fn,
+                const std::function<void(UncertaintyPlanningTree&, const int64_t)>& goal_reached_callback)
+        {
+            if (warm_start_tree.empty())
+            {
+                throw std::invalid_argument("warm_start_tree cannot be empty");
+            }
+            if (warm_start_tree.size() == 1)
+            {
+                nearest_neighbors_storage_.emplace_back(warm_start_tree[0].GetValueImmutable());
+                return 0;
+            }
+            if (common_robotics_utilities::simple_rrt_planner::CheckTreeLinkage(warm_start_tree) == false)
+            {
+                throw std::invalid_argument("warm_start_tree has invalid linkage");
+            }
+            Log("Warm-starting planner with " + std::to_string(warm_start_tree.size()) + " states", 1);
+            nearest_neighbors_storage_ = warm_start_tree;
+            UpdateIdCountersFromTree(nearest_neighbors_storage_);
+            for (size_t idx = 0; idx < nearest_neighbors_storage_.size(); idx++)
+            {
+                UncertaintyPlanningTreeState& current_tree_state = nearest_neighbors_storage_[idx];
+                if ((idx > 0) && ((current_tree_state.GetParentIndex() < 0) || (current_tree_state.GetParentIndex() >= (int64_t)idx)))
+                {
+                    throw std::invalid_argument("warm_start_tree is not ordered parent-before-child");
+                }
+                UncertaintyPlanningState& current_state = current_tree_state.GetValueMutable();
+                current_state.SetGoalPfeasibility(0.0);
+                if (current_state.IsTransposition() || ((int64_t)idx < planning_root_index_))
+                {
+                    current_state.DisableForNearestNeighbors();
+                }
+                else
+                {
+                    current_state.EnableForNearestNeighbors();
+                }
+            }
+            int64_t num_seeded_goal_states = 0;
+            for (int64_t sdx = 0; sdx < (int64_t)nearest_neighbors_storage_.size(); sdx++)
+            {
+                if (nearest_neighbors_storage_[(size_t)sdx].GetChildIndices().size() > 0)
+                {
+                    continue;
+                }
+                if (seed_state_goal_check_fn(sdx))
+                {
+                    goal_reached_callback(nearest_neighbors_storage_, sdx);
+                    num_seeded_goal_states++;
+                }
+            }
+            Log("Warm-start tree has " + std::to_string(num_seeded_goal_states) + " states that reach the goal, with goal reached probability " + std::to_string(total_goal_reached_probability_), 1);
+            return nearest_neighbors_storage_.size();
+        }
 
         inline std::pair<UncertaintyPlanningPolicy, Statistics> ProcessPlanningResults(
                 const std::pair<std::vector<std::vector<UncertaintyPlanningState>>, Statistics>& planning_results,
@@ -626,6 +1096,11 @@ namespace uncertainty_planning_core
             planning_statistics.insert(simulator_resolve_statistics.begin(), simulator_resolve_statistics.end());
             const Statistics outcome_clustering_statistics = clustering_ptr_->GetStatistics();
             planning_statistics.insert(outcome_clustering_statistics.begin(), outcome_clustering_statistics.end());
+            if (simulation_cache_.IsEnabled())
+            {
+                const Statistics simulation_cache_statistics = simulation_cache_.GetStatistics();
+                planning_statistics.insert(simulation_cache_statistics.begin(), simulation_cache_statistics.end());
+            }
             planning_statistics["elapsed_clustering_time"] = elapsed_clustering_time_;
             planning_statistics["elapsed_simulation_time"] = elapsed_simulation_time_;
             planning_statistics["Particles stored"] = (double)particles_stored_;
@@ -635,10 +1110,7 @@ namespace uncertainty_planning_core
             planning_statistics["Goal reaching successful"] = (double)goal_reaching_successful_;
             if (total_goal_reached_probability_ >= goal_probability_threshold_)
             {
-                const UncertaintyPlanningTree postprocessed_tree = PostProcessTree(nearest_neighbors_storage_);
-                const UncertaintyPlanningTree pruned_tree = PruneTree(postprocessed_tree, include_spur_actions);
-                // Not sure hwat to do here with goal states
-                const UncertaintyPlanningPolicy policy = ExtractPolicy(pruned_tree, virtual_goal_config, edge_attempt_count, policy_action_attempt_count);
+                const UncertaintyPlanningPolicy policy = ExtractFinalPolicy(virtual_goal_config, edge_attempt_count, policy_action_attempt_count, include_spur_actions);
                 planning_statistics["Extracted policy size"] = (double)policy.GetRawPolicy().GetNodesImmutable().size();
                 if (debug_level_ >= 2)
                 {
@@ -709,22 +1181,34 @@ namespace uncertainty_planning_core
          */
         inline UncertaintyPlanningTree PostProcessTree(
                 const UncertaintyPlanningTree& planner_tree) const
+        {
+            // We don't want to mess with the original tree, so we copy it
+            UncertaintyPlanningTree postprocessed_planner_tree = planner_tree;
+            PostProcessTreeInPlace(postprocessed_planner_tree);
+            return postprocessed_planner_tree;
+        }
+
+        inline void PostProcessTreeInPlace(
+                UncertaintyPlanningTree& planner_tree) const
         {
             Log("Postprocessing planner tree in preparation for policy extraction...", 1);
             std::chrono::time_point<std::chrono::high_resolution_clock> start_time = std::chrono::high_resolution_clock::now();
-            // Let's do some post-processing to the planner tree - we don't want to mess with the original tree, so we copy it
-            UncertaintyPlanningTree postprocessed_planner_tree = planner_tree;
             // We have already computed reversibility for all edges, however, we now need to update the P(goal reached) for reversible children
-            // We start with a naive implementation of this - this works because given the process that the tree is generated, children *MUST* have higher indices than their parents, so we can depend on the parents
-            // having been updated first by the time we get to an index. To make this parallelizable, we'll need to switch to an explicitly branch-based approach
+            // The update for a state only reads the P(goal reached) of its parent and siblings, and only when they are > 0 (i.e. on a goal branch). Since the update only ever writes
+            // P(goal reached) <= 0 to states that were not on a goal branch, no update can change the inputs of another, and the result does not depend on the order states are processed in.
+            // This lets us compute all updates in parallel against the unmodified tree, then apply them in parallel, without depending on parents having lower indices than their children.
+            const int64_t num_states = (int64_t)planner_tree.size();
+            std::vector<uint8_t> state_needs_update(planner_tree.size(), 0x00);
+            std::vector<double> updated_goal_probabilities(planner_tree.size(), 0.0);
             // Go through each state in the tree - we skip the initial state, since it has no transition
-            for (size_t sdx = 1; sdx < postprocessed_planner_tree.size(); sdx++)
+            #pragma omp parallel for
+            for (int64_t sdx = 1; sdx < num_states; sdx++)
             {
                 // Get the current state
-                UncertaintyPlanningTreeState& current_state = postprocessed_planner_tree[sdx];
+                const UncertaintyPlanningTreeState& current_state = planner_tree[(size_t)sdx];
                 const int64_t parent_index = current_state.GetParentIndex();
                 // Get the parent state
-                const UncertaintyPlanningTreeState& parent_state = postprocessed_planner_tree[(size_t)parent_index];
+                const UncertaintyPlanningTreeState& parent_state = planner_tree[(size_t)parent_index];
                 // If the current state is on a goal branch
                 if (current_state.GetValueImmutable().GetGoalPfeasibility() > 0.0)
                 {
@@ -742,7 +1226,7 @@ namespace uncertainty_planning_core
                     for (size_t idx = 0; idx < other_children.size(); idx++)
                     {
                         const int64_t other_child_index = other_children[idx];
-                        const UncertaintyPlanningTreeState& other_child_state = postprocessed_planner_tree[(size_t)other_child_index];
+                        const UncertaintyPlanningTreeState& other_child_state = planner_tree[(size_t)other_child_index];
                         const uint64_t other_child_transition_id = other_child_state.GetValueImmutable().GetTransitionId();
                         const uint64_t other_child_state_id = other_child_state.GetValueImmutable().GetStateId();
                         // If it's a child of the same split that produced us
@@ -761,23 +1245,42 @@ namespace uncertainty_planning_core
                         // Update P(goal reached) based on our ability to reverse to the goal branch
                         const double parent_pgoalreached = parent_state.GetValueImmutable().GetGoalPfeasibility();
                         const double new_pgoalreached = -(parent_pgoalreached * current_state.GetValueImmutable().GetReverseEdgePfeasibility()); // We use negative goal reached probabilities to signal probability due to reversing
-                        current_state.GetValueMutable().SetGoalPfeasibility(new_pgoalreached);
+                        state_needs_update[(size_t)sdx] = 0x01;
+                        updated_goal_probabilities[(size_t)sdx] = new_pgoalreached;
                     }
                 }
             }
+            // Apply the updates - each state only writes to itself
+            #pragma omp parallel for
+            for (int64_t sdx = 1; sdx < num_states; sdx++)
+            {
+                if (state_needs_update[(size_t)sdx] != 0x00)
+                {
+                    planner_tree[(size_t)sdx].GetValueMutable().SetGoalPfeasibility(updated_goal_probabilities[(size_t)sdx]);
+                }
+            }
             std::chrono::time_point<std::chrono::high_resolution_clock> end_time = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> postprocessing_time(end_time - start_time);
             Log("...postprocessing complete, took " + std::to_string(postprocessing_time.count()) + " seconds", 1);
-            return postprocessed_planner_tree;
         }
 
         inline UncertaintyPlanningTree PruneTree(
                 const UncertaintyPlanningTree& planner_tree,
                 const bool include_spur_actions) const
+        {
+            // We don't want to mess with the original tree, so we copy it
+            UncertaintyPlanningTree pruned_planner_tree = planner_tree;
+            PruneTreeInPlace(pruned_planner_tree, include_spur_actions);
+            return pruned_planner_tree;
+        }
+
+        inline void PruneTreeInPlace(
+                UncertaintyPlanningTree& planner_tree,
+                const bool include_spur_actions) const
         {
             if (planner_tree.size() <= 1)
             {
-                return planner_tree;
+                return;
             }
             // Test to make sure the tree linkage is intact
             if (common_robotics_utilities::simple_rrt_planner::CheckTreeLinkage(planner_tree) == false)
@@ -786,63 +1289,98 @@ namespace uncertainty_planning_core
             }
             Log("Pruning planner tree in preparation for policy extraction...", 1);
             std::chrono::time_point<std::chrono::high_resolution_clock> start_time = std::chrono::high_resolution_clock::now();
-            // Let's do some post-processing to the planner tree - we don't want to mess with the original tree, so we copy it
-            UncertaintyPlanningTree intermediate_planner_tree = planner_tree;
-            // Loop through the tree and prune unproductive nodes+edges
-            for (size_t idx = 0; idx < intermediate_planner_tree.size(); idx++)
-            {
-                UncertaintyPlanningTreeState& current_state = intermediate_planner_tree[idx];
+            const int64_t num_states = (int64_t)planner_tree.size();
+            // Mark productive nodes+edges - this only looks at each state on its own, so it can be done in parallel
+            std::vector<uint8_t> state_is_productive(planner_tree.size(), 0x00);
+            bool all_states_initialized = true;
+            #pragma omp parallel for reduction(&&:all_states_initialized)
+            for (int64_t sdx = 0; sdx < num_states; sdx++)
+            {
+                const UncertaintyPlanningTreeState& current_state = planner_tree[(size_t)sdx];
                 if (current_state.IsInitialized() == false)
                 {
-                    throw std::runtime_error("current_state is uninitialized");
+                    all_states_initialized = false;
+                    continue;
                 }
+                const double goal_probability = current_state.GetValueImmutable().GetGoalPfeasibility();
                 // If we're on a path to the goal, we always keep it
-                if (current_state.GetValueImmutable().GetGoalPfeasibility() > 0.0)
+                if (goal_probability > 0.0)
                 {
-                    continue;
+                    state_is_productive[(size_t)sdx] = 0x01;
                 }
-                // If the current node can reverse to reach the goal
-                else if (current_state.GetValueImmutable().GetGoalPfeasibility() < -0.0)
+                // If the current node can reverse to reach the goal, we keep it only if we allow spur nodes
+                else if (goal_probability < -0.0)
                 {
-                    // If we allow spur nodes, we keep it
-                    if (include_spur_actions)
-                    {
-                        continue;
-                    }
-                    // If not, prune the node
-                    else
-                    {
-                        current_state.SetParentIndex(-1);
-                        current_state.ClearChildIndicies();
-                    }
+                    state_is_productive[(size_t)sdx] = (include_spur_actions) ? 0x01 : 0x00;
                 }
                 // We always prune nodes that can't reach the goal
-                else
+            }
+            if (all_states_initialized == false)
+            {
+                throw std::runtime_error("current_state is uninitialized");
+            }
+            // Compute which states are kept and where they move to in a single sweep - a state is kept if it is productive and its parent is kept.
+            // Given the process that the tree is generated, children *MUST* have higher indices than their parents, so the parent is always decided first.
+            // The root state is always kept.
+            std::vector<int64_t> pruned_indices(planner_tree.size(), -1);
+            pruned_indices[0] = 0;
+            int64_t num_pruned_states = 1;
+            for (int64_t sdx = 1; sdx < num_states; sdx++)
+            {
+                const int64_t parent_index = planner_tree[(size_t)sdx].GetParentIndex();
+                if ((parent_index < 0) || (parent_index >= sdx))
+                {
+                    throw std::runtime_error("planner_tree is not ordered parent-before-child");
+                }
+                if ((state_is_productive[(size_t)sdx] != 0x00) && (pruned_indices[(size_t)parent_index] >= 0))
+                {
+                    pruned_indices[(size_t)sdx] = num_pruned_states;
+                    num_pruned_states++;
+                }
+            }
+            // Compact the kept states in place - since states only ever move to lower indices, moving in order never overwrites a state we still need
+            for (int64_t sdx = 1; sdx < num_states; sdx++)
+            {
+                const int64_t pruned_index = pruned_indices[(size_t)sdx];
+                if ((pruned_index >= 0) && (pruned_index != sdx))
                 {
-                    current_state.SetParentIndex(-1);
-                    current_state.ClearChildIndicies();
+                    planner_tree[(size_t)pruned_index] = std::move(planner_tree[(size_t)sdx]);
                 }
             }
-            // Now, extract the pruned tree
-            UncertaintyPlanningTree pruned_planner_tree;
-            // Add root state
-            UncertaintyPlanningTreeState root_state = intermediate_planner_tree[0];
-            if (root_state.IsInitialized() == false)
+            planner_tree.erase(planner_tree.begin() + num_pruned_states, planner_tree.end());
+            // Update the parent and child indices - each state only touches itself, so this can be done in parallel
+            #pragma omp parallel for
+            for (int64_t sdx = 0; sdx < num_pruned_states; sdx++)
             {
-                throw std::runtime_error("root_state is uninitialized");
+                UncertaintyPlanningTreeState& current_state = planner_tree[(size_t)sdx];
+                const int64_t parent_index = current_state.GetParentIndex();
+                if (parent_index >= 0)
+                {
+                    current_state.SetParentIndex(pruned_indices[(size_t)parent_index]);
+                }
+                const std::vector<int64_t> raw_child_indices = current_state.GetChildIndices();
+                current_state.ClearChildIndicies();
+                for (size_t idx = 0; idx < raw_child_indices.size(); idx++)
+                {
+                    const int64_t pruned_child_index = pruned_indices[(size_t)raw_child_indices[idx]];
+                    if (pruned_child_index >= 0)
+                    {
+                        current_state.AddChildIndex(pruned_child_index);
+                    }
+                }
+                if (current_state.GetValueImmutable().IsTransposition())
+                {
+                    current_state.GetValueMutable().SetTranspositionIndex(pruned_indices[(size_t)current_state.GetValueImmutable().GetTranspositionIndex()]);
+                }
             }
-            pruned_planner_tree.push_back(root_state);
-            // Recursive call to extract live branches
-            ExtractChildStates(intermediate_planner_tree, 0, 0, pruned_planner_tree);
             // Test to make sure the tree linkage is intact
-            if (common_robotics_utilities::simple_rrt_planner::CheckTreeLinkage(pruned_planner_tree) == false)
+            if (common_robotics_utilities::simple_rrt_planner::CheckTreeLinkage(planner_tree) == false)
             {
                 throw std::runtime_error("pruned_planner_tree has invalid linkage");
             }
             std::chrono::time_point<std::chrono::high_resolution_clock> end_time = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> pruning_time(end_time - start_time);
-            Log("...pruning complete, pruned to " + std::to_string(pruned_planner_tree.size()) + " states, took " + std::to_string(pruning_time.count()) + " seconds", 1);
-            return pruned_planner_tree;
+            Log("...pruning complete, pruned to " + std::to_string(planner_tree.size()) + " states, took " + std::to_string(pruning_time.count()) + " seconds", 1);
         }
 
         /*
@@ -859,6 +1397,217 @@ namespace uncertainty_planning_core
             return policy;
         }
 
+        /*
+         * Anytime policy functions
+         *
+         * The live policy tree holds the same states as PostProcessTree + PruneTree would produce from the planner tree,
+         * but it is extended after each goal is reached using only the states whose P(goal reached) changed, and states
+         * are ordered by when they were added (still parent-before-child) rather than by their planner tree index.
+         * This relies on P(goal reached) of planner tree states never decreasing, so states are never removed.
+         */
+        inline void ResetLivePolicyTree()
+        {
+            live_policy_tree_.clear();
+            live_policy_tree_indices_.clear();
+            std::lock_guard<std::mutex> lock(policy_snapshot_mutex_);
+            policy_snapshot_.reset();
+            published_policy_goal_reached_probability_ = 0.0;
+        }
+
+        inline int64_t GetLivePolicyTreeIndex(const int64_t state_index) const
+        {
+            return live_policy_tree_indices_[(size_t)state_index];
+        }
+
+        inline int64_t AddToLivePolicyTree(
+                const int64_t state_index,
+                const double goal_probability)
+        {
+            const UncertaintyPlanningTreeState& planner_tree_state = nearest_neighbors_storage_[(size_t)state_index];
+            const int64_t live_parent_index = (state_index > 0) ? GetLivePolicyTreeIndex(planner_tree_state.GetParentIndex()) : -1;
+            const int64_t live_index = (int64_t)live_policy_tree_.size();
+            live_policy_tree_.emplace_back(UncertaintyPlanningTreeState(planner_tree_state.GetValueImmutable(), live_parent_index));
+            UncertaintyPlanningState& live_state = live_policy_tree_.back().GetValueMutable();
+            live_state.SetGoalPfeasibility(goal_probability);
+            if (live_state.IsTransposition())
+            {
+                live_state.SetTranspositionIndex(GetLivePolicyTreeIndex(live_state.GetTranspositionIndex()));
+            }
+            if (live_parent_index >= 0)
+            {
+                live_policy_tree_[(size_t)live_parent_index].AddChildIndex(live_index);
+            }
+            live_policy_tree_indices_[(size_t)state_index] = live_index;
+            return live_index;
+        }
+
+        inline bool CanAddToLivePolicyTree(const int64_t state_index) const
+        {
+            // Transpositions must be linked to a state already in the live policy tree
+            const UncertaintyPlanningState& state = nearest_neighbors_storage_[(size_t)state_index].GetValueImmutable();
+            return (!state.IsTransposition() || (GetLivePolicyTreeIndex(state.GetTranspositionIndex()) >= 0));
+        }
+
+        inline void AddGoalBranchToLivePolicyTree(const int64_t state_index)
+        {
+            // Collect the states between the provided state and the nearest ancestor already in the live policy tree
+            std::vector<int64_t> branch_state_indices;
+            int64_t current_index = state_index;
+            while (GetLivePolicyTreeIndex(current_index) < 0)
+            {
+                // Like PruneTree, a branch is only kept if every state on it reaches the goal
+                if ((nearest_neighbors_storage_[(size_t)current_index].GetValueImmutable().GetGoalPfeasibility() <= 0.0) || !CanAddToLivePolicyTree(current_index))
+                {
+                    return;
+                }
+                branch_state_indices.push_back(current_index);
+                current_index = nearest_neighbors_storage_[(size_t)current_index].GetParentIndex();
+            }
+            // Add them parent-first
+            for (auto itr = branch_state_indices.rbegin(); itr != branch_state_indices.rend(); ++itr)
+            {
+                AddToLivePolicyTree(*itr, nearest_neighbors_storage_[(size_t)*itr].GetValueImmutable().GetGoalPfeasibility());
+            }
+        }
+
+        inline void UpdateLivePolicySpurChildren(const int64_t parent_index)
+        {
+            // This matches the P(goal reached) assigned to reversible children by PostProcessTree
+            const UncertaintyPlanningTreeState& parent_state = nearest_neighbors_storage_[(size_t)parent_index];
+            const double parent_pgoalreached = parent_state.GetValueImmutable().GetGoalPfeasibility();
+            if ((parent_pgoalreached <= 0.0) || (GetLivePolicyTreeIndex(parent_index) < 0))
+            {
+                return;
+            }
+            const std::vector<int64_t>& child_indices = parent_state.GetChildIndices();
+            for (size_t idx = 0; idx < child_indices.size(); idx++)
+            {
+                const int64_t child_index = child_indices[idx];
+                const UncertaintyPlanningState& child_state = nearest_neighbors_storage_[(size_t)child_index].GetValueImmutable();
+                if (child_state.GetGoalPfeasibility() > 0.0)
+                {
+                    continue;
+                }
+                // Make sure we're a child of a split where at least one child reaches the goal
+                bool result_of_goal_reaching_split = false;
+                for (size_t odx = 0; odx < child_indices.size(); odx++)
+                {
+                    const UncertaintyPlanningState& other_child_state = nearest_neighbors_storage_[(size_t)child_indices[odx]].GetValueImmutable();
+                    if ((child_state.GetStateId() != other_child_state.GetStateId()) && (child_state.GetTransitionId() == other_child_state.GetTransitionId()) && (other_child_state.GetGoalPfeasibility() > 0.0))
+                    {
+                        result_of_goal_reaching_split = true;
+                        break;
+                    }
+                }
+                if (!result_of_goal_reaching_split)
+                {
+                    continue;
+                }
+                const double new_pgoalreached = -(parent_pgoalreached * child_state.GetReverseEdgePfeasibility());
+                const int64_t live_child_index = GetLivePolicyTreeIndex(child_index);
+                if (live_child_index >= 0)
+                {
+                    live_policy_tree_[(size_t)live_child_index].GetValueMutable().SetGoalPfeasibility(new_pgoalreached);
+                }
+                else if (CanAddToLivePolicyTree(child_index))
+                {
+                    AddToLivePolicyTree(child_index, new_pgoalreached);
+                }
+            }
+        }
+
+        inline void UpdateLivePolicyTree(
+                const std::vector<int64_t>& changed_state_indices,
+                const bool include_spur_actions)
+        {
+            live_policy_tree_indices_.resize(nearest_neighbors_storage_.size(), -1);
+            // The root state is always kept
+            if (live_policy_tree_.empty())
+            {
+                AddToLivePolicyTree(0, nearest_neighbors_storage_[0].GetValueImmutable().GetGoalPfeasibility());
+            }
+            // Add or update the changed states - the first changed state is the new goal, so adding its branch adds any other changed states
+            std::vector<int64_t> spur_parent_indices;
+            for (size_t idx = 0; idx < changed_state_indices.size(); idx++)
+            {
+                const int64_t changed_state_index = changed_state_indices[idx];
+                const int64_t live_index = GetLivePolicyTreeIndex(changed_state_index);
+                if (live_index >= 0)
+                {
+                    live_policy_tree_[(size_t)live_index].GetValueMutable().SetGoalPfeasibility(nearest_neighbors_storage_[(size_t)changed_state_index].GetValueImmutable().GetGoalPfeasibility());
+                }
+                else
+                {
+                    AddGoalBranchToLivePolicyTree(changed_state_index);
+                }
+                // Reversible children can change if their parent changed, or if one of their siblings now reaches the goal
+                if (include_spur_actions)
+                {
+                    spur_parent_indices.push_back(changed_state_index);
+                    if (changed_state_index > 0)
+                    {
+                        spur_parent_indices.push_back(nearest_neighbors_storage_[(size_t)changed_state_index].GetParentIndex());
+                    }
+                }
+            }
+            std::sort(spur_parent_indices.begin(), spur_parent_indices.end());
+            spur_parent_indices.erase(std::unique(spur_parent_indices.begin(), spur_parent_indices.end()), spur_parent_indices.end());
+            for (size_t idx = 0; idx < spur_parent_indices.size(); idx++)
+            {
+                UpdateLivePolicySpurChildren(spur_parent_indices[idx]);
+            }
+        }
+
+        inline bool ShouldPublishPolicySnapshot() const
+        {
+            return (IsAnytimePolicyEnabled() && (total_goal_reached_probability_ >= goal_probability_threshold_) && (total_goal_reached_probability_ > published_policy_goal_reached_probability_));
+        }
+
+        inline void PublishPolicySnapshot(
+                const Configuration& virtual_goal_config,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count)
+        {
+            if (common_robotics_utilities::simple_rrt_planner::CheckTreeLinkage(live_policy_tree_) == false)
+            {
+                throw std::runtime_error("live_policy_tree_ has invalid linkage");
+            }
+            const PolicySnapshot policy = std::make_shared<const UncertaintyPlanningPolicy>(ExtractPolicy(live_policy_tree_, virtual_goal_config, edge_attempt_count, policy_action_attempt_count));
+            Log("Publishing policy snapshot with " + std::to_string(live_policy_tree_.size()) + " states and goal reached probability " + std::to_string(total_goal_reached_probability_), 2);
+            {
+                std::lock_guard<std::mutex> lock(policy_snapshot_mutex_);
+                policy_snapshot_ = policy;
+                published_policy_goal_reached_probability_ = total_goal_reached_probability_;
+            }
+            if (policy_snapshot_fn_)
+            {
+                policy_snapshot_fn_(*policy, total_goal_reached_probability_);
+            }
+        }
+
+        inline UncertaintyPlanningPolicy ExtractFinalPolicy(
+                const Configuration& virtual_goal_config,
+                const uint32_t edge_attempt_count,
+                const uint32_t policy_action_attempt_count,
+                const bool include_spur_actions)
+        {
+            // In anytime mode, the live policy tree already matches the postprocessed and pruned planner tree
+            if (IsAnytimePolicyEnabled())
+            {
+                const std::pair<PolicySnapshot, double> latest_snapshot = GetPolicySnapshot();
+                if (latest_snapshot.first && (latest_snapshot.second == total_goal_reached_probability_))
+                {
+                    return *latest_snapshot.first;
+                }
+                return ExtractPolicy(live_policy_tree_, virtual_goal_config, edge_attempt_count, policy_action_attempt_count);
+            }
+            // Postprocess and prune a single working copy of the planner tree
+            UncertaintyPlanningTree pruned_tree = PostProcessTree(nearest_neighbors_storage_);
+            PruneTreeInPlace(pruned_tree, include_spur_actions);
+            // Not sure hwat to do here with goal states
+            return ExtractPolicy(pruned_tree, virtual_goal_config, edge_attempt_count, policy_action_attempt_count);
+        }
+
         inline void LogParticleTrajectories(
                 const std::vector<std::vector<Configuration, ConfigAlloc>>& particle_executions,
                 const std::string& filename) const
@@ -945,6 +1694,12 @@ namespace uncertainty_planning_core
         {
             const uint32_t num_executions = (uint32_t)start_configs.size();
             UncertaintyPlanningPolicy policy = immutable_policy;
+            // With cumulative background learning, all executions share a single learner
+            std::unique_ptr<UncertaintyPlanningPolicyLearner> cumulative_policy_learner;
+            if (enable_cumulative_learning && background_policy_learning_enabled_)
+            {
+                cumulative_policy_learner.reset(new UncertaintyPlanningPolicyLearner(immutable_policy, MakeBackgroundPolicyStateClusteringFn()));
+            }
             simulator_ptr_->ResetStatistics();
             std::vector<std::vector<Configuration, ConfigAlloc>> particle_executions(num_executions);
             std::vector<int64_t> policy_execution_step_counts(num_executions, 0u);
@@ -974,17 +1729,26 @@ namespace uncertainty_planning_core
                         return false;
                     }
                 };
-                const std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> particle_execution = PerformSinglePolicyExecution(policy, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], simulator_move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> particle_execution;
+                if (cumulative_policy_learner)
+                {
+                    particle_execution = PerformSinglePolicyExecution(*cumulative_policy_learner, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], simulator_move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                }
+                else
+                {
+                    std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> learned_particle_execution = PerformSinglePolicyExecution(policy, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], simulator_move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                    if (enable_cumulative_learning)
+                    {
+                        policy = std::move(learned_particle_execution.second.first);
+                    }
+                    particle_execution = std::make_pair(std::move(learned_particle_execution.first), learned_particle_execution.second.second);
+                }
                 const std::chrono::time_point<std::chrono::high_resolution_clock> end_time = std::chrono::high_resolution_clock::now();
                 const std::chrono::duration<double> execution_time(end_time - start_time);
                 const double execution_seconds = execution_time.count();
                 policy_execution_times[idx] = execution_seconds;
-                particle_executions[idx] = particle_execution.first;
-                if (enable_cumulative_learning)
-                {
-                    policy = particle_execution.second.first;
-                }
-                const int64_t policy_execution_step_count = particle_execution.second.second;
+                particle_executions[idx] = std::move(particle_execution.first);
+                const int64_t policy_execution_step_count = particle_execution.second;
                 policy_execution_step_counts[idx] = policy_execution_step_count;
                 if (policy_execution_step_count >= 0)
                 {
@@ -1003,6 +1767,10 @@ namespace uncertainty_planning_core
                 std::cout << "Press ENTER to draw pretty simulation tracks..." << std::endl;
                 std::cin.get();
             }
+            if (cumulative_policy_learner)
+            {
+                policy = *cumulative_policy_learner->GetLearnedPolicy();
+            }
             for (size_t idx = 0; idx < num_executions; idx++)
             {
                 const std::string ns = "policy_simulation_" + std::to_string(idx + 1);
@@ -1017,7 +1785,7 @@ namespace uncertainty_planning_core
             {
                 LogParticleTrajectories(particle_executions, "/tmp/policy_simulation_trajectories.csv");
             }
-            return std::make_pair(policy, std::make_pair(policy_statistics, std::make_pair(policy_execution_step_counts, policy_execution_times)));
+            return std::make_pair(std::move(policy), std::make_pair(std::move(policy_statistics), std::make_pair(std::move(policy_execution_step_counts), std::move(policy_execution_times))));
         }
 
         inline std::pair<UncertaintyPlanningPolicy, std::pair<Statistics, std::pair<std::vector<int64_t>, std::vector<double>>>> ExecuteExectionPolicy(
@@ -1082,6 +1850,12 @@ namespace uncertainty_planning_core
         {
             const uint32_t num_executions = (uint32_t)start_configs.size();
             UncertaintyPlanningPolicy policy = immutable_policy;
+            // With cumulative background learning, all executions share a single learner
+            std::unique_ptr<UncertaintyPlanningPolicyLearner> cumulative_policy_learner;
+            if (enable_cumulative_learning && background_policy_learning_enabled_)
+            {
+                cumulative_policy_learner.reset(new UncertaintyPlanningPolicyLearner(immutable_policy, MakeBackgroundPolicyStateClusteringFn()));
+            }
             // Buffer for a teensy bit of time
             for (size_t iter = 0; iter < 100; iter++)
             {
@@ -1110,17 +1884,26 @@ namespace uncertainty_planning_core
                     }
                     return false;
                 };
-                const std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> particle_execution = PerformSinglePolicyExecution(policy, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> particle_execution;
+                if (cumulative_policy_learner)
+                {
+                    particle_execution = PerformSinglePolicyExecution(*cumulative_policy_learner, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                }
+                else
+                {
+                    std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> learned_particle_execution = PerformSinglePolicyExecution(policy, allow_branch_jumping, link_runtime_states_to_planned_parent, start_configs[idx], move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                    if (enable_cumulative_learning)
+                    {
+                        policy = std::move(learned_particle_execution.second.first);
+                    }
+                    particle_execution = std::make_pair(std::move(learned_particle_execution.first), learned_particle_execution.second.second);
+                }
                 const double end_time = ros::Time::now().toSec();
                 Log("Started policy exec @ " + std::to_string(start_time) + " finished policy exec @ " + std::to_string(end_time), 1);
                 const double execution_seconds = end_time - start_time;
                 policy_execution_times[idx] = execution_seconds;
-                particle_executions[idx] = particle_execution.first;
-                if (enable_cumulative_learning)
-                {
-                    policy = particle_execution.second.first;
-                }
-                const int64_t policy_execution_step_count = particle_execution.second.second;
+                particle_executions[idx] = std::move(particle_execution.first);
+                const int64_t policy_execution_step_count = particle_execution.second;
                 policy_execution_step_counts[idx] = policy_execution_step_count;
                 if (policy_execution_step_count >= 0)
                 {
@@ -1139,6 +1922,10 @@ namespace uncertainty_planning_core
                 std::cout << "Press ENTER to draw pretty execution tracks..." << std::endl;
                 std::cin.get();
             }
+            if (cumulative_policy_learner)
+            {
+                policy = *cumulative_policy_learner->GetLearnedPolicy();
+            }
             for (size_t idx = 0; idx < num_executions; idx++)
             {
                 const std::string ns = "policy_execution_" + std::to_string(idx + 1);
@@ -1150,20 +1937,89 @@ namespace uncertainty_planning_core
             policy_statistics["(Execution) Policy success"] = policy_success;
             if (debug_level_ >= 15)
             {
-                LogParticleTrajectories(particle_executions, "/tmp/policy_execution_trajectories.csv");
+                LogParticleTrajectories(particle_executions, "/tmp/policy_execution_trajectories.csv");
+            }
+            return std::make_pair(std::move(policy), std::make_pair(std::move(policy_statistics), std::make_pair(std::move(policy_execution_step_counts), std::move(policy_execution_times))));
+        }
+
+        static inline std_msgs::ColorRGBA MakeColor(const float r, const float g, const float b, const float a)
+        {
+            return common_robotics_utilities::color_builder::MakeFromFloatColors<std_msgs::ColorRGBA>(r, g, b, a);
+        }
+
+        inline std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> PerformSinglePolicyExecution(
+                const UncertaintyPlanningPolicy& immutable_policy,
+                const bool allow_branch_jumping,
+                const bool link_runtime_states_to_planned_parent,
+                const Configuration& start,
+                const ExecutionMovementFn& move_fn,
+                const ConfigGoalCheckFn& user_goal_check_fn,
+                const std::function<bool(void)>& policy_exec_termination_fn,
+                const DisplayFn& display_fn,
+                const double policy_marker_size,
+                const bool wait_for_user) const
+        {
+            if (background_policy_learning_enabled_)
+            {
+                UncertaintyPlanningPolicyLearner policy_learner(immutable_policy, MakeBackgroundPolicyStateClusteringFn());
+                std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> particle_execution = PerformSinglePolicyExecution(policy_learner, allow_branch_jumping, link_runtime_states_to_planned_parent, start, move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+                return std::make_pair(std::move(particle_execution.first), std::make_pair(*policy_learner.GetLearnedPolicy(), particle_execution.second));
             }
-            return std::make_pair(policy, std::make_pair(policy_statistics, std::make_pair(policy_execution_step_counts, policy_execution_times)));
+            UncertaintyPlanningPolicy policy = immutable_policy;
+            const typename UncertaintyPlanningPolicy::StateClusteringFn policy_state_clustering_fn = [&] (const UncertaintyPlanningState& state, const Configuration& config) { return PolicyStateClusteringFn(state, config, display_fn); };
+            // Each outcome is learned before the next action is queried
+            const PolicyQueryFn policy_query_fn = [&] (const uint64_t performed_transition_id, const Configuration& current_config)
+            {
+                return policy.QueryBestAction(performed_transition_id, current_config, allow_branch_jumping, link_runtime_states_to_planned_parent, policy_state_clustering_fn);
+            };
+            const CurrentPolicyFn current_policy_fn = [&] () -> const UncertaintyPlanningPolicy& { return policy; };
+            std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> particle_execution = PerformPolicyExecutionSteps(policy_query_fn, current_policy_fn, start, move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
+            return std::make_pair(std::move(particle_execution.first), std::make_pair(std::move(policy), particle_execution.second));
         }
 
-        static inline std_msgs::ColorRGBA MakeColor(const float r, const float g, const float b, const float a)
+        /*
+         * Executes the policy held by policy_learner. Actions are queried from the learner's current snapshot, and
+         * outcomes are learned by the learner's background thread, so learning never blocks the execution loop. See
+         * SetBackgroundPolicyLearningEnabled for the caveats.
+         */
+        inline std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> PerformSinglePolicyExecution(
+                UncertaintyPlanningPolicyLearner& policy_learner,
+                const bool allow_branch_jumping,
+                const bool link_runtime_states_to_planned_parent,
+                const Configuration& start,
+                const ExecutionMovementFn& move_fn,
+                const ConfigGoalCheckFn& user_goal_check_fn,
+                const std::function<bool(void)>& policy_exec_termination_fn,
+                const DisplayFn& display_fn,
+                const double policy_marker_size,
+                const bool wait_for_user) const
         {
-            return common_robotics_utilities::color_builder::MakeFromFloatColors<std_msgs::ColorRGBA>(r, g, b, a);
+            const PolicyQueryFn policy_query_fn = [&] (const uint64_t performed_transition_id, const Configuration& current_config)
+            {
+                return policy_learner.QueryBestAction(performed_transition_id, current_config, allow_branch_jumping, link_runtime_states_to_planned_parent);
+            };
+            // The snapshot may be newer than the one that answered the query, but states are only ever appended
+            std::shared_ptr<const UncertaintyPlanningPolicy> current_snapshot;
+            const CurrentPolicyFn current_policy_fn = [&] () -> const UncertaintyPlanningPolicy&
+            {
+                current_snapshot = policy_learner.GetSnapshot();
+                return *current_snapshot;
+            };
+            return PerformPolicyExecutionSteps(policy_query_fn, current_policy_fn, start, move_fn, user_goal_check_fn, policy_exec_termination_fn, display_fn, policy_marker_size, wait_for_user);
         }
 
-        inline std::pair<std::vector<Configuration, ConfigAlloc>, std::pair<UncertaintyPlanningPolicy, int64_t>> PerformSinglePolicyExecution(
-                const UncertaintyPlanningPolicy& immutable_policy,
-                const bool allow_branch_jumping,
-                const bool link_runtime_states_to_planned_parent,
+    protected:
+
+        typedef std::function<PolicyQueryResult<Configuration>(const uint64_t, const Configuration&)> PolicyQueryFn;
+        typedef std::function<const UncertaintyPlanningPolicy&(void)> CurrentPolicyFn;
+
+        /*
+         * Policy execution loop, shared by synchronous and background learning. The policy returned by current_policy_fn
+         * is only used for drawing, and is only used until the next call.
+         */
+        inline std::pair<std::vector<Configuration, ConfigAlloc>, int64_t> PerformPolicyExecutionSteps(
+                const PolicyQueryFn& policy_query_fn,
+                const CurrentPolicyFn& current_policy_fn,
                 const Configuration& start,
                 const ExecutionMovementFn& move_fn,
                 const ConfigGoalCheckFn& user_goal_check_fn,
@@ -1172,7 +2028,6 @@ namespace uncertainty_planning_core
                 const double policy_marker_size,
                 const bool wait_for_user) const
         {
-            UncertaintyPlanningPolicy policy = immutable_policy;
             Log("Drawing environment...", 1);
             ClearAndRedrawEnvironment(display_fn);
             if (wait_for_user)
@@ -1186,7 +2041,7 @@ namespace uncertainty_planning_core
                 std::this_thread::sleep_for(std::chrono::duration<double>(0.1));
             }
             Log("Drawing initial policy...", 1);
-            DrawPolicy(policy, policy_marker_size, "execution_policy", display_fn);
+            DrawPolicy(current_policy_fn(), policy_marker_size, "execution_policy", display_fn);
             if (wait_for_user)
             {
                 std::cout << "Press ENTER to continue..." << std::endl;
@@ -1198,7 +2053,6 @@ namespace uncertainty_planning_core
                 std::this_thread::sleep_for(std::chrono::duration<double>(0.1));
             }
             // Let's do this
-            std::function<bool(const std::vector<Configuration, ConfigAlloc>&, const Configuration&)> policy_particle_clustering_fn = [&] (const std::vector<Configuration, ConfigAlloc>& particles, const Configuration& config) { return PolicyParticleClusteringFn(particles, config, display_fn); };
             // Reset the robot first
             Log("Reseting before policy execution...", 1);
             move_fn(start, start, start, false, true);
@@ -1213,7 +2067,8 @@ namespace uncertainty_planning_core
                 // Get the current configuration
                 const Configuration& current_config = particle_trajectory.back();
                 // Get the next action
-                const PolicyQueryResult<Configuration> policy_query_response = policy.QueryBestAction(desired_transition_id, current_config, allow_branch_jumping, link_runtime_states_to_planned_parent, policy_particle_clustering_fn);
+                const PolicyQueryResult<Configuration> policy_query_response = policy_query_fn(desired_transition_id, current_config);
+                const UncertaintyPlanningPolicy& policy = current_policy_fn();
                 const int64_t previous_state_idx = policy_query_response.PreviousStateIndex();
                 desired_transition_id = policy_query_response.DesiredTransitionId();
                 const Configuration& action = policy_query_response.Action();
@@ -1270,32 +2125,33 @@ namespace uncertainty_planning_core
                 {
                     // We've reached the goal!
                     Log("Policy execution reached the goal in " + std::to_string(current_exec_step) + " steps", 2);
-                    return std::make_pair(particle_trajectory, std::make_pair(policy, (int64_t)current_exec_step));
+                    return std::make_pair(std::move(particle_trajectory), (int64_t)current_exec_step);
                 }
             }
             // If we get here, we haven't reached the goal!
             Log("Policy execution failed to reach the goal in " + std::to_string(current_exec_step) + " steps", 3);
-            return std::make_pair(particle_trajectory, std::make_pair(policy, -((int64_t)current_exec_step)));
+            return std::make_pair(std::move(particle_trajectory), -((int64_t)current_exec_step));
         }
 
-    protected:
-
         inline std::vector<Configuration, ConfigAlloc> SimulatePolicyStep(
                 const Configuration& current_config,
                 const Configuration& action,
                 const bool is_reverse_motion,
                 const DisplayFn& display_fn) const
         {
-            ForwardSimulationStepTrace<Configuration, ConfigAlloc> trace;
+            // Reuse the trace storage across policy steps (and executions) on the same thread
+            static thread_local ForwardSimulationTraceArena<Configuration, ConfigAlloc> trace_arena;
+            const std::vector<Configuration, ConfigAlloc> start_positions(1, current_config);
+            const std::vector<Configuration, ConfigAlloc> target_positions(1, action);
             if (is_reverse_motion == false)
             {
-                simulator_ptr_->ForwardSimulateRobot(robot_ptr_, current_config, action, true, trace, true, display_fn);
+                simulator_ptr_->ForwardSimulateRobotsBatch(robot_ptr_, start_positions, target_positions, true, trace_arena, true, display_fn);
             }
             else
             {
-                simulator_ptr_->ReverseSimulateRobot(robot_ptr_, current_config, action, true, trace, true, display_fn);
+                simulator_ptr_->ReverseSimulateRobotsBatch(robot_ptr_, start_positions, target_positions, true, trace_arena, true, display_fn);
             }
-            std::vector<Configuration, ConfigAlloc> execution_trajectory = ExtractTrajectoryFromTrace(trace);
+            std::vector<Configuration, ConfigAlloc> execution_trajectory = ExtractTrajectoryFromTrace(trace_arena.GetTrace(0));
             if (execution_trajectory.empty())
             {
                 throw std::runtime_error("SimulatePolicyStep execution trajectory is empty, this should not happen!");
@@ -1555,20 +2411,21 @@ namespace uncertainty_planning_core
         }
 
         /*
-         * Particle clustering function used in policy execution
+         * State clustering function used in policy execution
          */
-        inline bool PolicyParticleClusteringFn(
-                const std::vector<Configuration, ConfigAlloc>& parent_particles,
+        inline bool PolicyStateClusteringFn(
+                const UncertaintyPlanningState& parent,
                 const Configuration& current_config,
                 const DisplayFn& display_fn) const
         {
+            const std::vector<Configuration, ConfigAlloc>& parent_particles = parent.GetParticlePositionsImmutable().Value();
             if (parent_particles.empty())
             {
                 throw std::invalid_argument("parent_particles cannot be empty");
             }
             std::vector<SimulationResult<Configuration>> result_particles;
             result_particles.push_back(SimulationResult<Configuration>(current_config, current_config, false, false));
-            const std::vector<uint8_t> cluster_membership = clustering_ptr_->IdentifyClusterMembers(robot_ptr_, parent_particles, result_particles, display_fn);
+            const std::vector<uint8_t> cluster_membership = clustering_ptr_->IdentifyClusterMembersWithDescriptor(robot_ptr_, parent_particles, parent.GetClusterDescriptor(), result_particles, display_fn);
             const uint8_t parent_cluster_membership = cluster_membership.at(0);
             if (parent_cluster_membership > 0x00)
             {
@@ -1580,6 +2437,16 @@ namespace uncertainty_planning_core
             }
         }
 
+        /*
+         * State clustering function used by background policy learning, which runs on the learner thread and so does not
+         * draw anything
+         */
+        inline typename UncertaintyPlanningPolicy::StateClusteringFn MakeBackgroundPolicyStateClusteringFn() const
+        {
+            const DisplayFn null_display_fn = [] (const visualization_msgs::MarkerArray& markers) { UNUSED(markers); };
+            return [this, null_display_fn] (const UncertaintyPlanningState& state, const Configuration& config) { return PolicyStateClusteringFn(state, config, null_display_fn); };
+        }
+
         /*
          * Particle clustering function for planning
          */
@@ -1599,10 +2466,25 @@ namespace uncertainty_planning_core
             }
             const std::chrono::time_point<std::chrono::high_resolution_clock> start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
             const std::vector<std::vector<size_t>> final_index_clusters = clustering_ptr_->ClusterParticles(robot_ptr_, particles, display_fn);
-            // Before we return, we need to convert the index clusters to configuration clusters
+            const std::vector<std::vector<SimulationResult<Configuration>>> final_clusters = MakeParticleClusters(particles, final_index_clusters, allow_contacts);
+            // Now, return the clusters and probability table
+            const std::chrono::time_point<std::chrono::high_resolution_clock> end = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+            const std::chrono::duration<double> elapsed = end - start;
+            elapsed_clustering_time_ += elapsed.count();
+            return final_clusters;
+        }
+
+        inline static std::vector<std::vector<SimulationResult<Configuration>>> MakeParticleClusters(
+                const std::vector<SimulationResult<Configuration>>& particles,
+                const std::vector<std::vector<size_t>>& final_index_clusters,
+                const bool allow_contacts)
+        {
+            // Convert the index clusters to configuration clusters
+            // Particles may be left out of every cluster (e.g. DBSCAN noise), in which case they count towards the attempts
+            // of the resulting edges but reach none of them, but no particle may be in more than one cluster
             std::vector<std::vector<SimulationResult<Configuration>>> final_clusters;
             final_clusters.reserve(final_index_clusters.size());
-            size_t total_particles = 0;
+            std::vector<uint8_t> particle_clustered(particles.size(), 0x00);
             for (size_t cluster_idx = 0; cluster_idx < final_index_clusters.size(); cluster_idx++)
             {
                 const std::vector<size_t>& cluster = final_index_clusters[cluster_idx];
@@ -1610,9 +2492,13 @@ namespace uncertainty_planning_core
                 final_cluster.reserve(cluster.size());
                 for (size_t element_idx = 0; element_idx < cluster.size(); element_idx++)
                 {
-                    total_particles++;
                     const size_t particle_idx = cluster[element_idx];
                     const SimulationResult<Configuration>& particle = particles.at(particle_idx);
+                    if (particle_clustered[particle_idx] != 0x00)
+                    {
+                        throw std::runtime_error("Particle " + std::to_string(particle_idx) + " is in more than one cluster");
+                    }
+                    particle_clustered[particle_idx] = 0x01;
                     if ((particle.DidContact() == false) || allow_contacts)
                     {
                         final_cluster.push_back(particle);
@@ -1622,14 +2508,6 @@ namespace uncertainty_planning_core
                 final_clusters.push_back(final_cluster);
             }
             final_clusters.shrink_to_fit();
-            if (total_particles != particles.size())
-            {
-                throw std::runtime_error("total_particles != particles.size()");
-            }
-            // Now, return the clusters and probability table
-            const std::chrono::time_point<std::chrono::high_resolution_clock> end = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
-            const std::chrono::duration<double> elapsed = end - start;
-            elapsed_clustering_time_ += elapsed.count();
             return final_clusters;
         }
 
@@ -1647,26 +2525,7 @@ namespace uncertainty_planning_core
             // First, compute a target state
             const Configuration target_point = target.GetExpectation();
             // Get the initial particles
-            std::vector<Configuration, ConfigAlloc> initial_particles;
-            // We'd like to use the particles of the parent directly
-            if (nearest.GetNumParticles() == num_particles_)
-            {
-                initial_particles = nearest.CollectParticles(num_particles_);
-            }
-            // If the number of particles is dynamic based on the simulator
-            else if (num_particles_ == 0u)
-            {
-                initial_particles = nearest.CollectParticles(nearest.GetNumParticles());
-            }
-            // Otherwise, we resample from the parent
-            else
-            {
-                initial_particles = nearest.ResampleParticles(num_particles_, simulator_ptr_->GetRandomGenerator());
-            }
-            if (debug_level_ >= 15)
-            {
-                display_fn(MakeParticlesDisplayRep(initial_particles, MakeColor(0.1f, 0.1f, 0.1f, 1.0f), "initial_particles"));
-            }
+            const std::vector<Configuration, ConfigAlloc> initial_particles = CollectInitialParticles(nearest, display_fn);
             // Forward propagate each of the particles
             std::vector<Configuration, ConfigAlloc> target_position;
             target_position.reserve(1);
@@ -1688,32 +2547,289 @@ namespace uncertainty_planning_core
             return std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>>(initial_particles, propagated_points);
         }
 
-        inline std::pair<uint32_t, uint32_t> ComputeReverseEdgeProbability(
-                const UncertaintyPlanningState& parent,
-                const UncertaintyPlanningState& child,
+        /*
+         * Pipelined version of SimulateParticles + ClusterParticles for forward propagation - particles are simulated in chunks
+         * on a single worker thread, which queues each simulated chunk for the incremental clusterer and moves on to the next
+         * chunk. Using one thread for every chunk means that simulators using OpenMP keep the same thread team for the whole
+         * propagation. Falls back to SimulateParticles + ClusterParticles if the clusterer does not support incremental
+         * clustering.
+         */
+        inline std::pair<std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>>, std::vector<std::vector<SimulationResult<Configuration>>>> SimulateAndClusterParticlesPipelined(
+                const UncertaintyPlanningState& nearest,
+                const UncertaintyPlanningState& target,
+                const bool allow_contacts,
+                const DisplayFn& display_fn)
+        {
+            const std::chrono::time_point<std::chrono::high_resolution_clock> start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+            // The simulator and the clusterer run concurrently, so the clusterer gets its own copy of the robot
+            const std::shared_ptr<Robot> clustering_robot_ptr(robot_ptr_->Clone());
+            const std::unique_ptr<IncrementalOutcomeClusteringInterface<Configuration, ConfigAlloc>> incremental_clustering = clustering_ptr_->MakeIncrementalClustering(clustering_robot_ptr);
+            if (!incremental_clustering)
+            {
+                std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>> simulation_result = SimulateParticles(nearest, target, allow_contacts, false, display_fn);
+                std::vector<std::vector<SimulationResult<Configuration>>> particle_clusters = ClusterParticles(simulation_result.second, allow_contacts, display_fn);
+                return std::make_pair(std::move(simulation_result), std::move(particle_clusters));
+            }
+            const std::vector<Configuration, ConfigAlloc> initial_particles = CollectInitialParticles(nearest, display_fn);
+            const std::vector<Configuration, ConfigAlloc> target_position(1, target.GetExpectation());
+            const size_t chunk_size = pipelined_propagation_chunk_size_;
+            const size_t num_chunks = (initial_particles.size() + chunk_size - 1) / chunk_size;
+            // Only the simulator draws while the pipeline is running
+            const DisplayFn null_display_fn = [] (const visualization_msgs::MarkerArray& markers) { UNUSED(markers); };
+            // Only the worker thread touches the simulator until the pipeline is drained
+            const std::function<std::vector<SimulationResult<Configuration>>(const size_t)> simulate_chunk_fn = [&] (const size_t chunk_idx)
+            {
+                const size_t chunk_start = chunk_idx * chunk_size;
+                const size_t chunk_end = std::min(chunk_start + chunk_size, initial_particles.size());
+                const std::vector<Configuration, ConfigAlloc> chunk_particles(initial_particles.begin() + (ptrdiff_t)chunk_start, initial_particles.begin() + (ptrdiff_t)chunk_end);
+                return simulator_ptr_->ForwardSimulateRobots(robot_ptr_, chunk_particles, target_position, allow_contacts, display_fn);
+            };
+            // Simulated chunks are queued in order by the worker thread
+            std::mutex chunk_queue_mutex;
+            std::condition_variable chunk_queue_cv;
+            std::deque<std::vector<SimulationResult<Configuration>>> simulated_chunks;
+            bool simulation_finished = false;
+            bool pipeline_abandoned = false;
+            std::exception_ptr simulation_exception;
+            std::thread simulation_thread([&] ()
+            {
+                try
+                {
+                    for (size_t chunk_idx = 0; chunk_idx < num_chunks; chunk_idx++)
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(chunk_queue_mutex);
+                            if (pipeline_abandoned)
+                            {
+                                break;
+                            }
+                        }
+                        std::vector<SimulationResult<Configuration>> propagated_chunk = simulate_chunk_fn(chunk_idx);
+                        std::lock_guard<std::mutex> lock(chunk_queue_mutex);
+                        simulated_chunks.push_back(std::move(propagated_chunk));
+                        chunk_queue_cv.notify_one();
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(chunk_queue_mutex);
+                    simulation_exception = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(chunk_queue_mutex);
+                simulation_finished = true;
+                chunk_queue_cv.notify_one();
+            });
+            std::vector<SimulationResult<Configuration>> propagated_points;
+            propagated_points.reserve(initial_particles.size());
+            double clustering_time = 0.0;
+            try
+            {
+                for (size_t chunk_idx = 0; chunk_idx < num_chunks; chunk_idx++)
+                {
+                    std::vector<SimulationResult<Configuration>> propagated_chunk;
+                    {
+                        std::unique_lock<std::mutex> lock(chunk_queue_mutex);
+                        chunk_queue_cv.wait(lock, [&] () { return (simulated_chunks.size() > 0) || simulation_finished; });
+                        // The worker only finishes early if the simulator threw
+                        if (simulated_chunks.empty())
+                        {
+                            break;
+                        }
+                        propagated_chunk = std::move(simulated_chunks.front());
+                        simulated_chunks.pop_front();
+                    }
+                    // Cluster this chunk while the following ones are simulated
+                    const std::chrono::time_point<std::chrono::high_resolution_clock> clustering_start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+                    incremental_clustering->AddParticles(propagated_chunk, null_display_fn);
+                    const std::chrono::duration<double> chunk_clustering_time = std::chrono::high_resolution_clock::now() - clustering_start;
+                    clustering_time += chunk_clustering_time.count();
+                    propagated_points.insert(propagated_points.end(), propagated_chunk.begin(), propagated_chunk.end());
+                }
+            }
+            catch (...)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(chunk_queue_mutex);
+                    pipeline_abandoned = true;
+                }
+                simulation_thread.join();
+                throw;
+            }
+            simulation_thread.join();
+            if (simulation_exception)
+            {
+                std::rethrow_exception(simulation_exception);
+            }
+            particles_simulated_ += propagated_points.size();
+            const std::chrono::time_point<std::chrono::high_resolution_clock> clustering_start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+            const std::vector<std::vector<size_t>> final_index_clusters = incremental_clustering->FinishClustering(display_fn);
+            std::vector<std::vector<SimulationResult<Configuration>>> particle_clusters = MakeParticleClusters(propagated_points, final_index_clusters, allow_contacts);
+            const std::chrono::time_point<std::chrono::high_resolution_clock> end = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+            const std::chrono::duration<double> final_clustering_time = end - clustering_start;
+            clustering_time += final_clustering_time.count();
+            // Simulation time is the remainder of the pipeline wall time
+            const std::chrono::duration<double> elapsed = end - start;
+            elapsed_clustering_time_ += clustering_time;
+            elapsed_simulation_time_ += (elapsed.count() - clustering_time);
+            return std::make_pair(std::make_pair(initial_particles, std::move(propagated_points)), std::move(particle_clusters));
+        }
+
+        /*
+         * Adaptive version of SimulateParticles + ClusterParticles for forward propagation - particles are simulated in
+         * geometrically growing batches until the outcome proportions are known to the requested confidence (see
+         * SetAdaptiveParticleCount)
+         */
+        inline std::pair<std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>>, std::vector<std::vector<SimulationResult<Configuration>>>> SimulateAndClusterParticlesAdaptive(
+                const UncertaintyPlanningState& nearest,
+                const UncertaintyPlanningState& target,
+                const bool allow_contacts,
+                const DisplayFn& display_fn)
+        {
+            std::vector<Configuration, ConfigAlloc> initial_particles = CollectInitialParticles(nearest, display_fn);
+            if (adaptive_particle_max_count_ > initial_particles.size())
+            {
+                const std::vector<Configuration, ConfigAlloc> extra_particles = nearest.ResampleParticles(adaptive_particle_max_count_ - initial_particles.size(), simulator_ptr_->GetRandomGenerator());
+                initial_particles.insert(initial_particles.end(), extra_particles.begin(), extra_particles.end());
+            }
+            else if ((adaptive_particle_max_count_ > 0u) && (adaptive_particle_max_count_ < initial_particles.size()))
+            {
+                initial_particles.erase(initial_particles.begin() + (ptrdiff_t)adaptive_particle_max_count_, initial_particles.end());
+            }
+            const std::vector<Configuration, ConfigAlloc> target_position(1, target.GetExpectation());
+            std::vector<SimulationResult<Configuration>> propagated_points;
+            propagated_points.reserve(initial_particles.size());
+            std::vector<std::vector<SimulationResult<Configuration>>> particle_clusters;
+            size_t num_simulated = 0u;
+            while (num_simulated < initial_particles.size())
+            {
+                const std::chrono::time_point<std::chrono::high_resolution_clock> start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+                // Re-clustering after every fixed-size batch would cost (N / batch_size) full clusterings
+                const size_t batch_end = std::min(num_simulated + std::max(num_simulated, adaptive_particle_batch_size_), initial_particles.size());
+                const std::vector<Configuration, ConfigAlloc> batch_particles(initial_particles.begin() + (ptrdiff_t)num_simulated, initial_particles.begin() + (ptrdiff_t)batch_end);
+                const std::vector<SimulationResult<Configuration>> propagated_batch = simulator_ptr_->ForwardSimulateRobots(robot_ptr_, batch_particles, target_position, allow_contacts, display_fn);
+                propagated_points.insert(propagated_points.end(), propagated_batch.begin(), propagated_batch.end());
+                num_simulated = batch_end;
+                const std::chrono::time_point<std::chrono::high_resolution_clock> end = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+                const std::chrono::duration<double> elapsed = end - start;
+                elapsed_simulation_time_ += elapsed.count();
+                particle_clusters = ClusterParticles(propagated_points, allow_contacts, display_fn);
+                if (CheckOutcomeProportionsConverged(particle_clusters, propagated_points.size()))
+                {
+                    break;
+                }
+            }
+            particles_simulated_ += propagated_points.size();
+            Log("Adaptive forward propagation simulated " + std::to_string(num_simulated) + " of " + std::to_string(initial_particles.size()) + " particles", 1);
+            // Only keep the initial particles that were actually simulated
+            initial_particles.erase(initial_particles.begin() + (ptrdiff_t)num_simulated, initial_particles.end());
+            return std::make_pair(std::make_pair(std::move(initial_particles), std::move(propagated_points)), std::move(particle_clusters));
+        }
+
+        inline bool CheckOutcomeProportionsConverged(
+                const std::vector<std::vector<SimulationResult<Configuration>>>& particle_clusters,
+                const size_t num_simulated) const
+        {
+            if (num_simulated == 0u)
+            {
+                return false;
+            }
+            // Wilson score interval on P(reached cluster) = reached_count / attempt_count for each cluster
+            const double n = (double)num_simulated;
+            const double z = adaptive_particle_confidence_z_;
+            const double z2_over_n = (z * z) / n;
+            for (size_t idx = 0; idx < particle_clusters.size(); idx++)
+            {
+                const double p = (double)particle_clusters[idx].size() / n;
+                const double halfwidth = (z / (1.0 + z2_over_n)) * std::sqrt(((p * (1.0 - p)) / n) + (z2_over_n / (4.0 * n)));
+                if (halfwidth > adaptive_particle_interval_halfwidth_)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        inline std::vector<Configuration, ConfigAlloc> CollectInitialParticles(
+                const UncertaintyPlanningState& nearest,
                 const DisplayFn& display_fn)
         {
-            const std::vector<SimulationResult<Configuration>> simulation_result = SimulateParticles(child, parent, true, true, display_fn).second;
-            std::vector<uint8_t> parent_cluster_membership;
-            if (parent.HasParticles())
+            std::vector<Configuration, ConfigAlloc> initial_particles;
+            // We'd like to use the particles of the parent directly
+            if (nearest.GetNumParticles() == num_particles_)
+            {
+                initial_particles = nearest.CollectParticles(num_particles_);
+            }
+            // If the number of particles is dynamic based on the simulator
+            else if (num_particles_ == 0u)
             {
-                parent_cluster_membership = clustering_ptr_->IdentifyClusterMembers(robot_ptr_, parent.GetParticlePositionsImmutable().Value(), simulation_result, display_fn);
+                initial_particles = nearest.CollectParticles(nearest.GetNumParticles());
             }
+            // Otherwise, we resample from the parent
             else
             {
-                const std::vector<Configuration, ConfigAlloc> parent_cluster(1, parent.GetExpectation());
-                parent_cluster_membership = clustering_ptr_->IdentifyClusterMembers(robot_ptr_, parent_cluster, simulation_result, display_fn);
+                initial_particles = nearest.ResampleParticles(num_particles_, simulator_ptr_->GetRandomGenerator());
+            }
+            if (debug_level_ >= 15)
+            {
+                display_fn(MakeParticlesDisplayRep(initial_particles, MakeColor(0.1f, 0.1f, 0.1f, 1.0f), "initial_particles"));
+            }
+            return initial_particles;
+        }
+
+        /*
+         * Computes the reverse edge (attempt, reached) counts of the provided children of parent. The particles of all the
+         * children are reverse simulated as one heterogeneous batch, rather than with one simulator call per child.
+         */
+        inline std::vector<std::pair<uint32_t, uint32_t>> ComputeReverseEdgeProbabilities(
+                const UncertaintyPlanningState& parent,
+                const std::vector<std::pair<UncertaintyPlanningState, int64_t>>& children,
+                const std::vector<size_t>& child_indices,
+                const DisplayFn& display_fn)
+        {
+            if (child_indices.empty())
+            {
+                return std::vector<std::pair<uint32_t, uint32_t>>();
             }
-            uint32_t reached_parent = 0u;
-            // Get the target position;
-            for (size_t ndx = 0; ndx < parent_cluster_membership.size(); ndx++)
+            const std::chrono::time_point<std::chrono::high_resolution_clock> start = (std::chrono::time_point<std::chrono::high_resolution_clock>)std::chrono::high_resolution_clock::now();
+            const Configuration parent_point = parent.GetExpectation();
+            std::vector<Configuration, ConfigAlloc> start_positions;
+            std::vector<size_t> child_particle_offsets(child_indices.size() + 1, 0u);
+            for (size_t idx = 0; idx < child_indices.size(); idx++)
+            {
+                const std::vector<Configuration, ConfigAlloc> child_particles = CollectInitialParticles(children[child_indices[idx]].first, display_fn);
+                start_positions.insert(start_positions.end(), child_particles.begin(), child_particles.end());
+                child_particle_offsets[idx + 1] = start_positions.size();
+            }
+            const std::vector<Configuration, ConfigAlloc> target_positions(start_positions.size(), parent_point);
+            const std::vector<SimulationResult<Configuration>> simulation_results = simulator_ptr_->ReverseSimulateRobotsBatch(robot_ptr_, start_positions, target_positions, true, reverse_check_trace_arena_, false, display_fn);
+            particles_simulated_ += simulation_results.size();
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            elapsed_simulation_time_ += elapsed.count();
+            std::vector<std::pair<uint32_t, uint32_t>> reverse_edge_counts(child_indices.size());
+            for (size_t idx = 0; idx < child_indices.size(); idx++)
             {
-                if (parent_cluster_membership[ndx] > 0)
+                const std::vector<SimulationResult<Configuration>> child_results(simulation_results.begin() + (ptrdiff_t)child_particle_offsets[idx], simulation_results.begin() + (ptrdiff_t)child_particle_offsets[idx + 1]);
+                std::vector<uint8_t> parent_cluster_membership;
+                if (parent.HasParticles())
+                {
+                    parent_cluster_membership = clustering_ptr_->IdentifyClusterMembersWithDescriptor(robot_ptr_, parent.GetParticlePositionsImmutable().Value(), parent.GetClusterDescriptor(), child_results, display_fn);
+                }
+                else
                 {
-                    reached_parent++;
+                    const std::vector<Configuration, ConfigAlloc> parent_cluster(1, parent_point);
+                    parent_cluster_membership = clustering_ptr_->IdentifyClusterMembers(robot_ptr_, parent_cluster, child_results, display_fn);
+                }
+                uint32_t reached_parent = 0u;
+                for (size_t ndx = 0; ndx < parent_cluster_membership.size(); ndx++)
+                {
+                    if (parent_cluster_membership[ndx] > 0)
+                    {
+                        reached_parent++;
+                    }
                 }
+                reverse_edge_counts[idx] = std::make_pair((uint32_t)parent_cluster_membership.size(), reached_parent);
             }
-            return std::make_pair((uint32_t)parent_cluster_membership.size(), reached_parent);
+            return reverse_edge_counts;
         }
 
         inline std::pair<std::vector<std::pair<UncertaintyPlanningState, int64_t>>, std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>>> ForwardSimulateStates(
@@ -1727,12 +2843,43 @@ namespace uncertainty_planning_core
             // Increment the transition ID
             transition_id_++;
             const uint64_t current_forward_transition_id = transition_id_;
-            // Forward propagate each of the particles
-            std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>> simulation_result = SimulateParticles(nearest, target, allow_contacts, false, display_fn);
+            // Forward propagate each of the particles, and cluster the live particles into (potentially) multiple states
+            std::pair<std::vector<Configuration, ConfigAlloc>, std::vector<SimulationResult<Configuration>>> simulation_result;
+            std::vector<std::vector<SimulationResult<Configuration>>> particle_clusters;
+            const size_t num_propagated_particles = (num_particles_ > 0u) ? num_particles_ : nearest.GetNumParticles();
+            if (adaptive_particle_batch_size_ > 0u)
+            {
+                auto adaptive_result = SimulateAndClusterParticlesAdaptive(nearest, target, allow_contacts, display_fn);
+                simulation_result = std::move(adaptive_result.first);
+                particle_clusters = std::move(adaptive_result.second);
+            }
+            // Pipelining is only worth it with more than one chunk
+            else if ((pipelined_propagation_chunk_size_ > 0u) && (num_propagated_particles > pipelined_propagation_chunk_size_))
+            {
+                auto pipelined_result = SimulateAndClusterParticlesPipelined(nearest, target, allow_contacts, display_fn);
+                simulation_result = std::move(pipelined_result.first);
+                particle_clusters = std::move(pipelined_result.second);
+            }
+            else
+            {
+                // An earlier expansion of the same state towards (nearly) the same target already added its children to
+                // the tree, and repeating it would only add copies of them, so the expansion is skipped (the cached
+                // particles are still returned for display)
+                const typename SimulationResultCache<Configuration, ConfigAlloc>::DistanceFn target_distance_fn = [&] (const Configuration& config1, const Configuration& config2)
+                {
+                    return robot_ptr_->ComputeConfigurationDistance(config1, config2);
+                };
+                if (simulation_cache_.Lookup(nearest.GetStateId(), false, allow_contacts, target.GetExpectation(), target_distance_fn, simulation_result))
+                {
+                    Log("Skipping repeated expansion of state " + std::to_string(nearest.GetStateId()) + " towards a cached target", 1);
+                    return std::make_pair(std::vector<std::pair<UncertaintyPlanningState, int64_t>>(), simulation_result);
+                }
+                simulation_result = SimulateParticles(nearest, target, allow_contacts, false, display_fn);
+                simulation_cache_.Insert(nearest.GetStateId(), false, allow_contacts, target.GetExpectation(), simulation_result);
+                particle_clusters = ClusterParticles(simulation_result.second, allow_contacts, display_fn);
+            }
             std::vector<Configuration, ConfigAlloc>& initial_particles = simulation_result.first;
             std::vector<SimulationResult<Configuration>>& propagated_points = simulation_result.second;
-            // Cluster the live particles into (potentially) multiple states
-            const std::vector<std::vector<SimulationResult<Configuration>>>& particle_clusters = ClusterParticles(propagated_points, allow_contacts, display_fn);
             bool is_split_child = false;
             if (particle_clusters.size() > 1)
             {
@@ -1781,7 +2928,9 @@ namespace uncertainty_planning_core
                         reverse_attempt_count = (uint32_t)current_cluster.size();
                         reverse_reached_count = 0u;
                     }
-                    else if (is_split_child)
+                    // Split children need to be checked too, unless they are
+                    // contact-free and the simulator says that makes them reversible
+                    else if (is_split_child && (did_collide || !simulator_ptr_->ContactFreeMotionIsReversible()))
                     {
                         reverse_attempt_count = (uint32_t)current_cluster.size();
                         reverse_reached_count = 0u;
@@ -1791,13 +2940,14 @@ namespace uncertainty_planning_core
                     const uint64_t new_state_reverse_transtion_id = transition_id_;
                     UncertaintyPlanningState propagated_state(state_counter_, particle_locations, attempt_count, reached_count, effective_edge_feasibility, reverse_attempt_count, reverse_reached_count, nearest.GetMotionPfeasibility(), step_size_, control_target, current_forward_transition_id, new_state_reverse_transtion_id, ((is_split_child) ? split_id_ : 0u), action_is_nominally_independent);
                     propagated_state.UpdateStatistics(robot_ptr_);
+                    propagated_state.SetClusterDescriptor(clustering_ptr_->ComputeClusterDescriptor(robot_ptr_, propagated_state.GetParticlePositionsImmutable().Value()));
                     // Store the state
                     result_states[idx].first = propagated_state;
                     result_states[idx].second = -1;
                 }
             }
             // Now that we've built the forward-propagated states, we compute their reverse edge P(feasibility)
-            uint32_t computed_reversibility = 0u;
+            std::vector<size_t> reverse_check_indices;
             for (size_t idx = 0; idx < result_states.size(); idx++)
             {
                 UncertaintyPlanningState& current_state = result_states[idx].first;
@@ -1806,9 +2956,7 @@ namespace uncertainty_planning_core
                     // In some cases, we already know the reverse edge P(feasibility) so we don't need to compute it again
                     if (current_state.GetReverseEdgePfeasibility() < 1.0)
                     {
-                        const std::pair<uint32_t, uint32_t> reverse_edge_check = ComputeReverseEdgeProbability(nearest, current_state, display_fn);
-                        current_state.UpdateReverseAttemptAndReachedCounts(reverse_edge_check.first, reverse_edge_check.second);
-                        computed_reversibility++;
+                        reverse_check_indices.push_back(idx);
                     }
                 }
                 else
@@ -1816,39 +2964,27 @@ namespace uncertainty_planning_core
                     current_state.UpdateReverseAttemptAndReachedCounts((uint32_t)current_state.GetNumParticles(), 0u);
                 }
             }
+            const std::vector<std::pair<uint32_t, uint32_t>> reverse_edge_checks = ComputeReverseEdgeProbabilities(nearest, result_states, reverse_check_indices, display_fn);
+            for (size_t idx = 0; idx < reverse_check_indices.size(); idx++)
+            {
+                result_states[reverse_check_indices[idx]].first.UpdateReverseAttemptAndReachedCounts(reverse_edge_checks[idx].first, reverse_edge_checks[idx].second);
+            }
+            const size_t computed_reversibility = reverse_check_indices.size();
             Log("Forward simultation produced " + std::to_string(result_states.size()) + " states, needed to compute reversibility for " + std::to_string(computed_reversibility) + " of them", 1);
             // We only do further processing if a split happened
             if (result_states.size() > 1)
             {
                 // Now that we have the forward-propagated states, we go back and update their effective edge P(feasibility)
+                // Only if a state has nominally independent outcomes can we expect particles that return to the parent to actually reach a different outcome in future repeats
+                RetryProbabilitySolver retry_solver;
+                for (size_t idx = 0; idx < result_states.size(); idx++)
+                {
+                    retry_solver.AddOutcome(result_states[idx].first);
+                }
                 for (size_t idx = 0; idx < result_states.size(); idx++)
                 {
                     UncertaintyPlanningState& current_state = result_states[idx].first;
-                    double percent_active = 1.0;
-                    double p_reached = 0.0;
-                    for (uint32_t try_attempt = 0; try_attempt < planner_action_try_attempts; try_attempt++)
-                    {
-                        // How many particles got to our state on this attempt?
-                        p_reached += (percent_active * current_state.GetRawEdgePfeasibility());
-                        // Update the percent of particles that are still usefully active
-                        double updated_percent_active = 0.0;
-                        for (size_t other_idx = 0; other_idx < result_states.size(); other_idx++)
-                        {
-                            if (other_idx != idx)
-                            {
-                                const UncertaintyPlanningState& other_state = result_states[other_idx].first;
-                                // Only if this state has nominally independent outcomes can we expect particles that
-                                // return to the parent to actually reach a different outcome in future repeats
-                                if (other_state.IsActionOutcomeNominallyIndependent())
-                                {
-                                    const double p_reached_other = percent_active * other_state.GetRawEdgePfeasibility();
-                                    const double p_returned_to_parent = p_reached_other * other_state.GetReverseEdgePfeasibility();
-                                    updated_percent_active += p_returned_to_parent;
-                                }
-                            }
-                        }
-                        percent_active = updated_percent_active;
-                    }
+                    double p_reached = retry_solver.ComputeReachedProbability(idx, planner_action_try_attempts);
                     if ((p_reached >= 0.0) && (p_reached <= 1.0))
                     {
                         current_state.SetEffectiveEdgePfeasibility(p_reached);
@@ -2085,8 +3221,19 @@ namespace uncertainty_planning_core
             UNUSED(state);
             UNUSED(planner_action_try_attempts);
             UNUSED(allow_contacts);
-            UncertaintyPlanningState& goal_state_candidate = nearest_neighbors_storage_.back().GetValueMutable();
             // NOTE - this assumes (safely) that the state passed to this function is the last state added to the tree, which we can safely mutate!
+            return GoalReachedGoalFunction((int64_t)nearest_neighbors_storage_.size() - 1, user_goal_check_fn);
+        }
+
+        inline bool GoalReachedGoalFunction(
+                const int64_t candidate_index,
+                const GoalReachedProbabilityFn& user_goal_check_fn)
+        {
+            UncertaintyPlanningState& goal_state_candidate = nearest_neighbors_storage_[(size_t)candidate_index].GetValueMutable();
+            if (goal_state_candidate.IsTransposition())
+            {
+                return TranspositionGoalReached(candidate_index);
+            }
             // We only care about states with control input == goal position (states that are directly trying to go to the goal)
             const double goal_reached_probability = user_goal_check_fn(goal_state_candidate);
             if (goal_reached_probability > 0.0)
@@ -2115,8 +3262,19 @@ namespace uncertainty_planning_core
             UNUSED(state);
             UNUSED(planner_action_try_attempts);
             UNUSED(allow_contacts);
-            UncertaintyPlanningState& goal_state_candidate = nearest_neighbors_storage_.back().GetValueMutable();
             // NOTE - this assumes (safely) that the state passed to this function is the last state added to the tree, which we can safely mutate!
+            return GoalReachedGoalState((int64_t)nearest_neighbors_storage_.size() - 1, goal_state);
+        }
+
+        inline bool GoalReachedGoalState(
+                const int64_t candidate_index,
+                const UncertaintyPlanningState& goal_state)
+        {
+            UncertaintyPlanningState& goal_state_candidate = nearest_neighbors_storage_[(size_t)candidate_index].GetValueMutable();
+            if (goal_state_candidate.IsTransposition())
+            {
+                return TranspositionGoalReached(candidate_index);
+            }
             // We only care about states with control input == goal position (states that are directly trying to go to the goal)
             if (robot_ptr_->ComputeConfigurationDistance(goal_state_candidate.GetCommand(), goal_state.GetExpectation()) == 0.0)
             {
@@ -2134,10 +3292,35 @@ namespace uncertainty_planning_core
             return false;
         }
 
+        /*
+         * Transpositions (states identical to an earlier state in the tree, see UncertaintyPlannerState) are never expanded,
+         * so they reach the goal exactly when the state they duplicate does. This registers the provided state as a
+         * transposition and treats it as a goal if the state it duplicates already reaches the goal.
+         */
+        inline bool TranspositionGoalReached(const int64_t transposition_state_index)
+        {
+            UncertaintyPlanningState& transposition_state = nearest_neighbors_storage_[(size_t)transposition_state_index].GetValueMutable();
+            const int64_t duplicated_state_index = transposition_state.GetTranspositionIndex();
+            if ((duplicated_state_index < 0) || (duplicated_state_index >= transposition_state_index))
+            {
+                throw std::runtime_error("Transposition must refer to an earlier state in the tree");
+            }
+            transpositions_by_state_index_[duplicated_state_index].push_back(transposition_state_index);
+            const double duplicated_goal_probability = nearest_neighbors_storage_[(size_t)duplicated_state_index].GetValueImmutable().GetGoalPfeasibility();
+            if (duplicated_goal_probability > 0.0)
+            {
+                transposition_state.SetGoalPfeasibility(duplicated_goal_probability);
+                Log("Transposition " + std::to_string(transposition_state_index) + " of state " + std::to_string(duplicated_state_index) + " reaches the goal with probability " + std::to_string(duplicated_goal_probability), 2);
+                return true;
+            }
+            return false;
+        }
+
         inline void GoalReachedCallback(
                 UncertaintyPlanningTree& tree,
                 const int64_t new_goal_state_idx,
                 const uint32_t planner_action_try_attempts,
+                const bool include_spur_actions,
                 const std::chrono::time_point<std::chrono::high_resolution_clock>& start_time)
         {
             UncertaintyPlanningTreeState& new_goal = tree[new_goal_state_idx];
@@ -2178,17 +3361,53 @@ namespace uncertainty_planning_core
                 throw std::runtime_error("new_goal cannot reach the goal (GoalPfeasibility() == 0)");
             }
             // Backtrack up the tree, updating states as we go
+            // Only the transition containing the changed child needs to be recomputed at each state, and once a state's
+            // P(goal reached) stops changing, none of its ancestors can change either, so we can stop early
+            std::vector<int64_t> changed_state_indices(1, new_goal_state_idx);
+            int64_t changed_child_index = new_goal_state_idx;
             int64_t probability_update_index = new_goal.GetParentIndex();
             while (probability_update_index >= 0)
             {
-                // Get the current state that we're looking at
-                UncertaintyPlanningTreeState& current_state = nearest_neighbors_storage_[(size_t)probability_update_index];
                 // Update the state
-                UpdateNodeGoalReachedProbability(current_state, planner_action_try_attempts);
-                probability_update_index = current_state.GetParentIndex();
+                const bool goal_probability_changed = UpdateNodeGoalReachedProbability(probability_update_index, changed_child_index, planner_action_try_attempts);
+                if (!goal_probability_changed)
+                {
+                    break;
+                }
+                changed_state_indices.push_back(probability_update_index);
+                changed_child_index = probability_update_index;
+                probability_update_index = nearest_neighbors_storage_[(size_t)probability_update_index].GetParentIndex();
+            }
+            // Extend the live policy tree before updating transpositions, which must be added after the states they duplicate
+            if (IsAnytimePolicyEnabled())
+            {
+                UpdateLivePolicyTree(changed_state_indices, include_spur_actions);
+            }
+            // Transpositions of the changed states reach the goal with the same probability, so they are updated like new goals.
+            // Transpositions never refer to a state that can reach them (see TaskPlannerAdapter), so this recursion terminates
+            for (size_t idx = 0; idx < changed_state_indices.size(); idx++)
+            {
+                const int64_t changed_state_index = changed_state_indices[idx];
+                const auto found_itr = transpositions_by_state_index_.find(changed_state_index);
+                if (found_itr == transpositions_by_state_index_.end())
+                {
+                    continue;
+                }
+                const double changed_goal_probability = nearest_neighbors_storage_[(size_t)changed_state_index].GetValueImmutable().GetGoalPfeasibility();
+                const std::vector<int64_t> transposition_indices = found_itr->second;
+                for (size_t tdx = 0; tdx < transposition_indices.size(); tdx++)
+                {
+                    const int64_t transposition_index = transposition_indices[tdx];
+                    UncertaintyPlanningState& transposition_state = nearest_neighbors_storage_[(size_t)transposition_index].GetValueMutable();
+                    if ((changed_goal_probability > 0.0) && (transposition_state.GetGoalPfeasibility() != changed_goal_probability))
+                    {
+                        transposition_state.SetGoalPfeasibility(changed_goal_probability);
+                        GoalReachedCallback(tree, transposition_index, planner_action_try_attempts, include_spur_actions, start_time);
+                    }
+                }
             }
             // Get the goal reached probability that we use to decide when we're done
-            total_goal_reached_probability_ = nearest_neighbors_storage_[0].GetValueImmutable().GetGoalPfeasibility();
+            total_goal_reached_probability_ = nearest_neighbors_storage_[(size_t)planning_root_index_].GetValueImmutable().GetGoalPfeasibility();
             Log("Updated goal reached probability to " + std::to_string(total_goal_reached_probability_), 2);
         }
 
@@ -2248,7 +3467,9 @@ namespace uncertainty_planning_core
                         const int64_t other_child_index = other_parent_children[idx];
                         const UncertaintyPlanningTreeState& other_child_tree_state = nearest_neighbors_storage_[(size_t)other_child_index];
                         const UncertaintyPlanningState& other_child_state = other_child_tree_state.GetValueImmutable();
-                        if (other_child_state.GetTransitionId() == state.GetValueImmutable().GetTransitionId() && other_child_state.UseForNearestNeighbors())
+                        // Transpositions are never expanded, so they are only resolved once they reach the goal
+                        const bool other_child_unresolved = other_child_state.IsTransposition() ? (other_child_state.GetGoalPfeasibility() <= 0.0) : other_child_state.UseForNearestNeighbors();
+                        if (other_child_state.GetTransitionId() == state.GetValueImmutable().GetTransitionId() && other_child_unresolved)
                         {
                             other_children_blacklisted = false;
                         }
@@ -2263,8 +3484,8 @@ namespace uncertainty_planning_core
                     }
                 }
             }
-            // 3) The parent of the current node is the root of the tree
-            const bool parent_is_root = (state.GetParentIndex() == 0);
+            // 3) The parent of the current node is the root of the tree (or of the subtree being replanned)
+            const bool parent_is_root = (state.GetParentIndex() == planning_root_index_);
             // If one or more condition is true, the state is a branch root
             if (has_low_probability_transition || is_child_of_unresolved_split || parent_is_root)
             {
@@ -2276,11 +3497,13 @@ namespace uncertainty_planning_core
             }
         }
 
-        inline void UpdateNodeGoalReachedProbability(
-                UncertaintyPlanningTreeState& current_node,
+        inline bool UpdateNodeGoalReachedProbability(
+                const int64_t current_node_index,
+                const int64_t changed_child_index,
                 const uint32_t planner_action_try_attempts)
         {
-            // Check all the children of the current node, and update the node's goal reached probability accordingly
+            UncertaintyPlanningTreeState& current_node = nearest_neighbors_storage_[(size_t)current_node_index];
+            // Check the children of the current node, and update the node's goal reached probability accordingly
             //
             // Naively, the goal reached probability of a node is the maximum of the child goal reached probabilities;
             // intuitively, the probability of reaching the goal is that of reaching the goal if we follow the best child.
@@ -2289,35 +3512,37 @@ namespace uncertainty_planning_core
             // makes this more compilcated. For split child states, the goal reached probability of the split is the sum
             // over every split option of (split goal probability * probability of split)
             //
-            // We can identify split nodes as children which share a transition id
-            // First, we go through the children and separate them based on transition id (this puts all the children of a
-            // split together in one place)
-            std::map<uint64_t, std::vector<int64_t>> effective_child_branches;
+            // We can identify split nodes as children which share a transition id. Since only the changed child's goal
+            // reached probability has changed, we only need to recompute the transition that produced it (this puts all
+            // the children of a split together in one place); the other transitions are cached from earlier updates.
+            // Transitions that have never been updated have no children that reach the goal, so their probability is zero.
+            const uint64_t changed_transition_id = nearest_neighbors_storage_[(size_t)changed_child_index].GetValueImmutable().GetTransitionId();
+            std::vector<int64_t> changed_transition_child_indices;
             for (size_t idx = 0; idx < current_node.GetChildIndices().size(); idx++)
             {
                 const int64_t& current_child_index = current_node.GetChildIndices()[idx];
                 const uint64_t& child_transition_id = nearest_neighbors_storage_[(size_t)current_child_index].GetValueImmutable().GetTransitionId();
-                effective_child_branches[child_transition_id].push_back(current_child_index);
-            }
-            // Now that we have the transitions separated out, compute the goal probability of each transition
-            std::vector<double> effective_child_branch_probabilities;
-            for (auto itr = effective_child_branches.begin(); itr != effective_child_branches.end(); ++itr)
-            {
-                const double transition_goal_probability = ComputeTransitionGoalProbability(itr->second, planner_action_try_attempts);
-                effective_child_branch_probabilities.push_back(transition_goal_probability);
+                if (child_transition_id == changed_transition_id)
+                {
+                    changed_transition_child_indices.push_back(current_child_index);
+                }
             }
+            std::map<uint64_t, double>& transition_goal_probabilities = transition_goal_probability_cache_[current_node_index];
+            transition_goal_probabilities[changed_transition_id] = ComputeTransitionGoalProbability(changed_transition_child_indices, planner_action_try_attempts);
             // Now, get the highest transtion probability
             double max_transition_probability = 0.0;
-            if (effective_child_branch_probabilities.size() > 0)
+            for (auto itr = transition_goal_probabilities.begin(); itr != transition_goal_probabilities.end(); ++itr)
             {
-                max_transition_probability = *std::max_element(effective_child_branch_probabilities.begin(), effective_child_branch_probabilities.end());
+                max_transition_probability = std::max(max_transition_probability, itr->second);
             }
             if ((max_transition_probability < 0.0) || (max_transition_probability > 1.0))
             {
                 throw std::runtime_error("max_transition_probability out of range [0, 1]");
             }
             // Update the current state
+            const double previous_goal_probability = current_node.GetValueImmutable().GetGoalPfeasibility();
             current_node.GetValueMutable().SetGoalPfeasibility(max_transition_probability);
+            return (max_transition_probability != previous_goal_probability);
         }
 
         inline double ComputeTransitionGoalProbability(
@@ -2358,6 +3583,10 @@ namespace uncertainty_planning_core
                 // We do this the right way
                 std::vector<double> action_outcomes_dependent_child_goal_reached_probabilities;
                 std::vector<double> action_outcomes_independent_child_goal_reached_probabilities;
+                // CORRECTION (TODO: is this right?) If it its not independent, we cannot reach it if we are not there!
+                // Only if a state has nominally independent outcomes can we expect particles that return to the parent
+                // to actually reach a different outcome in future repeats
+                const RetryProbabilitySolver retry_solver(child_nodes);
                 // For each child state, we compute the probability that we'll end up at each of the result states, accounting for try/retry with reversibility
                 // This lets us compare child states as if they were separate actions, so the overall P(goal reached) = max(child) P(goal reached | child)
                 for (size_t idx = 0; idx < child_nodes.size(); idx++)
@@ -2366,39 +3595,8 @@ namespace uncertainty_planning_core
                     const UncertaintyPlanningState& current_child = child_nodes[idx];
                     Log("Child node: " + current_child.Print(), 0);
                     // For the selected child, we keep track of the probability that we reach the goal directly via the child state AND the probability that we reach the goal from unintended other child states
-                    double percent_active = 1.0;
-                    double p_we_reached_goal = 0.0;
-                    double p_others_reached_goal = 0.0;
-                    for (uint32_t try_attempt = 0; try_attempt < planner_action_try_attempts; try_attempt++)
-                    {
-                        // How many particles got to our state on this attempt?
-                        const double p_reached = percent_active * current_child.GetRawEdgePfeasibility();
-                        p_we_reached_goal += (p_reached * current_child.GetGoalPfeasibility());
-                        // Update the percent of particles that are still usefully active
-                        // and the probability that the goal was reached via a different child
-                        double updated_percent_active = 0.0;
-                        for (size_t other_idx = 0; other_idx < child_nodes.size(); other_idx++)
-                        {
-                            if (other_idx != idx)
-                            {
-                                // Get the other child
-                                const UncertaintyPlanningState& other_child = child_nodes[other_idx];
-                                // CORRECTION (TODO: is this right?) If it its not independent, we cannot reach it if we are not there!
-                                // Only if this state has nominally independent outcomes can we expect particles that
-                                // return to the parent to actually reach a different outcome in future repeats
-                                if (other_child.IsActionOutcomeNominallyIndependent())
-                                {
-                                    const double p_reached_other = percent_active * other_child.GetRawEdgePfeasibility();
-                                    const double p_stuck_at_other = p_reached_other * (1.0 - other_child.GetReverseEdgePfeasibility());
-                                    const double p_reached_goal_from_other = p_stuck_at_other * other_child.GetGoalPfeasibility();
-                                    p_others_reached_goal += p_reached_goal_from_other;
-                                    const double p_returned_to_parent = p_reached_other * other_child.GetReverseEdgePfeasibility();
-                                    updated_percent_active += p_returned_to_parent;
-                                }
-                            }
-                        }
-                        percent_active = updated_percent_active;
-                    }
+                    const double p_we_reached_goal = retry_solver.ComputeDirectGoalReachedProbability(idx, planner_action_try_attempts);
+                    const double p_others_reached_goal = retry_solver.ComputeIndirectGoalReachedProbability(idx, planner_action_try_attempts);
                     Log("P(child->goal) via ourself " + std::to_string(p_we_reached_goal), 0);
                     Log("P(child->goal) via others " + std::to_string(p_others_reached_goal), 0);
                     double p_reached_goal = p_we_reached_goal + p_others_reached_goal;
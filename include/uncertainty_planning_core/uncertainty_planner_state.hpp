@@ -30,7 +30,13 @@ protected:
   Configuration command_;
   Eigen::VectorXd variances_;
   Eigen::VectorXd space_independent_variances_;
-  std::vector<Configuration, ConfigAlloc> particles_;
+  // Particles are immutable once set and are shared between copies of the
+  // state, so copying states (e.g. into policy graphs) does not copy them
+  std::shared_ptr<std::vector<Configuration, ConfigAlloc>> particles_;
+  // Opaque summary of the particles computed by the outcome clustering (see
+  // SimpleOutcomeClusteringInterface::ComputeClusterDescriptor), shared like
+  // the particles. Null if the state has no descriptor.
+  std::shared_ptr<const std::vector<uint8_t>> cluster_descriptor_;
   double step_size_;
   double parent_motion_Pfeasibility_;
   double raw_edge_Pfeasibility_;
@@ -44,6 +50,10 @@ protected:
   uint64_t transition_id_;
   uint64_t reverse_transition_id_;
   uint64_t split_id_;
+  // Tree index of an identical state that this state is a transposition of,
+  // or -1. Transpositions are not expanded; their subtree is the subtree of
+  // the identical state, which turns the planner tree into a DAG.
+  int64_t transposition_index_;
   uint32_t attempt_count_;
   uint32_t reached_count_;
   uint32_t reverse_attempt_count_;
@@ -53,6 +63,29 @@ protected:
   bool use_for_nearest_neighbors_;
   bool action_outcome_is_nominally_independent_;
 
+  const std::vector<Configuration, ConfigAlloc>& Particles() const
+  {
+    return *particles_;
+  }
+
+  // Type ID markers - states serialized with the first marker predate cluster
+  // descriptors and don't contain one, and states serialized with the second
+  // marker predate transposition indices
+  static uint64_t QualifiedTypeIdMarker()
+  {
+    return std::numeric_limits<uint64_t>::max();
+  }
+
+  static uint64_t QualifiedTypeIdWithClusterDescriptorMarker()
+  {
+    return std::numeric_limits<uint64_t>::max() - 1u;
+  }
+
+  static uint64_t QualifiedTypeIdWithTranspositionMarker()
+  {
+    return std::numeric_limits<uint64_t>::max() - 2u;
+  }
+
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
@@ -83,7 +116,8 @@ public:
     }
     const uint64_t start_buffer_size = buffer.size();
     // First thing we save is the qualified type id
-    SerializeMemcpyable<uint64_t>(std::numeric_limits<uint64_t>::max(), buffer);
+    SerializeMemcpyable<uint64_t>(
+        QualifiedTypeIdWithTranspositionMarker(), buffer);
     SerializeString<char>(GetConfigurationType(), buffer);
     SerializeMemcpyable<uint8_t>((uint8_t)has_particles_, buffer);
     SerializeMemcpyable<uint8_t>((uint8_t)use_for_nearest_neighbors_, buffer);
@@ -110,7 +144,12 @@ public:
     SerializeVectorXd(space_independent_variances_, buffer);
     // Serialize the particles
     SerializeVectorLike<Configuration, std::vector<Configuration, ConfigAlloc>>(
-        particles_, buffer, &ConfigSerializer::Serialize);
+        Particles(), buffer, &ConfigSerializer::Serialize);
+    // Serialize the cluster descriptor
+    SerializeVectorLike<uint8_t>(
+        GetClusterDescriptor(), buffer, &SerializeMemcpyable<uint8_t>);
+    // Serialize the transposition index
+    SerializeMemcpyable<int64_t>(transposition_index_, buffer);
     // Figure out how many bytes we wrote
     const uint64_t end_buffer_size = buffer.size();
     const uint64_t bytes_written = end_buffer_size - start_buffer_size;
@@ -138,8 +177,6 @@ public:
     // First thing we load and check is the qualified type ID so we know that
     // we're loading our state properly
     // First thing we save is the qualified type id
-    const uint64_t reference_qualified_type_id_hash
-        = std::numeric_limits<uint64_t>::max();
     const std::string reference_configuration_type = GetConfigurationType();
     const std::pair<uint64_t, uint64_t> deserialized_qualified_type_id_hash
         = DeserializeMemcpyable<uint64_t>(buffer, current_position);
@@ -150,7 +187,14 @@ public:
     // If the file used the legacy type ID, we can't safely check it
     // (std::hash is not required to be consistent across program executions!)
     // so we warn the user and continue
-    if (qualified_type_id_hash == reference_qualified_type_id_hash)
+    const bool has_serialized_transposition_index
+        = (qualified_type_id_hash == QualifiedTypeIdWithTranspositionMarker());
+    const bool has_serialized_cluster_descriptor
+        = (qualified_type_id_hash
+           == QualifiedTypeIdWithClusterDescriptorMarker())
+          || has_serialized_transposition_index;
+    if ((qualified_type_id_hash == QualifiedTypeIdMarker())
+        || has_serialized_cluster_descriptor)
     {
       const std::pair<std::string, uint64_t> deserialized_configuration_type
           = DeserializeString<char>(buffer, current_position);
@@ -283,8 +327,33 @@ public:
            = DeserializeVectorLike<Configuration,
                                    std::vector<Configuration, ConfigAlloc>>(
                buffer, current_position, &ConfigSerializer::Deserialize);
-    particles_ = deserialized_particles.first;
+    particles_ = std::make_shared<std::vector<Configuration, ConfigAlloc>>(
+        deserialized_particles.first);
     current_position += deserialized_particles.second;
+    // Load the cluster descriptor
+    cluster_descriptor_.reset();
+    if (has_serialized_cluster_descriptor)
+    {
+      const std::pair<std::vector<uint8_t>, uint64_t>
+          deserialized_cluster_descriptor
+              = DeserializeVectorLike<uint8_t>(
+                  buffer, current_position, &DeserializeMemcpyable<uint8_t>);
+      if (deserialized_cluster_descriptor.first.size() > 0)
+      {
+        cluster_descriptor_ = std::make_shared<const std::vector<uint8_t>>(
+            deserialized_cluster_descriptor.first);
+      }
+      current_position += deserialized_cluster_descriptor.second;
+    }
+    // Load the transposition index
+    transposition_index_ = -1;
+    if (has_serialized_transposition_index)
+    {
+      const std::pair<int64_t, uint64_t> deserialized_transposition_index
+          = DeserializeMemcpyable<int64_t>(buffer, current_position);
+      transposition_index_ = deserialized_transposition_index.first;
+      current_position += deserialized_transposition_index.second;
+    }
     // Initialize the state
     initialized_ = true;
     // Return how many bytes we read from the buffer
@@ -297,8 +366,8 @@ public:
     state_id_ = 0u;
     step_size_ = 0.0;
     expectation_ = expectation;
-    particles_.clear();
-    particles_.push_back(expectation_);
+    particles_ = std::make_shared<std::vector<Configuration, ConfigAlloc>>(
+        1, expectation_);
     variance_ = 0.0;
     variances_ = Eigen::VectorXd();
     space_independent_variance_ = 0.0;
@@ -318,6 +387,7 @@ public:
     action_outcome_is_nominally_independent_ = true;
     command_ = expectation_;
     split_id_ = 0u;
+    transposition_index_ = -1;
     transition_id_ = 0;
     reverse_transition_id_ = 0;
     goal_Pfeasibility_ = 0.0;
@@ -337,8 +407,8 @@ public:
     state_id_ = state_id;
     step_size_ = step_size;
     expectation_ = particle;
-    particles_.clear();
-    particles_.push_back(expectation_);
+    particles_ = std::make_shared<std::vector<Configuration, ConfigAlloc>>(
+        1, expectation_);
     variance_ = 0.0;
     variances_ = Eigen::VectorXd();
     space_independent_variance_ = 0.0;
@@ -363,6 +433,7 @@ public:
     transition_id_ = transition_id;
     reverse_transition_id_ = reverse_transition_id;
     split_id_ = split_id;
+    transposition_index_ = -1;
     goal_Pfeasibility_ = 0.0;
   }
 
@@ -380,7 +451,9 @@ public:
   {
       state_id_ = state_id;
       step_size_ = step_size;
-      particles_ = particles;
+      particles_
+          = std::make_shared<std::vector<Configuration, ConfigAlloc>>(
+              particles);
       attempt_count_ = attempt_count;
       reached_count_ = reached_count;
       reverse_attempt_count_ = reverse_attempt_count;
@@ -401,6 +474,7 @@ public:
       transition_id_ = transition_id;
       reverse_transition_id_ = reverse_transition_id;
       split_id_ = split_id;
+      transposition_index_ = -1;
       goal_Pfeasibility_ = 0.0;
   }
 
@@ -438,9 +512,13 @@ public:
 
   inline UncertaintyPlannerState()
     : goal_Pfeasibility_(0.0), state_id_(0), transition_id_(0),
-      reverse_transition_id_(0), split_id_(0u), initialized_(false),
+      reverse_transition_id_(0), split_id_(0u), transposition_index_(-1),
+      initialized_(false),
       has_particles_(false), use_for_nearest_neighbors_(false),
-      action_outcome_is_nominally_independent_(false) {}
+      action_outcome_is_nominally_independent_(false)
+  {
+    particles_ = std::make_shared<std::vector<Configuration, ConfigAlloc>>();
+  }
 
   bool IsInitialized() const { return initialized_; }
 
@@ -548,11 +626,52 @@ public:
 
   uint64_t GetSplitId() const { return split_id_; }
 
+  bool IsTransposition() const { return (transposition_index_ >= 0); }
+
+  int64_t GetTranspositionIndex() const { return transposition_index_; }
+
+  void SetTranspositionIndex(const int64_t transposition_index)
+  {
+    transposition_index_ = transposition_index;
+  }
+
   const Configuration& GetCommand() const { return command_; }
 
   void SetCommand(const Configuration& command) { command_ = command; }
 
-  size_t GetNumParticles() const { return particles_.size(); }
+  size_t GetNumParticles() const { return Particles().size(); }
+
+  bool HasClusterDescriptor() const
+  {
+    return static_cast<bool>(cluster_descriptor_);
+  }
+
+  // Returns an empty descriptor if the state has none
+  const std::vector<uint8_t>& GetClusterDescriptor() const
+  {
+    static const std::vector<uint8_t> empty_cluster_descriptor;
+    if (cluster_descriptor_)
+    {
+      return *cluster_descriptor_;
+    }
+    else
+    {
+      return empty_cluster_descriptor;
+    }
+  }
+
+  void SetClusterDescriptor(const std::vector<uint8_t>& cluster_descriptor)
+  {
+    if (cluster_descriptor.size() > 0)
+    {
+      cluster_descriptor_
+          = std::make_shared<const std::vector<uint8_t>>(cluster_descriptor);
+    }
+    else
+    {
+      cluster_descriptor_.reset();
+    }
+  }
 
   common_robotics_utilities::ReferencingMaybe<
       const std::vector<Configuration, ConfigAlloc>>
@@ -562,7 +681,7 @@ public:
     if (has_particles_)
     {
       return ReferencingMaybe<const std::vector<Configuration, ConfigAlloc>>(
-          particles_);
+          Particles());
     }
     else
     {
@@ -576,8 +695,17 @@ public:
     using common_robotics_utilities::ReferencingMaybe;
     if (has_particles_)
     {
+      // The descriptor no longer matches once the particles are modified
+      cluster_descriptor_.reset();
+      // Copy-on-write, since the particles may be shared with other copies
+      if (particles_.use_count() > 1)
+      {
+        particles_
+            = std::make_shared<std::vector<Configuration, ConfigAlloc>>(
+                *particles_);
+      }
       return ReferencingMaybe<std::vector<Configuration, ConfigAlloc>>(
-          particles_);
+          *particles_);
     }
     else
     {
@@ -588,21 +716,21 @@ public:
   std::vector<Configuration, ConfigAlloc> CollectParticles(
       const size_t num_particles) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return std::vector<Configuration, ConfigAlloc>(
           num_particles, expectation_);
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
       return std::vector<Configuration, ConfigAlloc>(
-          num_particles, particles_[0]);
+          num_particles, Particles()[0]);
     }
     else
     {
-      if (num_particles == particles_.size())
+      if (num_particles == Particles().size())
       {
-        return particles_;
+        return Particles();
       }
       else
       {
@@ -618,30 +746,30 @@ public:
   std::vector<Configuration, ConfigAlloc> ResampleParticles(
       const size_t num_particles, RNG& rng) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return std::vector<Configuration, ConfigAlloc>(
             num_particles, expectation_);
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
       return std::vector<Configuration, ConfigAlloc>(
-            num_particles, particles_[0]);
+            num_particles, Particles()[0]);
     }
     else
     {
       std::vector<Configuration, ConfigAlloc> resampled_particles(
           num_particles);
-      double particle_probability = 1.0 / (double)particles_.size();
+      double particle_probability = 1.0 / (double)Particles().size();
       std::uniform_int_distribution<size_t> resampling_distribution(
-          0, particles_.size() - 1);
+          0, Particles().size() - 1);
       std::uniform_real_distribution<double> importance_sampling_distribution(
           0.0, 1.0);
       size_t resampled = 0;
       while (resampled < num_particles)
       {
         size_t random_index = resampling_distribution(rng);
-        const Configuration& random_particle = particles_[random_index];
+        const Configuration& random_particle = Particles()[random_index];
         if (importance_sampling_distribution(rng) < particle_probability)
         {
           resampled_particles[resampled] = random_particle;
@@ -670,17 +798,17 @@ public:
       const std::function<Configuration(
           const std::vector<Configuration, ConfigAlloc>&)>& average_fn) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return expectation_;
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
-      return particles_[0];
+      return Particles()[0];
     }
     else
     {
-      return average_fn(particles_);
+      return average_fn(Particles());
     }
   }
 
@@ -689,21 +817,21 @@ public:
       const std::function<double(
           const Configuration&, const Configuration&)>& distance_fn) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return 0.0;
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
       return 0.0;
     }
     else
     {
-      const double weight = 1.0 / (double)particles_.size();
+      const double weight = 1.0 / (double)Particles().size();
       double var_sum = 0.0;
-      for (size_t idx = 0; idx < particles_.size(); idx++)
+      for (size_t idx = 0; idx < Particles().size(); idx++)
       {
-        const double raw_distance = distance_fn(expectation, particles_[idx]);
+        const double raw_distance = distance_fn(expectation, Particles()[idx]);
         const double squared_distance = pow(raw_distance, 2.0);
         var_sum += (squared_distance * weight);
       }
@@ -717,21 +845,21 @@ public:
           const Configuration&, const Configuration&)>& distance_fn,
       const double step_size) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return 0.0;
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
       return 0.0;
     }
     else
     {
-      const double weight = 1.0 / (double)particles_.size();
+      const double weight = 1.0 / (double)Particles().size();
       double var_sum = 0.0;
-      for (size_t idx = 0; idx < particles_.size(); idx++)
+      for (size_t idx = 0; idx < Particles().size(); idx++)
       {
-        const double raw_distance = distance_fn(expectation, particles_[idx]);
+        const double raw_distance = distance_fn(expectation, Particles()[idx]);
         const double space_independent_distance = raw_distance / step_size;
         const double squared_distance = pow(space_independent_distance, 2.0);
         var_sum += (squared_distance * weight);
@@ -745,22 +873,22 @@ public:
       const std::function<Eigen::VectorXd(
           const Configuration&, const Configuration&)>& dim_distance_fn) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return dim_distance_fn(expectation, expectation);
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
-      return dim_distance_fn(particles_[0], particles_[0]);
+      return dim_distance_fn(Particles()[0], Particles()[0]);
     }
     else
     {
-      const double weight = 1.0 / (double)particles_.size();
+      const double weight = 1.0 / (double)Particles().size();
       Eigen::VectorXd variances;
-      for (size_t idx = 0; idx < particles_.size(); idx++)
+      for (size_t idx = 0; idx < Particles().size(); idx++)
       {
         const Eigen::VectorXd error
-            = dim_distance_fn(expectation, particles_[idx]);
+            = dim_distance_fn(expectation, Particles()[idx]);
         const Eigen::VectorXd squared_error = error.cwiseProduct(error);
         const Eigen::VectorXd weighted_squared_error = squared_error * weight;
         if (variances.size() != weighted_squared_error.size())
@@ -779,22 +907,22 @@ public:
           const Configuration&, const Configuration&)>& dim_distance_fn,
       const double step_size) const
   {
-    if (particles_.size() == 0)
+    if (Particles().size() == 0)
     {
       return dim_distance_fn(expectation, expectation);
     }
-    else if (particles_.size() == 1)
+    else if (Particles().size() == 1)
     {
-      return dim_distance_fn(particles_[0], particles_[0]);
+      return dim_distance_fn(Particles()[0], Particles()[0]);
     }
     else
     {
-      const double weight = 1.0 / (double)particles_.size();
+      const double weight = 1.0 / (double)Particles().size();
       Eigen::VectorXd variances;
-      for (size_t idx = 0; idx < particles_.size(); idx++)
+      for (size_t idx = 0; idx < Particles().size(); idx++)
       {
         const Eigen::VectorXd error
-            = dim_distance_fn(expectation, particles_[idx]);
+            = dim_distance_fn(expectation, Particles()[idx]);
         const Eigen::VectorXd space_independent_error = error / step_size;
         const Eigen::VectorXd squared_error
             = space_independent_error.cwiseProduct(space_independent_error);
@@ -16,6 +16,7 @@
 #include <common_robotics_utilities/simple_robot_model_interface.hpp>
 #include <common_robotics_utilities/zlib_helpers.hpp>
 #include <uncertainty_planning_core/execution_policy.hpp>
+#include <uncertainty_planning_core/outcome_clustering.hpp>
 #include <uncertainty_planning_core/simple_simulator_interface.hpp>
 #include <uncertainty_planning_core/uncertainty_planner_state.hpp>
 #include <uncertainty_planning_core/uncertainty_contact_planning.hpp>
@@ -138,6 +139,8 @@ namespace uncertainty_planning_core
     using VectorXdSimulatorPtr = std::shared_ptr<VectorXdSimulator>;
     using VectorXdClustering = SimpleOutcomeClusteringInterface<VectorXdConfig, VectorXdConfigAlloc>;
     using VectorXdClusteringPtr = std::shared_ptr<VectorXdClustering>;
+    using VectorXdGridClustering = GridOutcomeClustering<VectorXdConfig, VectorXdConfigAlloc>;
+    using VectorXdDBSCANClustering = KDTreeDBSCANOutcomeClustering;
     using VectorXdPlanningSpace = UncertaintyPlanningSpace<VectorXdConfig, VectorXdConfigSerializer, VectorXdConfigAlloc, PRNG>;
 
     // Policy and tree type definitions